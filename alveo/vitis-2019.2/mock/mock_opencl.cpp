@@ -0,0 +1,1122 @@
+/**
+ * Stand-in for the Xilinx OpenCL runtime that emulates an Alveo card running
+ * the krnl_word_match_rtl kernel. It implements the subset of the OpenCL API
+ * used by the host code, and is loaded in place of XRT's libOpenCL through
+ * `$LD_LIBRARY_PATH`. This allows the hardware path of the host library
+ * (scheduling, buffer management and result decoding) to be run, profiled
+ * and tested on machines without an Alveo card.
+ *
+ * The kernel follows the argument layout of `src/kernel.xml`, and the matcher
+ * semantics of `hardware/vhdl/WordMatch_Matcher.py`. Instead of measuring
+ * cycles, it computes them from a simple throughput model of the hardware.
+ * The following environment variables configure the emulated cards:
+ *
+ *  - `WORD_MATCH_MOCK_DEVICE`: device name, used to select the xclbin file
+ *    (default `xilinx_u200_xdma_201920_1`);
+ *  - `WORD_MATCH_MOCK_CARDS`: number of identical cards (default 1);
+ *  - `WORD_MATCH_MOCK_CUS`: number of kernel instances (default 15);
+ *  - `WORD_MATCH_MOCK_CLOCK`: kernel clock frequency in MHz (default 300);
+ *  - `WORD_MATCH_MOCK_REALTIME`: when set to a nonzero value, kernel runs take
+ *    as long as the modeled number of cycles would take on the card.
+ */
+
+#include <CL/cl.h>
+#include <CL/cl_ext_xilinx.h>
+#include <snappy.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Configuration of the emulated cards, read from the environment once.
+ */
+struct MockConfig {
+    std::string device_name = "xilinx_u200_xdma_201920_1";
+    unsigned int num_cards = 1;
+    unsigned int num_cus = 15;
+    double clock = 300.0;
+    bool realtime = false;
+
+    MockConfig() {
+        const char *env = getenv("WORD_MATCH_MOCK_DEVICE");
+        if (env != NULL && env[0]) device_name = env;
+        env = getenv("WORD_MATCH_MOCK_CARDS");
+        if (env != NULL && atoi(env) > 0) num_cards = atoi(env);
+        env = getenv("WORD_MATCH_MOCK_CUS");
+        if (env != NULL && atoi(env) > 0) num_cus = atoi(env);
+        env = getenv("WORD_MATCH_MOCK_CLOCK");
+        if (env != NULL && atof(env) > 0) clock = atof(env);
+        env = getenv("WORD_MATCH_MOCK_REALTIME");
+        realtime = env != NULL && atoi(env) != 0;
+    }
+};
+
+static const MockConfig &config() {
+    static MockConfig config;
+    return config;
+}
+
+// Number of DDR banks and their size.
+static const int NUM_BANKS = 4;
+static const uint64_t BANK_SIZE = 16ull << 30;
+
+// Required alignment of host pointers used directly by buffers.
+static const uintptr_t HOST_PAGE_SIZE = 4096;
+
+// Throughput model of the kernel. The sub-kernels share a 64-bit memory
+// interface for reading the compressed articles, while each has its own
+// decompressor and matcher processing 8 characters per cycle. Every article
+// additionally costs a fixed number of cycles for the commands and match
+// count handshakes, every result record for writing it, and every run for
+// starting up and writing the statistics.
+static const uint64_t BUS_BYTES_PER_CYCLE = 8;
+static const uint64_t MATCHER_CHARS_PER_CYCLE = 8;
+static const uint64_t ARTICLE_CYCLES = 20;
+static const uint64_t RECORD_CYCLES = 4;
+static const uint64_t RUN_CYCLES = 200;
+
+// Layout of the kernel arguments, see `src/kernel.xml`.
+static const cl_uint ARG_TITLE_OFFS = 0;
+static const cl_uint ARG_TITLE_VAL = 1;
+static const cl_uint ARG_TEXT_OFFS = 2;
+static const cl_uint ARG_TEXT_VAL = 3;
+static const cl_uint ARG_INDEX = 4;
+static const cl_uint ARG_RES_TITLE_OFFS = 8;
+static const cl_uint ARG_RES_TITLE_VAL = 9;
+static const cl_uint ARG_RES_MATCH = 10;
+static const cl_uint ARG_RESULT_SIZE = 11;
+static const cl_uint ARG_RES_STATS = 12;
+static const cl_uint ARG_PATTERN = 13;
+static const cl_uint ARG_SEARCH_CFG = 21;
+static const cl_uint NUM_ARGS = 22;
+static const unsigned int NUM_SUBKERNELS = 3;
+static const char *KERNEL_NAME = "krnl_word_match_rtl";
+
+/**
+ * Returns whether the given kernel argument is a buffer.
+ */
+static bool arg_is_mem(cl_uint index) {
+    return index <= ARG_TEXT_VAL
+        || (index >= ARG_RES_TITLE_OFFS && index <= ARG_RES_MATCH)
+        || index == ARG_RES_STATS;
+}
+
+/**
+ * Base class for reference-counted OpenCL objects.
+ */
+class MockObject {
+private:
+    std::atomic<unsigned int> refs;
+
+public:
+    MockObject() : refs(1) {}
+    virtual ~MockObject() = default;
+
+    void retain() {
+        refs++;
+    }
+
+    void release() {
+        if (--refs == 0) {
+            delete this;
+        }
+    }
+};
+
+struct _cl_platform_id {
+};
+
+struct _cl_device_id {
+
+    // Parent device for the sub-devices representing kernel instances, or
+    // null for the card itself.
+    _cl_device_id *parent = NULL;
+
+    // Index of the kernel instance for sub-devices.
+    unsigned int cu_index = 0;
+
+    // Sub-devices and allocated memory per bank for the card itself.
+    std::vector<std::unique_ptr<_cl_device_id>> subdevices;
+    std::mutex mutex;
+    uint64_t bank_usage[NUM_BANKS] = {0};
+
+    /**
+     * Returns the card this device belongs to.
+     */
+    _cl_device_id *card() {
+        return parent ? parent : this;
+    }
+
+    /**
+     * Returns the DDR bank that the m_axi port of the kernel instance is
+     * connected to, using the same connectivity as the makefile: groups of
+     * five instances are connected to banks 0, 1 and 3 on the U200, or banks
+     * 0, 1 and 2 on the U250.
+     */
+    int bank() const {
+        static const int u200_banks[NUM_BANKS] = {0, 1, 3, 2};
+        static const int u250_banks[NUM_BANKS] = {0, 1, 2, 3};
+        bool u250 = config().device_name.find("u250") != std::string::npos;
+        return (u250 ? u250_banks : u200_banks)[(cu_index / 5) % NUM_BANKS];
+    }
+};
+
+/**
+ * Returns the emulated platform and cards.
+ */
+static _cl_platform_id *platform() {
+    static _cl_platform_id platform;
+    return &platform;
+}
+
+static const std::vector<_cl_device_id*> &cards() {
+    static std::vector<_cl_device_id*> cards = []() {
+        std::vector<_cl_device_id*> cards;
+        for (unsigned int c = 0; c < config().num_cards; c++) {
+            auto card = new _cl_device_id();
+            for (unsigned int i = 0; i < config().num_cus; i++) {
+                card->subdevices.emplace_back(new _cl_device_id());
+                card->subdevices.back()->parent = card;
+                card->subdevices.back()->cu_index = i;
+            }
+            cards.push_back(card);
+        }
+        return cards;
+    }();
+    return cards;
+}
+
+struct _cl_context : public MockObject {
+    cl_device_id device;
+};
+
+struct _cl_program : public MockObject {
+    cl_context context;
+    bool built = false;
+
+    ~_cl_program() {
+        context->release();
+    }
+};
+
+struct _cl_mem : public MockObject {
+    cl_device_id card;
+    cl_mem_flags flags;
+    size_t size;
+    int bank = -1;
+    void *host_ptr = NULL;
+    std::vector<char> data;
+
+    ~_cl_mem() {
+        if (bank >= 0) {
+            std::lock_guard<std::mutex> lock(card->mutex);
+            card->bank_usage[bank] -= size;
+        }
+    }
+};
+
+/**
+ * Value of a kernel argument.
+ */
+struct MockArg {
+    bool set = false;
+    cl_mem mem = NULL;
+    uint32_t value = 0;
+};
+
+struct _cl_kernel : public MockObject {
+    cl_program program;
+    std::mutex mutex;
+    MockArg args[NUM_ARGS];
+
+    ~_cl_kernel() {
+        program->release();
+    }
+};
+
+struct _cl_event : public MockObject {
+    std::mutex mutex;
+    std::condition_variable cv;
+    cl_int status = CL_QUEUED;
+    cl_ulong queued = 0;
+    cl_ulong submit = 0;
+    cl_ulong start = 0;
+    cl_ulong end = 0;
+    bool profiling = false;
+
+    /**
+     * Blocks until the command completed, and returns its status.
+     */
+    cl_int wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]() { return status <= CL_COMPLETE; });
+        return status;
+    }
+};
+
+/**
+ * Returns the current time in nanoseconds for the profiling information.
+ */
+static cl_ulong now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * An enqueued command.
+ */
+struct MockCommand {
+    cl_event event;
+    std::vector<cl_event> wait_list;
+    std::function<cl_int()> work;
+};
+
+struct _cl_command_queue : public MockObject {
+    cl_context context;
+    cl_device_id device;
+    bool profiling;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<MockCommand> commands;
+    bool busy = false;
+    bool stop = false;
+    std::thread worker;
+
+    /**
+     * Executes the enqueued commands in order.
+     */
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [this]() { return stop || !commands.empty(); });
+            if (commands.empty()) {
+                return;
+            }
+            MockCommand command = std::move(commands.front());
+            commands.pop_front();
+            busy = true;
+            lock.unlock();
+
+            cl_event event = command.event;
+            {
+                std::lock_guard<std::mutex> event_lock(event->mutex);
+                event->status = CL_SUBMITTED;
+                event->submit = now_ns();
+            }
+            cl_int status = CL_COMPLETE;
+            for (auto dep : command.wait_list) {
+                if (dep->wait() != CL_COMPLETE) {
+                    status = CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST;
+                }
+                dep->release();
+            }
+            {
+                std::lock_guard<std::mutex> event_lock(event->mutex);
+                event->status = CL_RUNNING;
+                event->start = now_ns();
+            }
+            if (status == CL_COMPLETE) {
+                status = command.work();
+            }
+            command.work = nullptr;
+            {
+                std::lock_guard<std::mutex> event_lock(event->mutex);
+                event->status = status;
+                event->end = now_ns();
+            }
+            event->cv.notify_all();
+            event->release();
+
+            lock.lock();
+            busy = false;
+            cv.notify_all();
+        }
+    }
+
+    /**
+     * Enqueues a command, returning its event through `event_out` if it is
+     * not null.
+     */
+    cl_int enqueue(cl_uint num_events, const cl_event *event_wait_list, cl_event *event_out, std::function<cl_int()> work) {
+        if ((num_events > 0) != (event_wait_list != NULL)) {
+            return CL_INVALID_EVENT_WAIT_LIST;
+        }
+        MockCommand command;
+        for (cl_uint i = 0; i < num_events; i++) {
+            if (event_wait_list[i] == NULL) {
+                return CL_INVALID_EVENT_WAIT_LIST;
+            }
+            event_wait_list[i]->retain();
+            command.wait_list.push_back(event_wait_list[i]);
+        }
+        command.event = new _cl_event();
+        command.event->profiling = profiling;
+        command.event->queued = now_ns();
+        command.work = std::move(work);
+        if (event_out != NULL) {
+            command.event->retain();
+            *event_out = command.event;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        commands.push_back(std::move(command));
+        cv.notify_all();
+        return CL_SUCCESS;
+    }
+
+    /**
+     * Blocks until all enqueued commands have completed.
+     */
+    void finish() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]() { return commands.empty() && !busy; });
+    }
+
+    ~_cl_command_queue() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+            cv.notify_all();
+        }
+        worker.join();
+        context->release();
+    }
+};
+
+/**
+ * Helpers for the clGet*Info() functions.
+ */
+static cl_int get_info(size_t size, void *value, size_t *size_ret, const void *data, size_t data_size) {
+    if (size_ret != NULL) {
+        *size_ret = data_size;
+    }
+    if (value != NULL) {
+        if (size < data_size) {
+            return CL_INVALID_VALUE;
+        }
+        memcpy(value, data, data_size);
+    }
+    return CL_SUCCESS;
+}
+
+static cl_int get_info_string(size_t size, void *value, size_t *size_ret, const std::string &str) {
+    return get_info(size, value, size_ret, str.c_str(), str.size() + 1);
+}
+
+template <typename T>
+static cl_int get_info_value(size_t size, void *value, size_t *size_ret, T data) {
+    return get_info(size, value, size_ret, &data, sizeof(T));
+}
+
+/**
+ * Counts the matches of the given pattern in the given article text, in the
+ * same way as the hardware matcher: overlapping matches are counted, and in
+ * whole-word mode the characters surrounding a match must not be
+ * `[a-zA-Z0-9_]` (the start and end of the article also count as word
+ * boundaries). The hardware count is 16 bits wide and wraps around.
+ */
+static uint16_t count_matches(const std::string &text, const std::string &pattern, bool whole_words) {
+    auto is_word = [](char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+    };
+    uint16_t count = 0;
+    if (text.size() < pattern.size()) {
+        return 0;
+    }
+    for (size_t i = 0; i + pattern.size() <= text.size(); i++) {
+        if (memcmp(&text[i], pattern.data(), pattern.size()) != 0) {
+            continue;
+        }
+        if (whole_words) {
+            if (i > 0 && is_word(text[i - 1])) continue;
+            size_t j = i + pattern.size();
+            if (j < text.size() && is_word(text[j])) continue;
+        }
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Helper for reporting errors detected while emulating the kernel.
+ */
+static cl_int kernel_error(const std::string &msg) {
+    fprintf(stderr, "mock %s: %s\n", KERNEL_NAME, msg.c_str());
+    return CL_INVALID_KERNEL_ARGS;
+}
+
+/**
+ * Emulates a run of the word matcher kernel with the given arguments, writing
+ * the result records and statistics to the result buffers.
+ */
+static cl_int run_word_match(const MockArg *args) {
+
+    // Decode the search configuration.
+    uint32_t search_cfg = args[ARG_SEARCH_CFG].value;
+    unsigned int first = search_cfg & 0xFF;
+    bool whole_words = (search_cfg >> 8) & 1;
+    uint16_t min_matches = search_cfg >> 16;
+    if (first >= 32) {
+        return kernel_error("empty search pattern");
+    }
+    char pattern_data[32];
+    for (unsigned int i = 0; i < 8; i++) {
+        memcpy(pattern_data + 4 * i, &args[ARG_PATTERN + i].value, 4);
+    }
+    std::string pattern(pattern_data + first, 32 - first);
+
+    // Check the article range of each sub-kernel against the input buffers.
+    cl_mem title_offs = args[ARG_TITLE_OFFS].mem;
+    cl_mem title_val = args[ARG_TITLE_VAL].mem;
+    cl_mem text_offs = args[ARG_TEXT_OFFS].mem;
+    cl_mem text_val = args[ARG_TEXT_VAL].mem;
+    uint32_t index[NUM_SUBKERNELS + 1];
+    for (unsigned int i = 0; i <= NUM_SUBKERNELS; i++) {
+        index[i] = args[ARG_INDEX + i].value;
+        if (i && index[i] < index[i - 1]) {
+            return kernel_error("article indices are not ascending");
+        }
+    }
+    uint64_t num_rows = std::min(title_offs->size, text_offs->size) / 4;
+    if (num_rows == 0 || index[NUM_SUBKERNELS] > num_rows - 1) {
+        return kernel_error("article index out of range of offsets buffers");
+    }
+    const uint32_t *title_offsets = (const uint32_t*)title_offs->data.data();
+    const uint32_t *text_offsets = (const uint32_t*)text_offs->data.data();
+
+    // Match the articles of each sub-kernel in order, recording when each
+    // sub-kernel would produce the match count for each article.
+    struct Count {
+        uint64_t cycle;
+        uint32_t row;
+        uint16_t amount;
+    };
+    std::vector<Count> counts;
+    uint64_t compressed_bytes = 0;
+    uint64_t matcher_cycles = 0;
+    std::string text;
+    for (unsigned int sub = 0; sub < NUM_SUBKERNELS; sub++) {
+        uint64_t cycle = 0;
+        for (uint32_t row = index[sub]; row < index[sub + 1]; row++) {
+            uint32_t start = text_offsets[row];
+            uint32_t end = text_offsets[row + 1];
+            if (end < start || end > text_val->size) {
+                return kernel_error("text offsets out of range of values buffer");
+            }
+            const char *data = text_val->data.data() + start;
+            size_t size = end - start;
+            size_t uncompressed_size = 0;
+            if (!snappy::GetUncompressedLength(data, size, &uncompressed_size)) {
+                return kernel_error("article " + std::to_string(row) + " is not valid snappy data");
+            }
+            text.resize(uncompressed_size);
+            if (!snappy::RawUncompress(data, size, &text[0])) {
+                return kernel_error("article " + std::to_string(row) + " is not valid snappy data");
+            }
+            compressed_bytes += size;
+            cycle += (uncompressed_size + MATCHER_CHARS_PER_CYCLE - 1) / MATCHER_CHARS_PER_CYCLE + ARTICLE_CYCLES;
+            counts.push_back({cycle, row, count_matches(text, pattern, whole_words)});
+        }
+        matcher_cycles = std::max(matcher_cycles, cycle);
+    }
+
+    // The filter receives the match counts in the order in which the
+    // sub-kernels produce them.
+    std::stable_sort(counts.begin(), counts.end(), [](const Count &a, const Count &b) {
+        return a.cycle < b.cycle;
+    });
+
+    // Check the sizes of the result buffers.
+    uint32_t result_size = args[ARG_RESULT_SIZE].value;
+    cl_mem res_title_offs = args[ARG_RES_TITLE_OFFS].mem;
+    cl_mem res_title_val = args[ARG_RES_TITLE_VAL].mem;
+    cl_mem res_match = args[ARG_RES_MATCH].mem;
+    cl_mem res_stats = args[ARG_RES_STATS].mem;
+    if (res_title_offs->size < (result_size + 1) * 4ull || res_match->size < result_size * 4ull) {
+        return kernel_error("result buffers are smaller than the result size");
+    }
+    if (res_stats->size < 20) {
+        return kernel_error("statistics buffer is too small");
+    }
+    uint32_t *result_title_offsets = (uint32_t*)res_title_offs->data.data();
+    uint32_t *result_matches = (uint32_t*)res_match->data.data();
+
+    // Filter the match counts, writing result records for the first
+    // `result_size` matching articles and accumulating the statistics.
+    uint32_t page_matches = 0;
+    uint32_t word_matches = 0;
+    uint16_t max_matches = 0;
+    uint32_t max_page_idx = 0;
+    uint32_t num_records = 0;
+    uint32_t title_values_size = 0;
+    result_title_offsets[0] = 0;
+    for (const auto &count : counts) {
+        if (count.amount >= min_matches) {
+            if (num_records < result_size) {
+                uint32_t start = title_offsets[count.row];
+                uint32_t end = title_offsets[count.row + 1];
+                if (end < start || end > title_val->size) {
+                    return kernel_error("title offsets out of range of values buffer");
+                }
+                if (title_values_size + (end - start) > res_title_val->size) {
+                    return kernel_error("result title values buffer overflow");
+                }
+                memcpy(res_title_val->data.data() + title_values_size, title_val->data.data() + start, end - start);
+                title_values_size += end - start;
+                result_matches[num_records] = count.amount;
+                result_title_offsets[++num_records] = title_values_size;
+            }
+            page_matches++;
+        }
+        if (count.amount >= max_matches) {
+            max_matches = count.amount;
+            max_page_idx = count.row & 0xFFFFF;
+        }
+        word_matches += count.amount;
+    }
+
+    // Unused result records are written with empty titles and no matches.
+    for (; num_records < result_size; num_records++) {
+        result_matches[num_records] = 0;
+        result_title_offsets[num_records + 1] = title_values_size;
+    }
+
+    // Model the number of cycles the run takes.
+    uint64_t bus_cycles = (compressed_bytes + BUS_BYTES_PER_CYCLE - 1) / BUS_BYTES_PER_CYCLE;
+    uint64_t cycles = RUN_CYCLES + std::max(matcher_cycles, bus_cycles) + result_size * RECORD_CYCLES;
+    uint32_t cycle_count = (uint32_t)std::min<uint64_t>(cycles, UINT32_MAX);
+
+    // Write the statistics.
+    uint32_t stats[5] = {page_matches, word_matches, max_matches, max_page_idx, cycle_count};
+    memcpy(res_stats->data.data(), stats, sizeof(stats));
+
+    // Take as long as the card would if requested.
+    if (config().realtime) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds((uint64_t)(cycles * 1000.0 / config().clock)));
+    }
+
+    return CL_SUCCESS;
+}
+
+extern "C" {
+
+cl_int clGetPlatformIDs(cl_uint num_entries, cl_platform_id *platforms, cl_uint *num_platforms) {
+    if ((num_entries == 0 && platforms != NULL) || (platforms == NULL && num_platforms == NULL)) {
+        return CL_INVALID_VALUE;
+    }
+    if (platforms != NULL) {
+        platforms[0] = platform();
+    }
+    if (num_platforms != NULL) {
+        *num_platforms = 1;
+    }
+    return CL_SUCCESS;
+}
+
+cl_int clGetPlatformInfo(cl_platform_id plat, cl_platform_info param_name, size_t size, void *value, size_t *size_ret) {
+    if (plat != platform()) {
+        return CL_INVALID_PLATFORM;
+    }
+    switch (param_name) {
+        case CL_PLATFORM_PROFILE: return get_info_string(size, value, size_ret, "EMBEDDED_PROFILE");
+        case CL_PLATFORM_VERSION: return get_info_string(size, value, size_ret, "OpenCL 1.0");
+        case CL_PLATFORM_NAME: return get_info_string(size, value, size_ret, "Xilinx");
+        case CL_PLATFORM_VENDOR: return get_info_string(size, value, size_ret, "Xilinx");
+        case CL_PLATFORM_EXTENSIONS: return get_info_string(size, value, size_ret, "");
+        default: return CL_INVALID_VALUE;
+    }
+}
+
+cl_int clGetDeviceIDs(cl_platform_id plat, cl_device_type device_type, cl_uint num_entries, cl_device_id *devices, cl_uint *num_devices) {
+    if (plat != platform()) {
+        return CL_INVALID_PLATFORM;
+    }
+    if ((num_entries == 0 && devices != NULL) || (devices == NULL && num_devices == NULL)) {
+        return CL_INVALID_VALUE;
+    }
+    if (!(device_type & CL_DEVICE_TYPE_ACCELERATOR)) {
+        if (num_devices != NULL) *num_devices = 0;
+        return CL_DEVICE_NOT_FOUND;
+    }
+    const auto &all = cards();
+    if (devices != NULL) {
+        for (cl_uint i = 0; i < num_entries && i < all.size(); i++) {
+            devices[i] = all[i];
+        }
+    }
+    if (num_devices != NULL) {
+        *num_devices = all.size();
+    }
+    return CL_SUCCESS;
+}
+
+cl_int clGetDeviceInfo(cl_device_id device, cl_device_info param_name, size_t size, void *value, size_t *size_ret) {
+    if (device == NULL) {
+        return CL_INVALID_DEVICE;
+    }
+    switch (param_name) {
+        case CL_DEVICE_NAME: return get_info_string(size, value, size_ret, config().device_name);
+        case CL_DEVICE_VENDOR: return get_info_string(size, value, size_ret, "Xilinx");
+        case CL_DEVICE_VERSION: return get_info_string(size, value, size_ret, "OpenCL 1.0");
+        case CL_DRIVER_VERSION: return get_info_string(size, value, size_ret, "1.0");
+        case CL_DEVICE_TYPE: return get_info_value<cl_device_type>(size, value, size_ret, CL_DEVICE_TYPE_ACCELERATOR);
+        case CL_DEVICE_PLATFORM: return get_info_value<cl_platform_id>(size, value, size_ret, platform());
+        case CL_DEVICE_PARENT_DEVICE: return get_info_value<cl_device_id>(size, value, size_ret, device->parent);
+        case CL_DEVICE_MAX_COMPUTE_UNITS:
+            return get_info_value<cl_uint>(size, value, size_ret, device->parent ? 1 : config().num_cus);
+        case CL_DEVICE_GLOBAL_MEM_SIZE:
+            return get_info_value<cl_ulong>(size, value, size_ret, BANK_SIZE * NUM_BANKS);
+        default: return CL_INVALID_VALUE;
+    }
+}
+
+cl_int clCreateSubDevices(cl_device_id device, const cl_device_partition_property *properties, cl_uint num_devices, cl_device_id *out_devices, cl_uint *num_devices_ret) {
+    if (device == NULL || device->parent != NULL) {
+        return CL_INVALID_DEVICE;
+    }
+    if (properties == NULL || properties[0] != CL_DEVICE_PARTITION_EQUALLY || properties[1] != 1) {
+        return CL_INVALID_VALUE;
+    }
+    if (out_devices != NULL) {
+        if (num_devices < device->subdevices.size()) {
+            return CL_INVALID_VALUE;
+        }
+        for (size_t i = 0; i < device->subdevices.size(); i++) {
+            out_devices[i] = device->subdevices[i].get();
+        }
+    }
+    if (num_devices_ret != NULL) {
+        *num_devices_ret = device->subdevices.size();
+    }
+    return CL_SUCCESS;
+}
+
+cl_int clRetainDevice(cl_device_id device) {
+    return device == NULL ? CL_INVALID_DEVICE : CL_SUCCESS;
+}
+
+cl_int clReleaseDevice(cl_device_id device) {
+    return device == NULL ? CL_INVALID_DEVICE : CL_SUCCESS;
+}
+
+cl_context clCreateContext(const cl_context_properties *properties, cl_uint num_devices, const cl_device_id *devices,
+    void (CL_CALLBACK *pfn_notify)(const char *, const void *, size_t, void *), void *user_data, cl_int *errcode_ret)
+{
+    if (num_devices != 1 || devices == NULL || devices[0] == NULL) {
+        if (errcode_ret != NULL) *errcode_ret = CL_INVALID_DEVICE;
+        return NULL;
+    }
+    auto context = new _cl_context();
+    context->device = devices[0];
+    if (errcode_ret != NULL) *errcode_ret = CL_SUCCESS;
+    return context;
+}
+
+cl_int clRetainContext(cl_context context) {
+    if (context == NULL) return CL_INVALID_CONTEXT;
+    context->retain();
+    return CL_SUCCESS;
+}
+
+cl_int clReleaseContext(cl_context context) {
+    if (context == NULL) return CL_INVALID_CONTEXT;
+    context->release();
+    return CL_SUCCESS;
+}
+
+cl_command_queue clCreateCommandQueue(cl_context context, cl_device_id device, cl_command_queue_properties properties, cl_int *errcode_ret) {
+    if (context == NULL) {
+        if (errcode_ret != NULL) *errcode_ret = CL_INVALID_CONTEXT;
+        return NULL;
+    }
+    if (device != context->device) {
+        if (errcode_ret != NULL) *errcode_ret = CL_INVALID_DEVICE;
+        return NULL;
+    }
+    auto queue = new _cl_command_queue();
+    context->retain();
+    queue->context = context;
+    queue->device = device;
+    queue->profiling = (properties & CL_QUEUE_PROFILING_ENABLE) != 0;
+    queue->worker = std::thread(&_cl_command_queue::run, queue);
+    if (errcode_ret != NULL) *errcode_ret = CL_SUCCESS;
+    return queue;
+}
+
+cl_int clRetainCommandQueue(cl_command_queue queue) {
+    if (queue == NULL) return CL_INVALID_COMMAND_QUEUE;
+    queue->retain();
+    return CL_SUCCESS;
+}
+
+cl_int clReleaseCommandQueue(cl_command_queue queue) {
+    if (queue == NULL) return CL_INVALID_COMMAND_QUEUE;
+    queue->release();
+    return CL_SUCCESS;
+}
+
+cl_int clFlush(cl_command_queue queue) {
+    return queue == NULL ? CL_INVALID_COMMAND_QUEUE : CL_SUCCESS;
+}
+
+cl_int clFinish(cl_command_queue queue) {
+    if (queue == NULL) return CL_INVALID_COMMAND_QUEUE;
+    queue->finish();
+    return CL_SUCCESS;
+}
+
+cl_mem clCreateBuffer(cl_context context, cl_mem_flags flags, size_t size, void *host_ptr, cl_int *errcode_ret) {
+    if (context == NULL) {
+        if (errcode_ret != NULL) *errcode_ret = CL_INVALID_CONTEXT;
+        return NULL;
+    }
+    if (size == 0) {
+        if (errcode_ret != NULL) *errcode_ret = CL_INVALID_BUFFER_SIZE;
+        return NULL;
+    }
+
+    // Decode the Xilinx extension pointer, which selects the bank and
+    // contains the actual host pointer.
+    int bank = -1;
+    if (flags & CL_MEM_EXT_PTR_XILINX) {
+        auto ext = (const cl_mem_ext_ptr_t*)host_ptr;
+        if (ext == NULL) {
+            if (errcode_ret != NULL) *errcode_ret = CL_INVALID_HOST_PTR;
+            return NULL;
+        }
+        if (ext->flags & XCL_MEM_TOPOLOGY) {
+            bank = ext->flags & 0xFFFF;
+        } else if (ext->flags & 0xF) {
+            bank = __builtin_ctz(ext->flags & 0xF);
+        }
+        host_ptr = ext->obj;
+        if (bank >= NUM_BANKS) {
+            if (errcode_ret != NULL) *errcode_ret = CL_INVALID_VALUE;
+            return NULL;
+        }
+    }
+    if ((host_ptr != NULL) != ((flags & (CL_MEM_USE_HOST_PTR | CL_MEM_COPY_HOST_PTR)) != 0)) {
+        if (errcode_ret != NULL) *errcode_ret = CL_INVALID_HOST_PTR;
+        return NULL;
+    }
+
+    // Like XRT, only use page-aligned host memory directly for DMA.
+    if ((flags & CL_MEM_USE_HOST_PTR) && ((uintptr_t)host_ptr & (HOST_PAGE_SIZE - 1))) {
+        if (errcode_ret != NULL) *errcode_ret = CL_INVALID_HOST_PTR;
+        return NULL;
+    }
+
+    // Allocate the memory in the bank.
+    cl_device_id card = context->device->card();
+    if (bank >= 0) {
+        std::lock_guard<std::mutex> lock(card->mutex);
+        if (card->bank_usage[bank] + size > BANK_SIZE) {
+            if (errcode_ret != NULL) *errcode_ret = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+            return NULL;
+        }
+        card->bank_usage[bank] += size;
+    }
+    auto mem = new _cl_mem();
+    mem->card = card;
+    mem->flags = flags;
+    mem->size = size;
+    mem->bank = bank;
+    mem->data.resize(size);
+    if (flags & CL_MEM_USE_HOST_PTR) {
+        mem->host_ptr = host_ptr;
+    } else if (flags & CL_MEM_COPY_HOST_PTR) {
+        memcpy(mem->data.data(), host_ptr, size);
+    }
+    if (errcode_ret != NULL) *errcode_ret = CL_SUCCESS;
+    return mem;
+}
+
+cl_int clRetainMemObject(cl_mem mem) {
+    if (mem == NULL) return CL_INVALID_MEM_OBJECT;
+    mem->retain();
+    return CL_SUCCESS;
+}
+
+cl_int clReleaseMemObject(cl_mem mem) {
+    if (mem == NULL) return CL_INVALID_MEM_OBJECT;
+    mem->release();
+    return CL_SUCCESS;
+}
+
+cl_program clCreateProgramWithBinary(cl_context context, cl_uint num_devices, const cl_device_id *device_list,
+    const size_t *lengths, const unsigned char **binaries, cl_int *binary_status, cl_int *errcode_ret)
+{
+    if (context == NULL) {
+        if (errcode_ret != NULL) *errcode_ret = CL_INVALID_CONTEXT;
+        return NULL;
+    }
+    if (num_devices != 1 || device_list == NULL || device_list[0] != context->device) {
+        if (errcode_ret != NULL) *errcode_ret = CL_INVALID_DEVICE;
+        return NULL;
+    }
+    if (lengths == NULL || binaries == NULL) {
+        if (errcode_ret != NULL) *errcode_ret = CL_INVALID_VALUE;
+        return NULL;
+    }
+
+    // The contents of the xclbin file are not checked; the kernel is always
+    // the word matcher.
+    auto program = new _cl_program();
+    context->retain();
+    program->context = context;
+    if (binary_status != NULL) binary_status[0] = CL_SUCCESS;
+    if (errcode_ret != NULL) *errcode_ret = CL_SUCCESS;
+    return program;
+}
+
+cl_int clBuildProgram(cl_program program, cl_uint num_devices, const cl_device_id *device_list, const char *options,
+    void (CL_CALLBACK *pfn_notify)(cl_program, void *), void *user_data)
+{
+    if (program == NULL) return CL_INVALID_PROGRAM;
+    program->built = true;
+    if (pfn_notify != NULL) pfn_notify(program, user_data);
+    return CL_SUCCESS;
+}
+
+cl_int clRetainProgram(cl_program program) {
+    if (program == NULL) return CL_INVALID_PROGRAM;
+    program->retain();
+    return CL_SUCCESS;
+}
+
+cl_int clReleaseProgram(cl_program program) {
+    if (program == NULL) return CL_INVALID_PROGRAM;
+    program->release();
+    return CL_SUCCESS;
+}
+
+cl_kernel clCreateKernel(cl_program program, const char *kernel_name, cl_int *errcode_ret) {
+    if (program == NULL) {
+        if (errcode_ret != NULL) *errcode_ret = CL_INVALID_PROGRAM;
+        return NULL;
+    }
+    if (!program->built) {
+        if (errcode_ret != NULL) *errcode_ret = CL_INVALID_PROGRAM_EXECUTABLE;
+        return NULL;
+    }
+    if (kernel_name == NULL || strcmp(kernel_name, KERNEL_NAME) != 0) {
+        if (errcode_ret != NULL) *errcode_ret = CL_INVALID_KERNEL_NAME;
+        return NULL;
+    }
+    auto kernel = new _cl_kernel();
+    program->retain();
+    kernel->program = program;
+    if (errcode_ret != NULL) *errcode_ret = CL_SUCCESS;
+    return kernel;
+}
+
+cl_int clRetainKernel(cl_kernel kernel) {
+    if (kernel == NULL) return CL_INVALID_KERNEL;
+    kernel->retain();
+    return CL_SUCCESS;
+}
+
+cl_int clReleaseKernel(cl_kernel kernel) {
+    if (kernel == NULL) return CL_INVALID_KERNEL;
+    kernel->release();
+    return CL_SUCCESS;
+}
+
+cl_int clSetKernelArg(cl_kernel kernel, cl_uint arg_index, size_t arg_size, const void *arg_value) {
+    if (kernel == NULL) return CL_INVALID_KERNEL;
+    if (arg_index >= NUM_ARGS) return CL_INVALID_ARG_INDEX;
+    if (arg_value == NULL) return CL_INVALID_ARG_VALUE;
+    std::lock_guard<std::mutex> lock(kernel->mutex);
+    auto &arg = kernel->args[arg_index];
+    if (arg_is_mem(arg_index)) {
+        if (arg_size != sizeof(cl_mem)) return CL_INVALID_ARG_SIZE;
+        arg.mem = *(const cl_mem*)arg_value;
+        if (arg.mem == NULL) return CL_INVALID_MEM_OBJECT;
+    } else {
+        if (arg_size != sizeof(uint32_t)) return CL_INVALID_ARG_SIZE;
+        memcpy(&arg.value, arg_value, sizeof(uint32_t));
+    }
+    arg.set = true;
+    return CL_SUCCESS;
+}
+
+cl_int clEnqueueTask(cl_command_queue queue, cl_kernel kernel, cl_uint num_events, const cl_event *event_wait_list, cl_event *event) {
+    if (queue == NULL) return CL_INVALID_COMMAND_QUEUE;
+    if (kernel == NULL) return CL_INVALID_KERNEL;
+
+    // Take a snapshot of the arguments, checking that they are all set and
+    // that the buffers are in the bank connected to the kernel instance. A
+    // queue for the card as a whole runs the kernel on the first instance.
+    std::shared_ptr<std::vector<MockArg>> args;
+    {
+        std::lock_guard<std::mutex> lock(kernel->mutex);
+        args = std::make_shared<std::vector<MockArg>>(kernel->args, kernel->args + NUM_ARGS);
+    }
+    cl_device_id cu = queue->device->parent ? queue->device : queue->device->subdevices.front().get();
+    for (cl_uint i = 0; i < NUM_ARGS; i++) {
+        const auto &arg = (*args)[i];
+        if (!arg.set) {
+            return CL_INVALID_KERNEL_ARGS;
+        }
+        if (arg.mem != NULL && arg.mem->bank >= 0 && arg.mem->bank != cu->bank()) {
+            return CL_INVALID_MEM_OBJECT;
+        }
+    }
+    for (auto &arg : *args) {
+        if (arg.mem != NULL) arg.mem->retain();
+    }
+    return queue->enqueue(num_events, event_wait_list, event, [args]() {
+        cl_int status = run_word_match(args->data());
+        for (auto &arg : *args) {
+            if (arg.mem != NULL) arg.mem->release();
+        }
+        return status;
+    });
+}
+
+cl_int clEnqueueMigrateMemObjects(cl_command_queue queue, cl_uint num_mem_objects, const cl_mem *mem_objects,
+    cl_mem_migration_flags flags, cl_uint num_events, const cl_event *event_wait_list, cl_event *event)
+{
+    if (queue == NULL) return CL_INVALID_COMMAND_QUEUE;
+    if (num_mem_objects == 0 || mem_objects == NULL) return CL_INVALID_VALUE;
+    std::vector<cl_mem> mems(mem_objects, mem_objects + num_mem_objects);
+    for (auto mem : mems) {
+        if (mem == NULL) return CL_INVALID_MEM_OBJECT;
+    }
+    for (auto mem : mems) {
+        mem->retain();
+    }
+    return queue->enqueue(num_events, event_wait_list, event, [mems, flags]() {
+        for (auto mem : mems) {
+            if (mem->host_ptr != NULL) {
+                if (flags & CL_MIGRATE_MEM_OBJECT_HOST) {
+                    memcpy(mem->host_ptr, mem->data.data(), mem->size);
+                } else if (!(flags & CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED)) {
+                    memcpy(mem->data.data(), mem->host_ptr, mem->size);
+                }
+            }
+            mem->release();
+        }
+        return CL_COMPLETE;
+    });
+}
+
+cl_int clEnqueueReadBuffer(cl_command_queue queue, cl_mem buffer, cl_bool blocking_read, size_t offset, size_t size, void *ptr,
+    cl_uint num_events, const cl_event *event_wait_list, cl_event *event)
+{
+    if (queue == NULL) return CL_INVALID_COMMAND_QUEUE;
+    if (buffer == NULL) return CL_INVALID_MEM_OBJECT;
+    if (ptr == NULL || offset + size > buffer->size) return CL_INVALID_VALUE;
+    cl_event local_event = NULL;
+    if (blocking_read && event == NULL) {
+        event = &local_event;
+    }
+    buffer->retain();
+    cl_int err = queue->enqueue(num_events, event_wait_list, event, [buffer, offset, size, ptr]() {
+        memcpy(ptr, buffer->data.data() + offset, size);
+        buffer->release();
+        return CL_COMPLETE;
+    });
+    if (err != CL_SUCCESS) {
+        buffer->release();
+        return err;
+    }
+    if (blocking_read) {
+        err = (*event)->wait() == CL_COMPLETE ? CL_SUCCESS : CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST;
+        if (local_event != NULL) local_event->release();
+    }
+    return err;
+}
+
+cl_int clEnqueueWriteBuffer(cl_command_queue queue, cl_mem buffer, cl_bool blocking_write, size_t offset, size_t size, const void *ptr,
+    cl_uint num_events, const cl_event *event_wait_list, cl_event *event)
+{
+    if (queue == NULL) return CL_INVALID_COMMAND_QUEUE;
+    if (buffer == NULL) return CL_INVALID_MEM_OBJECT;
+    if (ptr == NULL || offset + size > buffer->size) return CL_INVALID_VALUE;
+    cl_event local_event = NULL;
+    if (blocking_write && event == NULL) {
+        event = &local_event;
+    }
+
+    // Non-blocking writes may return before the data is copied, so the
+    // caller must keep the host memory alive until the event completes.
+    buffer->retain();
+    cl_int err = queue->enqueue(num_events, event_wait_list, event, [buffer, offset, size, ptr]() {
+        memcpy(buffer->data.data() + offset, ptr, size);
+        buffer->release();
+        return CL_COMPLETE;
+    });
+    if (err != CL_SUCCESS) {
+        buffer->release();
+        return err;
+    }
+    if (blocking_write) {
+        err = (*event)->wait() == CL_COMPLETE ? CL_SUCCESS : CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST;
+        if (local_event != NULL) local_event->release();
+    }
+    return err;
+}
+
+cl_int clWaitForEvents(cl_uint num_events, const cl_event *event_list) {
+    if (num_events == 0 || event_list == NULL) return CL_INVALID_VALUE;
+    cl_int err = CL_SUCCESS;
+    for (cl_uint i = 0; i < num_events; i++) {
+        if (event_list[i] == NULL) return CL_INVALID_EVENT;
+        if (event_list[i]->wait() != CL_COMPLETE) {
+            err = CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST;
+        }
+    }
+    return err;
+}
+
+cl_int clRetainEvent(cl_event event) {
+    if (event == NULL) return CL_INVALID_EVENT;
+    event->retain();
+    return CL_SUCCESS;
+}
+
+cl_int clReleaseEvent(cl_event event) {
+    if (event == NULL) return CL_INVALID_EVENT;
+    event->release();
+    return CL_SUCCESS;
+}
+
+cl_int clGetEventInfo(cl_event event, cl_event_info param_name, size_t size, void *value, size_t *size_ret) {
+    if (event == NULL) return CL_INVALID_EVENT;
+    switch (param_name) {
+        case CL_EVENT_COMMAND_EXECUTION_STATUS: {
+            std::lock_guard<std::mutex> lock(event->mutex);
+            return get_info_value<cl_int>(size, value, size_ret, event->status);
+        }
+        default: return CL_INVALID_VALUE;
+    }
+}
+
+cl_int clGetEventProfilingInfo(cl_event event, cl_profiling_info param_name, size_t size, void *value, size_t *size_ret) {
+    if (event == NULL) return CL_INVALID_EVENT;
+    std::lock_guard<std::mutex> lock(event->mutex);
+    if (!event->profiling || event->status != CL_COMPLETE) {
+        return CL_PROFILING_INFO_NOT_AVAILABLE;
+    }
+    switch (param_name) {
+        case CL_PROFILING_COMMAND_QUEUED: return get_info_value<cl_ulong>(size, value, size_ret, event->queued);
+        case CL_PROFILING_COMMAND_SUBMIT: return get_info_value<cl_ulong>(size, value, size_ret, event->submit);
+        case CL_PROFILING_COMMAND_START: return get_info_value<cl_ulong>(size, value, size_ret, event->start);
+        case CL_PROFILING_COMMAND_END: return get_info_value<cl_ulong>(size, value, size_ret, event->end);
+        default: return CL_INVALID_VALUE;
+    }
+}
+
+}
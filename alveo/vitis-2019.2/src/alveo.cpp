@@ -9,11 +9,13 @@ AlveoKernelInstance::AlveoKernelInstance(
     cl_device_id device,
     cl_program program,
     const std::string &kernel_name,
-    unsigned int index
+    unsigned int index,
+    bool profiling
 ) :
     device(device),
     kernel_name(kernel_name),
-    index(index)
+    index(index),
+    profiling(profiling)
 {
 
     // Create a context.
@@ -25,17 +27,28 @@ AlveoKernelInstance::AlveoKernelInstance(
     }
 
     // Create a command queue.
+    cl_command_queue_properties properties = profiling ? CL_QUEUE_PROFILING_ENABLE : 0;
     queue = clCreateCommandQueue(
-        context, device, 0, &err);
+        context, device, properties, &err);
     if (err != CL_SUCCESS || context == NULL) {
         clReleaseContext(context);
         throw std::runtime_error("clCreateCommandQueue() failed");
     }
 
+    // Create the command queue for reading back results.
+    read_queue = clCreateCommandQueue(
+        context, device, properties, &err);
+    if (err != CL_SUCCESS || read_queue == NULL) {
+        clReleaseCommandQueue(queue);
+        clReleaseContext(context);
+        throw std::runtime_error("clCreateCommandQueue() failed");
+    }
+
     // Create the kernel.
     kernel = clCreateKernel(
         program, kernel_name.c_str(), &err);
     if (err != CL_SUCCESS || context == NULL) {
+        clReleaseCommandQueue(read_queue);
         clReleaseCommandQueue(queue);
         clReleaseContext(context);
         throw std::runtime_error("clCreateKernel() failed");
@@ -45,88 +58,32 @@ AlveoKernelInstance::AlveoKernelInstance(
 
 AlveoKernelInstance::~AlveoKernelInstance() {
     clReleaseKernel(kernel);
+    clReleaseCommandQueue(read_queue);
     clReleaseCommandQueue(queue);
     clReleaseContext(context);
 }
 
-AlveoContext::AlveoContext(const std::string &bin_prefix, const std::string &kernel_name, bool quiet) {
-
-    // Enumerate platforms.
-    cl_platform_id platforms[16];
-    cl_uint num_platforms;
-    cl_int err = clGetPlatformIDs(16, platforms, &num_platforms);
-    if (err != CL_SUCCESS) {
-        throw std::runtime_error("clGetPlatformIDs() failed");
-    }
-
-    // Look for the Xilinx platform.
-    cl_platform_id platform = NULL;
-    char param[65];
-    param[64] = 0;
-    for (unsigned int i = 0; i < num_platforms; i++) {
-        err = clGetPlatformInfo(
-            platforms[i], CL_PLATFORM_VENDOR, 64, (void*)param, NULL);
-        if (err != CL_SUCCESS) {
-            throw std::runtime_error("clGetPlatformInfo(vendor) failed");
-        }
-        if (strcmp(param, "Xilinx") == 0) {
-            platform = platforms[i];
-            break;
-        }
-    }
-    if (platform == NULL) {
-        throw std::runtime_error("failed to find Xilinx platform ID");
-    }
-    err = clGetPlatformInfo(
-        platform, CL_PLATFORM_NAME, 64, (void*)param, NULL);
-    if (err != CL_SUCCESS) {
-        throw std::runtime_error("clGetPlatformInfo(name) failed");
-    }
-    if (!quiet) printf("Platform:\n  Vendor: Xilinx\n  Name: %s\n", param);
-
-    // Enumerate devices in platform.
-    cl_device_id devices[16];  // compute device id
-    cl_uint num_devices;
-    err = clGetDeviceIDs(
-        platform, CL_DEVICE_TYPE_ACCELERATOR, 16, devices, &num_devices);
-    if (err != CL_SUCCESS) {
-        throw std::runtime_error("clGetDeviceIDs() failed");
-    }
-    if (num_devices == 0) {
-        throw std::runtime_error("no devices in Xilinx platform");
-    }
-
-    // Select an accelerator that we have an xclbin file for.
-    cl_device_id device = NULL;
-    std::string xclbin_fname;
-    for (unsigned int i = 0; i < num_devices; i++) {
-        err = clGetDeviceInfo(devices[i], CL_DEVICE_NAME, 64, param, 0);
-        if (err != CL_SUCCESS) {
-            throw std::runtime_error("clGetDeviceInfo(name) failed");
-        }
-        if (!quiet) printf("  Device %u: %s", i, param);
-        if (device == NULL) {
-            xclbin_fname = bin_prefix + "." + param + ".xclbin";
-            if (device == NULL && access(xclbin_fname.c_str(), F_OK) != -1) {
-                if (!quiet) printf(" <--");
-                device = devices[i];
-                device_index = i;
-            }
-        }
-        if (!quiet) printf("\n");
-    }
-    if (device == NULL) {
-        throw std::runtime_error("no accelerator with corresponding xclbin found");
-    }
+/**
+ * Opens a context for the given device, with the given index in the
+ * Xilinx platform, and loads the given xclbin file onto it. If
+ * `profiling` is set, the command queues of the kernel instances are
+ * created with profiling enabled.
+ */
+AlveoContext::AlveoContext(
+    cl_device_id device, unsigned int device_index,
+    const std::string &xclbin_fname, const std::string &kernel_name,
+    bool quiet, bool profiling
+) : device_index(device_index) {
 
     // Create a context.
+    cl_int err;
     context = clCreateContext(0, 1, &device, NULL, NULL, &err);
     if (err != CL_SUCCESS || context == NULL) {
         throw std::runtime_error("clCreateContext() failed");
     }
 
     // Load the binary.
-    if (!quiet) printf("\nLoading binary %s... ", xclbin_fname.c_str());
+    if (!quiet) printf("\nLoading binary %s onto device %u... ", xclbin_fname.c_str(), device_index);
     fflush(stdout);
     MmapFile xclbin(xclbin_fname);
     const size_t size = xclbin.size();
@@ -176,7 +133,7 @@ AlveoContext::AlveoContext(const std::string &bin_prefix, const std::string &ker
     }
     for (unsigned int i = 0; i < num_subdevices; i++) {
         instances.push_back(std::make_shared<AlveoKernelInstance>(
-            subdevices[i], program, kernel_name, i));
+            subdevices[i], program, kernel_name, i, profiling));
     }
     if (!quiet) printf("Found %u kernel instances.\n\n", num_subdevices);
 
@@ -195,6 +152,92 @@ AlveoContext::~AlveoContext() {
     clReleaseContext(context);
 }
 
+/**
+ * Opens a context for every accelerator in the Xilinx platform that
+ * there is an xclbin file for, given the xclbin prefix excluding the
+ * `.[device].xclbin` suffix. Throws a `std::runtime_error` if there are
+ * no such accelerators.
+ */
+std::vector<std::shared_ptr<AlveoContext>> AlveoContext::open_all(
+    const std::string &bin_prefix, const std::string &kernel_name,
+    bool quiet, bool profiling
+) {
+
+    // Enumerate platforms.
+    cl_platform_id platforms[16];
+    cl_uint num_platforms;
+    cl_int err = clGetPlatformIDs(16, platforms, &num_platforms);
+    if (err != CL_SUCCESS) {
+        throw std::runtime_error("clGetPlatformIDs() failed");
+    }
+
+    // Look for the Xilinx platform.
+    cl_platform_id platform = NULL;
+    char param[65];
+    param[64] = 0;
+    for (unsigned int i = 0; i < num_platforms; i++) {
+        err = clGetPlatformInfo(
+            platforms[i], CL_PLATFORM_VENDOR, 64, (void*)param, NULL);
+        if (err != CL_SUCCESS) {
+            throw std::runtime_error("clGetPlatformInfo(vendor) failed");
+        }
+        if (strcmp(param, "Xilinx") == 0) {
+            platform = platforms[i];
+            break;
+        }
+    }
+    if (platform == NULL) {
+        throw std::runtime_error("failed to find Xilinx platform ID");
+    }
+    err = clGetPlatformInfo(
+        platform, CL_PLATFORM_NAME, 64, (void*)param, NULL);
+    if (err != CL_SUCCESS) {
+        throw std::runtime_error("clGetPlatformInfo(name) failed");
+    }
+    if (!quiet) printf("Platform:\n  Vendor: Xilinx\n  Name: %s\n", param);
+
+    // Enumerate devices in platform.
+    cl_device_id devices[16];  // compute device id
+    cl_uint num_devices;
+    err = clGetDeviceIDs(
+        platform, CL_DEVICE_TYPE_ACCELERATOR, 16, devices, &num_devices);
+    if (err != CL_SUCCESS) {
+        throw std::runtime_error("clGetDeviceIDs() failed");
+    }
+    if (num_devices == 0) {
+        throw std::runtime_error("no devices in Xilinx platform");
+    }
+
+    // Select the accelerators that we have an xclbin file for.
+    std::vector<unsigned int> selected;
+    std::vector<std::string> xclbin_fnames;
+    for (unsigned int i = 0; i < num_devices; i++) {
+        err = clGetDeviceInfo(devices[i], CL_DEVICE_NAME, 64, param, 0);
+        if (err != CL_SUCCESS) {
+            throw std::runtime_error("clGetDeviceInfo(name) failed");
+        }
+        if (!quiet) printf("  Device %u: %s", i, param);
+        std::string xclbin_fname = bin_prefix + "." + param + ".xclbin";
+        if (access(xclbin_fname.c_str(), F_OK) != -1) {
+            if (!quiet) printf(" <--");
+            selected.push_back(i);
+            xclbin_fnames.push_back(xclbin_fname);
+        }
+        if (!quiet) printf("\n");
+    }
+    if (selected.empty()) {
+        throw std::runtime_error("no accelerator with corresponding xclbin found");
+    }
+
+    // Open them.
+    std::vector<std::shared_ptr<AlveoContext>> contexts;
+    for (unsigned int i = 0; i < selected.size(); i++) {
+        contexts.push_back(std::make_shared<AlveoContext>(
+            devices[selected[i]], selected[i], xclbin_fnames[i], kernel_name, quiet, profiling));
+    }
+    return contexts;
+}
+
 AlveoEvents::AlveoEvents() {
 }
 
@@ -206,22 +249,50 @@ AlveoEvents::~AlveoEvents() {
     wait();
 }
 
-void AlveoEvents::add(cl_event event) {
+/**
+ * Takes ownership of the given event. The tag is reported along with its
+ * profiling information.
+ */
+void AlveoEvents::add(cl_event event, int tag) {
     events.push_back(event);
+    tags.push_back(tag);
 }
 
-void AlveoEvents::wait() {
+/**
+ * Waits for all events to complete and releases them. If `profiles` is
+ * not null, the profiling information of the events is appended to it;
+ * this requires the commands to have been enqueued on queues with
+ * profiling enabled.
+ */
+void AlveoEvents::wait(std::vector<AlveoEventProfile> *profiles) {
     if (!events.size()) {
         return;
     }
     cl_int err = clWaitForEvents(events.size(), events.data());
-    if (err != CL_SUCCESS) {
-        throw std::runtime_error("clWaitForEvents() failed");
+    bool profiled = true;
+    if (err == CL_SUCCESS && profiles != nullptr) {
+        for (size_t i = 0; i < events.size(); i++) {
+            AlveoEventProfile profile;
+            profile.tag = tags[i];
+            profiled = profiled
+                && clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &profile.queued, NULL) == CL_SUCCESS
+                && clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &profile.submit, NULL) == CL_SUCCESS
+                && clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &profile.start, NULL) == CL_SUCCESS
+                && clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &profile.end, NULL) == CL_SUCCESS;
+            profiles->push_back(profile);
+        }
     }
     for (auto event : events) {
         clReleaseEvent(event);
     }
     events.clear();
+    tags.clear();
+    if (err != CL_SUCCESS) {
+        throw std::runtime_error("clWaitForEvents() failed");
+    }
+    if (!profiled) {
+        throw std::runtime_error("clGetEventProfilingInfo() failed");
+    }
 }
 
 void AlveoBuffer::mkhost(const void *data) {
@@ -286,6 +357,7 @@ void AlveoBuffer::kill_host() {
  */
 AlveoBuffer::AlveoBuffer(AlveoKernelInstance &context, size_t size, int bank) : context(context), size(size) {
     fake_host_ptr = NULL;
+    mapped_ptr = NULL;
     mkbuf(CL_MEM_READ_WRITE, NULL, bank);
     migrate();
 }
@@ -296,6 +368,7 @@ AlveoBuffer::AlveoBuffer(AlveoKernelInstance &context, size_t size, int bank) :
  */
 AlveoBuffer::AlveoBuffer(AlveoKernelInstance &context, cl_mem_flags flags, size_t size, int bank) : context(context), size(size) {
     fake_host_ptr = NULL;
+    mapped_ptr = NULL;
     mkbuf(flags, NULL, bank);
     migrate();
 }
@@ -306,6 +379,7 @@ AlveoBuffer::AlveoBuffer(AlveoKernelInstance &context, cl_mem_flags flags, size_
  * physical memory on the host after the initial copy.
  */
 AlveoBuffer::AlveoBuffer(AlveoKernelInstance &context, size_t size, void *data, int bank) : context(context), size(size) {
+    mapped_ptr = NULL;
 
     // Create a page-aligned region in physical memory for XDMA to use and
     // copy the file to it.
@@ -323,27 +397,46 @@ AlveoBuffer::AlveoBuffer(AlveoKernelInstance &context, size_t size, void *data,
 }
 
 /**
- * Construct an input buffer for the kernel from an mmap'd file, that can
- * only be written once but doesn't cost memory on the host. This is done
- * by unmapping the * physical memory on the host after the initial copy.
+ * Construct an input buffer for the kernel from read-only host memory
+ * that stays mapped for the lifetime of the buffer, such as a region of a
+ * memory-mapped file, without copying it on the host. If the region is
+ * page-aligned, it is used directly as the host pointer for the
+ * migration. Otherwise, the runtime writes it to a device-only buffer.
  */
-AlveoBuffer::AlveoBuffer(AlveoKernelInstance &context, const MmapFile &fil, size_t offs, size_t size, int bank) : context(context), size(size) {
+AlveoBuffer::AlveoBuffer(AlveoKernelInstance &context, const void *mapped, size_t size, int bank) : context(context), size(size) {
+    fake_host_ptr = NULL;
+    mapped_ptr = NULL;
+    static const uintptr_t page_size = sysconf(_SC_PAGESIZE);
 
-    // Create a page-aligned region in physical memory for XDMA to use and
-    // copy the file to it.
-    mkhost(fil.data() + offs);
+    if (((uintptr_t)mapped & (page_size - 1)) == 0) {
 
-    // Create the buffer from this region.
-    mkbuf(CL_MEM_READ_ONLY, fake_host_ptr, bank);
+        // XDMA can transfer directly from the mapping. The buffer is never
+        // migrated back, so the memory is only read.
+        mkbuf(CL_MEM_READ_ONLY, const_cast<void*>(mapped), bank);
+        migrate();
 
-    // Ensure that it is migrated to the device.
-    migrate();
+    } else {
 
-    // Kill the physical memory usage.
-    kill_host();
+        // The runtime only accepts page-aligned host pointers, but it can
+        // write from any host memory to a buffer that lives only on the
+        // device.
+        mkbuf(CL_MEM_READ_ONLY, NULL, bank);
+        write(mapped)->wait();
+
+    }
 
+    mapped_ptr = mapped;
 }
 
+/**
+ * Construct an input buffer for the kernel from a region of an mmap'd
+ * file without copying it on the host, like the constructor above. The
+ * file must stay mapped for the lifetime of the buffer.
+ */
+AlveoBuffer::AlveoBuffer(AlveoKernelInstance &context, const MmapFile &fil, size_t offs, size_t size, int bank)
+    : AlveoBuffer(context, fil.data() + offs, size, bank)
+{}
+
 AlveoBuffer::~AlveoBuffer() {
     clReleaseMemObject(buffer);
     if (fake_host_ptr != NULL) {
@@ -358,7 +451,7 @@ AlveoBuffer::~AlveoBuffer() {
  * is destroyed.
  */
 std::shared_ptr<AlveoEvents> AlveoBuffer::write(const void *data) {
-    if (fake_host_ptr != NULL) {
+    if (fake_host_ptr != NULL || mapped_ptr != NULL) {
         throw std::runtime_error("cannot write to buffer, host ptr is fake");
     }
     cl_event event;
@@ -374,7 +467,7 @@ std::shared_ptr<AlveoEvents> AlveoBuffer::write(const void *data) {
  * Synchronously reads data from the buffer.
  */
 void AlveoBuffer::read(void *data, size_t offset, ssize_t size) {
-    if (fake_host_ptr != NULL) {
+    if (fake_host_ptr != NULL || mapped_ptr != NULL) {
         throw std::runtime_error("cannot read from buffer, host ptr is fake");
     }
     size_t read_size = this->size;
@@ -392,6 +485,31 @@ void AlveoBuffer::read(void *data, size_t offset, ssize_t size) {
     }
 }
 
+/**
+ * Asynchronously reads data from the buffer through the readback queue of
+ * the kernel instance, once the `after` event (if not null) has completed.
+ * The read is added to `events` with the given tag, which must be waited
+ * upon before the data is used.
+ */
+void AlveoBuffer::read_async(void *data, size_t offset, size_t size, cl_event after, AlveoEvents &events, int tag) {
+    if (fake_host_ptr != NULL || mapped_ptr != NULL) {
+        throw std::runtime_error("cannot read from buffer, host ptr is fake");
+    }
+    if (size + offset > this->size) {
+        throw std::runtime_error("offset + size out of range");
+    }
+    if (!size) {
+        return;
+    }
+    cl_event event;
+    cl_int err = clEnqueueReadBuffer(
+        context.read_queue, buffer, CL_FALSE, offset, size, data, after ? 1 : 0, after ? &after : NULL, &event);
+    if (err != CL_SUCCESS) {
+        throw std::runtime_error("clEnqueueReadBuffer() failed");
+    }
+    events.add(event, tag);
+}
+
 /**
  * Returns the size of the buffer.
  */
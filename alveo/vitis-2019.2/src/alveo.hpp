@@ -13,12 +13,22 @@ public:
     cl_device_id device;
     cl_context context;
     cl_command_queue queue;
+
+    // Second command queue for reading back results, such that readback
+    // can overlap with kernel execution on the main queue.
+    cl_command_queue read_queue;
+
     cl_kernel kernel;
     const std::string kernel_name;
     const unsigned int index;
 
+    // Whether the command queues were created with profiling enabled.
+    const bool profiling;
+
     AlveoKernelInstance(const AlveoKernelInstance&) = delete;
-    AlveoKernelInstance(cl_device_id device, cl_program program, const std::string &kernel_name, unsigned int index);
+    AlveoKernelInstance(
+        cl_device_id device, cl_program program, const std::string &kernel_name, unsigned int index,
+        bool profiling = false);
     ~AlveoKernelInstance();
 
     template <typename T>
@@ -47,9 +57,43 @@ public:
     unsigned int device_index;
 
     AlveoContext(const AlveoContext&) = delete;
-    AlveoContext(const std::string &bin_prefix, const std::string &kernel_name, bool quiet = false);
+
+    /**
+     * Opens a context for the given device, with the given index in the
+     * Xilinx platform, and loads the given xclbin file onto it. If
+     * `profiling` is set, the command queues of the kernel instances are
+     * created with profiling enabled.
+     */
+    AlveoContext(
+        cl_device_id device, unsigned int device_index,
+        const std::string &xclbin_fname, const std::string &kernel_name,
+        bool quiet = false, bool profiling = false);
+
     ~AlveoContext();
 
+    /**
+     * Opens a context for every accelerator in the Xilinx platform that
+     * there is an xclbin file for, given the xclbin prefix excluding the
+     * `.[device].xclbin` suffix. Throws a `std::runtime_error` if there are
+     * no such accelerators.
+     */
+    static std::vector<std::shared_ptr<AlveoContext>> open_all(
+        const std::string &bin_prefix, const std::string &kernel_name,
+        bool quiet = false, bool profiling = false);
+
+};
+
+/**
+ * OpenCL profiling information for a completed command, in nanoseconds,
+ * along with the tag that its event was added with.
+ */
+class AlveoEventProfile {
+public:
+    int tag;
+    cl_ulong queued;
+    cl_ulong submit;
+    cl_ulong start;
+    cl_ulong end;
 };
 
 /**
@@ -58,14 +102,27 @@ public:
 class AlveoEvents {
 private:
     std::vector<cl_event> events;
+    std::vector<int> tags;
 
 public:
     AlveoEvents(const AlveoEvents&) = delete;
     AlveoEvents();
     AlveoEvents(cl_event event);
     ~AlveoEvents();
-    void add(cl_event event);
-    void wait();
+
+    /**
+     * Takes ownership of the given event. The tag is reported along with its
+     * profiling information.
+     */
+    void add(cl_event event, int tag = 0);
+
+    /**
+     * Waits for all events to complete and releases them. If `profiles` is
+     * not null, the profiling information of the events is appended to it;
+     * this requires the commands to have been enqueued on queues with
+     * profiling enabled.
+     */
+    void wait(std::vector<AlveoEventProfile> *profiles = nullptr);
 
 };
 
@@ -79,6 +136,10 @@ private:
     size_t size;
     cl_mem_ext_ptr_t ext;
 
+    // Read-only host memory that the buffer was loaded from without a copy,
+    // which must not be written by reading the buffer back.
+    const void *mapped_ptr;
+
 public:
     cl_mem buffer;
 
@@ -112,9 +173,18 @@ public:
     AlveoBuffer(AlveoKernelInstance &context, size_t size, void *data, int bank);
 
     /**
-     * Construct an input buffer for the kernel from an mmap'd file, that can
-     * only be written once but doesn't cost memory on the host. This is done
-     * by unmapping the * physical memory on the host after the initial copy.
+     * Construct an input buffer for the kernel from read-only host memory
+     * that stays mapped for the lifetime of the buffer, such as a region of a
+     * memory-mapped file, without copying it on the host. If the region is
+     * page-aligned, it is used directly as the host pointer for the
+     * migration. Otherwise, the runtime writes it to a device-only buffer.
+     */
+    AlveoBuffer(AlveoKernelInstance &context, const void *mapped, size_t size, int bank);
+
+    /**
+     * Construct an input buffer for the kernel from a region of an mmap'd
+     * file without copying it on the host, like the constructor above. The
+     * file must stay mapped for the lifetime of the buffer.
      */
     AlveoBuffer(AlveoKernelInstance &context, const MmapFile &fil, size_t offs, size_t size, int bank);
 
@@ -133,6 +203,14 @@ public:
      */
     void read(void *data, size_t offset=0, ssize_t size=-1);
 
+    /**
+     * Asynchronously reads data from the buffer through the readback queue
+     * of the kernel instance, once the `after` event (if not null) has
+     * completed. The read is added to `events` with the given tag, which
+     * must be waited upon before the data is used.
+     */
+    void read_async(void *data, size_t offset, size_t size, cl_event after, AlveoEvents &events, int tag = 0);
+
     /**
      * Returns the size of the buffer.
      */
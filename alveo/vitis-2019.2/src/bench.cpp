@@ -0,0 +1,523 @@
+#include "ffi.h"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void reporter(void *user, const char *status) {
+    fprintf(stderr, "\033[A\033[K%s\n", status);
+}
+
+/**
+ * A query from the query file.
+ */
+struct Query {
+    std::string pattern;
+    bool whole_words;
+};
+
+/**
+ * Statistics for a single query within a benchmark configuration.
+ */
+struct QueryStats {
+    unsigned int num_word_matches = 0;
+    unsigned int num_page_matches = 0;
+    double total_latency = 0.0;
+};
+
+/**
+ * Returns the given string as a JSON string literal.
+ */
+static std::string json_string(const std::string &str) {
+    std::string result = "\"";
+    for (unsigned char c : str) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            result += buf;
+        } else {
+            result += c;
+        }
+    }
+    return result + "\"";
+}
+
+/**
+ * Returns the given percentile of the sorted latencies using the
+ * nearest-rank method.
+ */
+static double percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t rank = (size_t)(p / 100.0 * sorted.size() + 0.999999);
+    rank = std::max<size_t>(1, std::min(rank, sorted.size()));
+    return sorted[rank - 1];
+}
+
+/**
+ * Reads the query file. Each line contains a pattern; patterns prefixed
+ * with `~` are matched as whole words. Empty lines and lines starting with
+ * `#` are ignored.
+ */
+static std::vector<Query> read_queries(const std::string &fname) {
+    FILE *f = fopen(fname.c_str(), "r");
+    if (!f) {
+        throw std::runtime_error("failed to open query file " + fname);
+    }
+    std::vector<Query> queries;
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), f)) {
+        std::string line = buf;
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        Query query;
+        query.whole_words = line[0] == '~';
+        query.pattern = query.whole_words ? line.substr(1) : line;
+        queries.push_back(query);
+    }
+    fclose(f);
+    if (queries.empty()) {
+        throw std::runtime_error("no queries in " + fname);
+    }
+    return queries;
+}
+
+/**
+ * Checks that the software implementation with the trigram index returns
+ * the same results as a full scan, by running each query on the given
+ * context (which has the index enabled) and on a second context that does
+ * not, both with the given minimum number of matches and with a minimum of
+ * zero, for which the index must not skip any articles. Throws a
+ * `std::runtime_error` describing the first difference.
+ */
+static void verify_index(
+    WordMatchContext *indexed, WordMatchPlatformConfig platcfg, const std::vector<Query> &queries,
+    unsigned int min_matches, unsigned int top_k)
+{
+    platcfg.xclbin_prefix = "";
+    platcfg.keep_loaded = true;
+    platcfg.sw_trigram_index = false;
+    platcfg.health_interval_ms = 0;
+    WordMatchContext *full = word_match_open(&platcfg, reporter, NULL);
+    if (full == nullptr) {
+        throw std::runtime_error(word_match_last_error());
+    }
+    std::string error;
+    for (size_t qi = 0; qi < queries.size() && error.empty(); qi++) {
+        for (unsigned int min : {min_matches, 0u}) {
+            WordMatchRunConfig runcfg;
+            runcfg.pattern = queries[qi].pattern.c_str();
+            runcfg.whole_words = queries[qi].whole_words;
+            runcfg.min_matches = min;
+            runcfg.mode = -1000;
+            runcfg.top_k = top_k;
+            runcfg.complete_results = 0;
+            auto a = word_match_query(indexed, &runcfg, nullptr, nullptr);
+            auto b = word_match_query(full, &runcfg, nullptr, nullptr);
+            if (a == nullptr || b == nullptr) {
+                error = word_match_last_error();
+            } else if (a->num_word_matches != b->num_word_matches
+                || a->num_page_matches != b->num_page_matches
+                || a->num_top_pages != b->num_top_pages
+                || memcmp(a->top_page_counts, b->top_page_counts, a->num_top_pages * sizeof(unsigned int)))
+            {
+                error = "trigram index results differ from a full scan for pattern "
+                    + json_string(queries[qi].pattern) + " with a minimum of " + std::to_string(min) + " matches";
+            }
+            word_match_results_free(a);
+            word_match_results_free(b);
+            if (!error.empty()) {
+                break;
+            }
+        }
+    }
+    word_match_close(full);
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+}
+
+/**
+ * Runs the benchmark for the given mode with the given number of concurrent
+ * clients, and returns the JSON object describing the results.
+ */
+static std::string run_benchmark(
+    const std::vector<Query> &queries, int mode, unsigned int warmup, unsigned int reps,
+    unsigned int min_matches, unsigned int top_k, int complete_results, bool profiling, unsigned int clients)
+{
+    std::vector<QueryStats> stats(queries.size());
+    std::vector<double> latencies;
+    unsigned long long data_size = 0;
+    double total_time = 0.0;
+    unsigned long long num_kernel_runs = 0;
+    double total_cycles = 0.0;
+    double total_subkernel_imbalance = 0.0;
+    double total_queue_time = 0.0;
+    double total_submit_time = 0.0;
+    double total_kernel_time = 0.0;
+    double total_readback_time = 0.0;
+    unsigned long long num_energy_runs = 0;
+    unsigned long long energy_data_size = 0;
+    double total_energy = 0.0;
+    double total_energy_time = 0.0;
+    int energy_source = WORD_MATCH_ENERGY_NONE;
+    unsigned long long num_coalesced = 0;
+
+    // Runs a single round over all queries from the given number of client
+    // threads, each taking the next query that has not been run yet. The
+    // results are owned by us and freed by the caller.
+    std::vector<const WordMatchResults*> round_results(queries.size());
+    std::vector<double> round_latencies(queries.size());
+    std::vector<std::string> round_errors(queries.size());
+    auto run_round = [&]() {
+        std::atomic<size_t> next(0);
+        auto client = [&]() {
+            for (size_t qi = next++; qi < queries.size(); qi = next++) {
+                WordMatchRunConfig runcfg;
+                runcfg.pattern = queries[qi].pattern.c_str();
+                runcfg.whole_words = queries[qi].whole_words;
+                runcfg.min_matches = min_matches;
+                runcfg.mode = mode;
+                runcfg.top_k = top_k;
+                runcfg.complete_results = complete_results;
+
+                auto start = std::chrono::steady_clock::now();
+                round_results[qi] = word_match_query(word_match_context(), &runcfg, nullptr, nullptr);
+                auto elapsed = std::chrono::steady_clock::now() - start;
+                round_latencies[qi] = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / 1000.0;
+                if (round_results[qi] == nullptr) {
+                    round_errors[qi] = word_match_last_error();
+                }
+            }
+        };
+        std::vector<std::thread> threads;
+        for (unsigned int i = 1; i < clients; i++) {
+            threads.emplace_back(client);
+        }
+        client();
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        for (size_t qi = 0; qi < queries.size(); qi++) {
+            if (round_results[qi] == nullptr) {
+                for (auto results : round_results) {
+                    word_match_results_free(results);
+                }
+                throw std::runtime_error(round_errors[qi]);
+            }
+        }
+    };
+
+    double wall_time = 0.0;
+    for (unsigned int rep = 0; rep < warmup + reps; rep++) {
+        bool measure = rep >= warmup;
+        auto round_start = std::chrono::steady_clock::now();
+        run_round();
+        auto round_elapsed = std::chrono::steady_clock::now() - round_start;
+        for (size_t qi = 0; qi < queries.size(); qi++) {
+            auto results = round_results[qi];
+            double latency = round_latencies[qi];
+            if (!measure) {
+                word_match_results_free(results);
+                continue;
+            }
+
+            latencies.push_back(latency);
+            total_time += latency;
+            if (results->coalesced) {
+                num_coalesced++;
+            }
+            for (unsigned int i = 0; i < results->num_partial_results; i++) {
+                data_size += results->partial_results[i]->data_size;
+                if (!mode) {
+                    num_kernel_runs++;
+                    total_cycles += results->partial_results[i]->cycle_count;
+                    total_subkernel_imbalance += results->partial_results[i]->subkernel_imbalance;
+                    total_queue_time += results->partial_results[i]->queue_time;
+                    total_submit_time += results->partial_results[i]->submit_time;
+                    total_kernel_time += results->partial_results[i]->kernel_time;
+                    total_readback_time += results->partial_results[i]->readback_time;
+                }
+            }
+            if (results->energy_source != WORD_MATCH_ENERGY_NONE && !results->coalesced) {
+                num_energy_runs++;
+                total_energy += results->energy;
+                total_energy_time += latency;
+                energy_source = results->energy_source;
+                for (unsigned int i = 0; i < results->num_partial_results; i++) {
+                    energy_data_size += results->partial_results[i]->data_size;
+                }
+            }
+            stats[qi].num_word_matches = results->num_word_matches;
+            stats[qi].num_page_matches = results->num_page_matches;
+            stats[qi].total_latency += latency;
+            word_match_results_free(results);
+        }
+        if (measure) {
+            wall_time += std::chrono::duration_cast<std::chrono::nanoseconds>(round_elapsed).count() / 1000.0;
+        }
+    }
+
+    // With a single client, the throughput is based on the latencies, so the
+    // time between queries is not counted. With more clients, the queries
+    // overlap, so it is based on the wall-clock time of the rounds instead.
+    double busy_time = clients > 1 ? wall_time : total_time;
+
+    // Summarize the results.
+    std::sort(latencies.begin(), latencies.end());
+    std::string json = "{\n";
+    json += "      \"mode\": " + std::to_string(mode) + ",\n";
+    json += "      \"implementation\": " + json_string(mode ? "software" : "hardware") + ",\n";
+    json += "      \"num_runs\": " + std::to_string(latencies.size()) + ",\n";
+    json += "      \"clients\": " + std::to_string(clients) + ",\n";
+    json += "      \"coalesced_runs\": " + std::to_string(num_coalesced) + ",\n";
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+        "      \"latency_us\": {\"p50\": %.1f, \"p95\": %.1f, \"p99\": %.1f, \"mean\": %.1f, \"max\": %.1f},\n",
+        percentile(latencies, 50), percentile(latencies, 95), percentile(latencies, 99),
+        latencies.empty() ? 0.0 : total_time / latencies.size(),
+        latencies.empty() ? 0.0 : latencies.back());
+    json += buf;
+    snprintf(buf, sizeof(buf), "      \"throughput_gb_per_s\": %.3f,\n",
+        busy_time > 0 ? data_size / (busy_time * 1000.0) : 0.0);
+    json += buf;
+    snprintf(buf, sizeof(buf), "      \"queries_per_s\": %.3f,\n",
+        busy_time > 0 ? latencies.size() / (busy_time / 1000000.0) : 0.0);
+    json += buf;
+    if (num_kernel_runs) {
+        snprintf(buf, sizeof(buf), "      \"mean_cycle_count\": %.1f,\n      \"mean_subkernel_imbalance\": %.3f,\n",
+            total_cycles / num_kernel_runs, total_subkernel_imbalance / num_kernel_runs);
+        json += buf;
+        if (profiling) {
+            snprintf(buf, sizeof(buf),
+                "      \"mean_time_us\": {\"queue\": %.1f, \"submit\": %.1f, \"kernel\": %.1f, \"readback\": %.1f},\n",
+                total_queue_time / num_kernel_runs, total_submit_time / num_kernel_runs,
+                total_kernel_time / num_kernel_runs, total_readback_time / num_kernel_runs);
+            json += buf;
+        }
+    }
+    // The energy of a run covers the whole CPU package or card for the
+    // duration of the run, so runs that overlap with other clients count the
+    // energy of those as well. Their sum would be far too high, so the energy
+    // is only reported for a single client.
+    if (num_energy_runs && clients == 1) {
+        snprintf(buf, sizeof(buf),
+            "      \"energy\": {\"source\": \"%s\", \"joules_per_query\": %.3f, \"joules_per_gb\": %.3f, \"mean_power_w\": %.2f},\n",
+            energy_source == WORD_MATCH_ENERGY_CARDS ? "cards" : "rapl",
+            total_energy / num_energy_runs,
+            energy_data_size ? total_energy / (energy_data_size / 1000000000.0) : 0.0,
+            total_energy_time > 0 ? total_energy / (total_energy_time / 1000000.0) : 0.0);
+        json += buf;
+    }
+    json += "      \"queries\": [\n";
+    for (size_t qi = 0; qi < queries.size(); qi++) {
+        snprintf(buf, sizeof(buf), ", \"whole_words\": %s, \"num_word_matches\": %u, \"num_page_matches\": %u, \"mean_latency_us\": %.1f}",
+            queries[qi].whole_words ? "true" : "false",
+            stats[qi].num_word_matches, stats[qi].num_page_matches,
+            reps ? stats[qi].total_latency / reps : 0.0);
+        json += "        {\"pattern\": " + json_string(queries[qi].pattern) + buf;
+        json += qi + 1 < queries.size() ? ",\n" : "\n";
+    }
+    json += "      ]\n";
+    json += "    }";
+    return json;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [options] <data-prefix> <query-file>\n", name);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -i <impl>      implementation to run: sw, hw or all (default sw)\n");
+    fprintf(stderr, "  -m <modes>     comma-separated software modes, i.e. thread counts, with\n");
+    fprintf(stderr, "                 negative values for dynamic scheduling (default -1000)\n");
+    fprintf(stderr, "  -w <count>     number of warm-up rounds over all queries (default 1)\n");
+    fprintf(stderr, "  -r <count>     number of measured rounds over all queries (default 5)\n");
+    fprintf(stderr, "  -x <prefix>    xclbin prefix (default xclbin/word_match)\n");
+    fprintf(stderr, "  -k <name>      kernel name (default krnl_word_match_rtl)\n");
+    fprintf(stderr, "  -S             disable streaming decompression in software\n");
+    fprintf(stderr, "  -W             enable work stealing in software\n");
+    fprintf(stderr, "  -I             enable the trigram index in software\n");
+    fprintf(stderr, "  -V             with -I, first check that the software results with the\n");
+    fprintf(stderr, "                 index equal those of a full scan\n");
+    fprintf(stderr, "  -n <count>     minimum number of matches for a page match (default 1)\n");
+    fprintf(stderr, "  -t <count>     number of top pages to rank (default 0)\n");
+    fprintf(stderr, "  -c <mode>      completeness of the hardware results: 0 for the first\n");
+    fprintf(stderr, "                 records only, 1 for an exact top-K, 2 for all records\n");
+    fprintf(stderr, "                 (default 0)\n");
+    fprintf(stderr, "  -p             enable OpenCL profiling in hardware and report the mean\n");
+    fprintf(stderr, "                 time breakdown per kernel run\n");
+    fprintf(stderr, "  -e <ms>        sample the card power every <ms> milliseconds to report\n");
+    fprintf(stderr, "                 the energy of hardware runs (default 0, disabled)\n");
+    fprintf(stderr, "  -j <clients>   number of threads submitting queries concurrently; the\n");
+    fprintf(stderr, "                 throughput is then based on the wall-clock time, and the\n");
+    fprintf(stderr, "                 energy is not reported (default 1)\n");
+    fprintf(stderr, "  -o <file>      write the JSON report to the given file (default stdout)\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+
+    // Parse command line.
+    std::string impl = "sw";
+    std::string modes_str = "-1000";
+    unsigned int warmup = 1;
+    unsigned int reps = 5;
+    std::string bin_prefix = "xclbin/word_match";
+    std::string kernel_name = "krnl_word_match_rtl";
+    bool streaming = true;
+    bool work_stealing = false;
+    bool trigram_index = false;
+    bool verify = false;
+    unsigned int min_matches = 1;
+    unsigned int top_k = 0;
+    int complete_results = 0;
+    bool profiling = false;
+    unsigned int health_interval = 0;
+    unsigned int clients = 1;
+    std::string output;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:m:w:r:x:k:SWIVn:t:c:pe:j:o:")) != -1) {
+        switch (opt) {
+            case 'i': impl = optarg; break;
+            case 'm': modes_str = optarg; break;
+            case 'w': warmup = atoi(optarg); break;
+            case 'r': reps = atoi(optarg); break;
+            case 'x': bin_prefix = optarg; break;
+            case 'k': kernel_name = optarg; break;
+            case 'S': streaming = false; break;
+            case 'W': work_stealing = true; break;
+            case 'I': trigram_index = true; break;
+            case 'V': verify = true; break;
+            case 'n': min_matches = atoi(optarg); break;
+            case 't': top_k = atoi(optarg); break;
+            case 'c': complete_results = atoi(optarg); break;
+            case 'p': profiling = true; break;
+            case 'e': health_interval = atoi(optarg); break;
+            case 'j': clients = std::max(atoi(optarg), 1); break;
+            case 'o': output = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 2 || (impl != "sw" && impl != "hw" && impl != "all")) {
+        usage(argv[0]);
+    }
+    std::string data_prefix = argv[optind];
+    std::vector<Query> queries = read_queries(argv[optind + 1]);
+
+    // Determine the modes to run.
+    std::vector<int> modes;
+    if (impl != "sw") {
+        modes.push_back(0);
+    }
+    if (impl != "hw") {
+        size_t pos = 0;
+        while (pos <= modes_str.size()) {
+            size_t end = modes_str.find(',', pos);
+            if (end == std::string::npos) end = modes_str.size();
+            int mode = atoi(modes_str.substr(pos, end - pos).c_str());
+            if (!mode) {
+                fprintf(stderr, "Error: software modes must be nonzero\n");
+                exit(1);
+            }
+            modes.push_back(mode);
+            pos = end + 1;
+        }
+    }
+
+    // Check environment for emulation mode.
+    const char *emu_mode = getenv("XCL_EMULATION_MODE");
+    if (emu_mode == NULL) {
+        emu_mode = "hw";
+    }
+
+    // Initialize the platform. The hardware is only loaded when it is
+    // benchmarked, so software benchmarks work without an xclbin. The result
+    // cache is disabled, as it would make repeated queries meaningless.
+    WordMatchPlatformConfig platcfg;
+    platcfg.data_prefix = data_prefix.c_str();
+    platcfg.xclbin_prefix = impl != "sw" ? bin_prefix.c_str() : "";
+    platcfg.emu_mode = emu_mode;
+    platcfg.kernel_name = kernel_name.c_str();
+    platcfg.num_subkernels = 3;
+    platcfg.hw_profiling = profiling;
+    platcfg.keep_loaded = impl != "hw";
+    platcfg.sw_streaming = streaming;
+    platcfg.sw_work_stealing = work_stealing;
+    platcfg.sw_trigram_index = trigram_index;
+    platcfg.result_cache_size = 0;
+    platcfg.health_interval_ms = health_interval;
+    fprintf(stderr, "word_match_init...\n");
+    if (!word_match_init(&platcfg, false, reporter, NULL)) {
+        fprintf(stderr, "Error: %s\n", word_match_last_error());
+        exit(1);
+    }
+
+    // Check the trigram index if requested.
+    if (verify && trigram_index && impl != "hw") {
+        fprintf(stderr, "Verifying the trigram index...\n");
+        try {
+            verify_index(word_match_context(), platcfg, queries, min_matches, top_k);
+        } catch (std::exception &e) {
+            fprintf(stderr, "Error: %s\n", e.what());
+            word_match_release();
+            exit(1);
+        }
+        fprintf(stderr, "Verifying the trigram index... done\n");
+    }
+
+    // Run the benchmarks.
+    std::string json = "{\n";
+    json += "  \"data_prefix\": " + json_string(data_prefix) + ",\n";
+    json += "  \"num_queries\": " + std::to_string(queries.size()) + ",\n";
+    json += "  \"warmup\": " + std::to_string(warmup) + ",\n";
+    json += "  \"repetitions\": " + std::to_string(reps) + ",\n";
+    json += "  \"hardware_threads\": " + std::to_string(std::thread::hardware_concurrency()) + ",\n";
+    json += "  \"sw_streaming\": " + std::string(streaming ? "true" : "false") + ",\n";
+    json += "  \"sw_work_stealing\": " + std::string(work_stealing ? "true" : "false") + ",\n";
+    json += "  \"sw_trigram_index\": " + std::string(trigram_index ? "true" : "false") + ",\n";
+    json += "  \"min_matches\": " + std::to_string(min_matches) + ",\n";
+    json += "  \"top_k\": " + std::to_string(top_k) + ",\n";
+    json += "  \"complete_results\": " + std::to_string(complete_results) + ",\n";
+    json += "  \"results\": [\n";
+    try {
+        for (size_t mi = 0; mi < modes.size(); mi++) {
+            fprintf(stderr, "Running %zu queries in mode %d...\n", queries.size(), modes[mi]);
+            json += "    " + run_benchmark(queries, modes[mi], warmup, reps, min_matches, top_k, complete_results, profiling, clients);
+            json += mi + 1 < modes.size() ? ",\n" : "\n";
+        }
+    } catch (std::exception &e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        word_match_release();
+        exit(1);
+    }
+    json += "  ]\n}\n";
+    word_match_release();
+
+    // Write the report.
+    if (output.empty()) {
+        fputs(json.c_str(), stdout);
+    } else {
+        FILE *f = fopen(output.c_str(), "w");
+        if (!f) {
+            fprintf(stderr, "Error: failed to open %s\n", output.c_str());
+            exit(1);
+        }
+        fputs(json.c_str(), f);
+        fclose(f);
+    }
+
+}
@@ -2,20 +2,54 @@
 #include "ffi.h"
 #include "hardware.hpp"
 #include "software.hpp"
+#include "result_cache.hpp"
 #include "xbutil.hpp"
+#include "sensors.hpp"
 #include <string>
 #include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <map>
+#include <atomic>
 #include <omp.h>
+#include <algorithm>
 #include <stdlib.h>
+#include <string.h>
 
-typedef struct {
+/**
+ * A query that is running through the handle-based API. Identical queries
+ * that arrive while it is running wait for it instead of running
+ * themselves.
+ */
+struct InFlightQuery {
+
+    // Number of queries waiting for this one, guarded by the cache mutex of
+    // the context, which is also held while the query can be found.
+    unsigned int num_waiters = 0;
 
-    // The most recent error message.
-    std::string last_error;
+    // Whether the query is done, and its results, or its error message if
+    // it failed. If it was cancelled, the waiting queries try again. Guarded
+    // by the mutex; the condition variable is signalled when it is done.
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+    bool cancelled = false;
+    std::shared_ptr<const WordMatchResultsContainer> results;
+    std::string error;
+
+};
+
+/**
+ * A platform configuration with its loaded dataset. The legacy API operates
+ * on a single global context; the handle-based API on any number of them.
+ */
+struct WordMatchContext {
 
     // Info about the current configuration, used for lazy reloading.
     std::string current_xclbin_prefix = "";
     std::string current_data_prefix = "";
+    bool current_hw_profiling = false;
 
     // Hardware implementation.
     std::shared_ptr<HardwareWordMatch> hw_impl;
@@ -23,20 +57,489 @@ typedef struct {
     // Software implementation.
     std::shared_ptr<SoftwareWordMatch> sw_impl;
 
-} state_type;
+    // Background sampler for the sensors of the cards used by the hardware
+    // implementation, if enabled.
+    std::shared_ptr<SensorSampler> sampler;
+
+    // CPU package energy counters, used to measure the energy of software
+    // runs.
+    std::shared_ptr<RaplMeter> rapl;
+
+    // Pointers to the results of the most recent batch run.
+    std::vector<const WordMatchResults*> batch_result_ptrs;
+
+    // Cache for the results of recent queries, and the version of the
+    // currently loaded dataset that is part of the cache keys.
+    WordMatchResultCache cache;
+    uint64_t data_version = 0;
+
+    // Copies of the cached results returned by the most recent batch run.
+    std::vector<WordMatchResultsContainer> batch_cached_results;
 
-static state_type *state = NULL;
+    // Bytes per kernel instance returned by the most recent placement info
+    // query.
+    std::vector<unsigned long long> placement_bytes;
+
+    // Queries running through the handle-based API by cache key, and the
+    // number of queries that waited for an identical one instead of running
+    // themselves.
+    std::map<std::string, std::shared_ptr<InFlightQuery>> in_flight;
+    std::atomic<uint64_t> num_coalesced{0};
+
+    // Guards the result cache and the running queries, and serializes the
+    // runs of the hardware implementation, which cannot run multiple queries
+    // at once. Software runs through the handle-based API do not need any
+    // locks.
+    std::mutex cache_mutex;
+    std::mutex hw_mutex;
+
+};
+
+// The context used by the legacy API.
+static WordMatchContext *state = NULL;
+
+// The most recent error message of each thread.
+static thread_local std::string last_error;
+
+/**
+ * Returns the implementation to use for the given run mode, configuring the
+ * OpenMP thread count for software runs.
+ */
+static std::shared_ptr<WordMatch> select_impl(WordMatchContext *ctx, int mode) {
+    if (!mode) {
+        if (!ctx->hw_impl) {
+            throw std::runtime_error("hardware implementation is not loaded");
+        }
+        return ctx->hw_impl;
+    }
+    if (!ctx->sw_impl) {
+        throw std::runtime_error("software implementation is not loaded");
+    }
+    if (mode > 0) {
+        omp_set_dynamic(0);
+        omp_set_num_threads(mode);
+    } else {
+        omp_set_dynamic(1);
+        omp_set_num_threads(-mode);
+    }
+    return ctx->sw_impl;
+}
+
+/**
+ * Measures the energy used by a run on the given context, from its
+ * construction up to the call to `finish()`. Hardware runs (mode 0)
+ * integrate the power samples of the cards, software runs read the RAPL
+ * counters.
+ */
+class EnergyMeasurement {
+private:
+    WordMatchContext *ctx;
+    bool hardware;
+    uint64_t start;
+    std::vector<uint64_t> rapl_start;
+
+public:
+    EnergyMeasurement(WordMatchContext *ctx, int mode) : ctx(ctx), hardware(!mode), start(SensorSampler::now()) {
+        if (!hardware && ctx->rapl && ctx->rapl->available()) {
+            rapl_start = ctx->rapl->read();
+        }
+    }
+
+    /**
+     * Stores the energy measured since construction in the given results,
+     * divided evenly over them.
+     */
+    void finish(const std::vector<WordMatchResults*> &results) {
+        uint64_t end = SensorSampler::now();
+        double joules = 0.0;
+        int source = WORD_MATCH_ENERGY_NONE;
+        if (hardware && ctx->sampler) {
+            source = WORD_MATCH_ENERGY_CARDS;
+            for (unsigned int card = 0; card < ctx->sampler->num_cards(); card++) {
+                double card_joules = ctx->sampler->energy(card, start, end);
+                if (card_joules < 0.0) {
+                    source = WORD_MATCH_ENERGY_NONE;
+                    break;
+                }
+                joules += card_joules;
+            }
+        } else if (!hardware && !rapl_start.empty()) {
+            source = WORD_MATCH_ENERGY_RAPL;
+            joules = ctx->rapl->energy(rapl_start, ctx->rapl->read());
+        }
+        for (auto result : results) {
+            if (source == WORD_MATCH_ENERGY_NONE) {
+                result->energy = 0.0;
+                result->avg_power = 0.0f;
+            } else {
+                result->energy = joules / results.size();
+                result->avg_power = end > start ? joules / ((end - start) * 0.000001) : 0.0;
+            }
+            result->energy_source = source;
+        }
+    }
+};
+
+/**
+ * Converts a sensor sample to a health information record.
+ */
+static WordMatchHealthInfo sample_to_health(const SensorSample &sample) {
+    WordMatchHealthInfo result;
+    result.fpga_temp = sample.fpga_temp;
+    result.power_in = sample.power_in;
+    result.power_vccint = sample.power_vccint;
+    return result;
+}
+
+/**
+ * Returns the health of the given card with the given device index: the
+ * latest sample if the sensor sampler is running and has one, or a fresh
+ * reading otherwise.
+ */
+static WordMatchHealthInfo card_health(unsigned int card, unsigned int index) {
+    SensorSample sample;
+    if (state != nullptr && state->sampler && card < state->sampler->num_cards()
+        && state->sampler->latest(card, sample))
+    {
+        return sample_to_health(sample);
+    }
+    WordMatchHealthInfo result;
+    XBUtilDumpInfo info;
+    xbutil_dump(info, index);
+    result.fpga_temp = info.fpga_temp;
+    result.power_in = info.power_in;
+    result.power_vccint = info.power_vccint;
+    return result;
+}
+
+/**
+ * Configures the given context as described for `word_match_init()`. Throws
+ * a `std::runtime_error` on failure.
+ */
+static void configure(
+    WordMatchContext *ctx, WordMatchPlatformConfig *config, int force_reload,
+    void (*progress)(void *user, const char *status), void *user)
+{
+    // Check configuration.
+    if (config == nullptr) {
+        throw std::runtime_error("configuration must not be null");
+    }
+
+    // Figure out if we need to load the hardware implementation.
+    if (config->xclbin_prefix != nullptr && config->xclbin_prefix[0]) {
+        std::string xclbin_prefix = std::string(config->xclbin_prefix) + "." + config->emu_mode;
+        bool hw_profiling = config->hw_profiling != 0;
+        if (force_reload || xclbin_prefix != ctx->current_xclbin_prefix
+            || hw_profiling != ctx->current_hw_profiling)
+        {
+
+            // Reload hardware context.
+            if (progress) progress(user, "Opening new Alveo OpenCL context...");
+            ctx->sampler = nullptr;
+            ctx->hw_impl = std::make_shared<HardwareWordMatch>(
+                xclbin_prefix, config->kernel_name, config->num_subkernels, true, hw_profiling);
+            ctx->current_xclbin_prefix = xclbin_prefix;
+            ctx->current_hw_profiling = hw_profiling;
+            ctx->current_data_prefix = "";
+            if (progress) progress(user, "Opening new Alveo OpenCL context... done");
+
+        }
+    } else if (force_reload) {
+
+        // Forcibly release hardware context.
+        if (progress) progress(user, "Releasing Alveo OpenCL context...");
+        ctx->sampler = nullptr;
+        ctx->hw_impl = nullptr;
+        ctx->current_xclbin_prefix = "";
+        ctx->current_data_prefix = "";
+        if (progress) progress(user, "Releasing Alveo OpenCL context... done");
+
+    }
+
+    // Start, restart or stop the sensor sampler.
+    if (!ctx->hw_impl || !config->health_interval_ms) {
+        ctx->sampler = nullptr;
+    } else if (!ctx->sampler || ctx->sampler->get_interval() != config->health_interval_ms) {
+        std::vector<unsigned int> device_indices;
+        for (unsigned int card = 0; card < ctx->hw_impl->get_num_cards(); card++) {
+            device_indices.push_back(ctx->hw_impl->get_device_index(card));
+        }
+        ctx->sampler = nullptr;
+        ctx->sampler = std::make_shared<SensorSampler>(device_indices, config->health_interval_ms);
+    }
+
+    // Look for the CPU package energy counters.
+    if (!ctx->rapl) {
+        ctx->rapl = std::make_shared<RaplMeter>();
+    }
+
+    // Figure out if we need to load the software implementation.
+    if (config->keep_loaded && !ctx->sw_impl) {
+        ctx->sw_impl = std::make_shared<SoftwareWordMatch>();
+    } else if (!config->keep_loaded && ctx->sw_impl) {
+        ctx->sw_impl = nullptr;
+    }
+    if (ctx->sw_impl) {
+        ctx->sw_impl->streaming = config->sw_streaming;
+        ctx->sw_impl->work_stealing = config->sw_work_stealing;
+    }
+
+    // Figure out if we need to reload the data.
+    std::string data_prefix = std::string(config->data_prefix);
+    if (data_prefix != ctx->current_data_prefix || force_reload) {
+        std::vector<std::shared_ptr<WordMatch>> impls;
+        if (ctx->hw_impl) impls.push_back(ctx->hw_impl);
+        if (ctx->sw_impl) impls.push_back(ctx->sw_impl);
+        ctx->cache.clear();
+        ctx->data_version++;
+        WordMatchDatasetLoader(data_prefix, progress, user).load(impls);
+        ctx->current_data_prefix = data_prefix;
+    }
+    ctx->cache.set_capacity(config->result_cache_size);
+
+    // Build or release the trigram index. This is done after loading
+    // the data, so the index is not built for data that is unloaded right
+    // away.
+    if (ctx->sw_impl) {
+        if (config->sw_trigram_index && !ctx->sw_impl->get_index()) {
+            if (progress) progress(user, "Building trigram index...");
+            ctx->sw_impl->set_indexing(true);
+            if (progress) progress(user, "Building trigram index... done");
+        } else if (!config->sw_trigram_index) {
+            ctx->sw_impl->set_indexing(false);
+        }
+    }
+}
+
+/**
+ * Waits for the given running query to complete, and copies its results.
+ * Returns false if it was cancelled, in which case the caller should try
+ * again. Throws a `std::runtime_error` if it failed, or a
+ * `WordMatchCancelled` if `control` is cancelled while waiting.
+ */
+static bool wait_in_flight(InFlightQuery &flight, WordMatchControl *control, WordMatchResultsContainer &results) {
+    std::unique_lock<std::mutex> lock(flight.mutex);
+    while (!flight.done) {
+        if (control) {
+            control->check();
+        }
+        flight.cv.wait_for(lock, std::chrono::milliseconds(10));
+    }
+    if (flight.cancelled) {
+        return false;
+    }
+    if (!flight.results) {
+        throw std::runtime_error(flight.error);
+    }
+    results.assign(*flight.results);
+    results.coalesced = true;
+    return true;
+}
+
+/**
+ * Marks the given running query as done, storing its results in the cache
+ * and handing them to the queries that are waiting for it. `results` is
+ * null if the query failed or was cancelled.
+ */
+static void finish_in_flight(
+    WordMatchContext *ctx, const std::string &key, InFlightQuery &flight,
+    const WordMatchResultsContainer *results, bool cancelled, const std::string &error)
+{
+    unsigned int num_waiters;
+    {
+        std::lock_guard<std::mutex> lock(ctx->cache_mutex);
+        ctx->in_flight.erase(key);
+        num_waiters = flight.num_waiters;
+        if (results && ctx->cache.get_capacity()) {
+            ctx->cache.put(key, *results);
+        }
+    }
+
+    // The results are only copied if anyone is waiting for them. No queries
+    // can start waiting anymore now that this one cannot be found.
+    std::shared_ptr<WordMatchResultsContainer> copy;
+    if (results && num_waiters) {
+        copy = std::make_shared<WordMatchResultsContainer>();
+        copy->assign(*results);
+    }
+    {
+        std::lock_guard<std::mutex> lock(flight.mutex);
+        flight.done = true;
+        flight.cancelled = cancelled;
+        flight.results = copy;
+        flight.error = error;
+    }
+    flight.cv.notify_all();
+}
+
+/**
+ * Runs a query on the given context for the handle-based API, returning
+ * results owned by the caller. Hardware queries are serialized, software
+ * queries run concurrently with any other queries. A query that is
+ * identical to one that is already running waits for it and returns a copy
+ * of its results. If `control` is not
+ * null, it receives the progress of the run and is polled for
+ * cancellation. Throws a `std::runtime_error` on failure, or a
+ * `WordMatchCancelled` if the query was cancelled.
+ */
+static WordMatchResultsContainer *query(
+    WordMatchContext *ctx, WordMatchRunConfig *config,
+    void (*progress)(void *user, const char *status), void *user,
+    WordMatchControl *control = nullptr)
+{
+    // Check configuration.
+    if (config == nullptr) {
+        throw std::runtime_error("configuration must not be null");
+    }
+
+    // Construct the configuration.
+    WordMatchConfig wmc(config->pattern, config->whole_words, config->min_matches, config->top_k,
+        config->complete_results);
+
+    // Return a copy of the cached results if we have them. Otherwise, wait
+    // for an identical query that is already running if there is one, or
+    // register this query as running.
+    std::unique_ptr<WordMatchResultsContainer> results(new WordMatchResultsContainer());
+    std::string key = WordMatchResultCache::make_key(wmc, config->mode, ctx->data_version);
+    std::shared_ptr<InFlightQuery> flight;
+    while (!flight) {
+        std::shared_ptr<InFlightQuery> other;
+        {
+            std::lock_guard<std::mutex> lock(ctx->cache_mutex);
+            if (ctx->cache.get_capacity()) {
+                if (auto cached = ctx->cache.get(key)) {
+                    results->assign(*cached);
+                    return results.release();
+                }
+            }
+            auto it = ctx->in_flight.find(key);
+            if (it == ctx->in_flight.end()) {
+                flight = std::make_shared<InFlightQuery>();
+                ctx->in_flight[key] = flight;
+                break;
+            }
+            other = it->second;
+            other->num_waiters++;
+        }
+
+        // A query that is cancelled while waiting no longer needs a copy of
+        // the results, so it stops counting as a waiter.
+        bool coalesced;
+        try {
+            coalesced = wait_in_flight(*other, control, *results);
+        } catch (const WordMatchCancelled&) {
+            std::lock_guard<std::mutex> lock(ctx->cache_mutex);
+            other->num_waiters--;
+            throw;
+        }
+        if (coalesced) {
+            ctx->num_coalesced++;
+            return results.release();
+        }
+    }
+
+    // Run the implementation. The hardware implementation only has a single
+    // set of results, so they are copied while we still hold the lock. A
+    // query that was cancelled while waiting for the lock is not started.
+    try {
+        if (!config->mode) {
+            std::lock_guard<std::mutex> lock(ctx->hw_mutex);
+            select_impl(ctx, config->mode);
+            EnergyMeasurement energy(ctx, config->mode);
+            ctx->hw_impl->execute(wmc, progress, user, control);
+            energy.finish({&ctx->hw_impl->results});
+            results->assign(ctx->hw_impl->results);
+        } else {
+            select_impl(ctx, config->mode);
+            EnergyMeasurement energy(ctx, config->mode);
+            ctx->sw_impl->execute_into(wmc, *results, progress, user, control);
+            energy.finish({results.get()});
+        }
+    } catch (const WordMatchCancelled&) {
+        finish_in_flight(ctx, key, *flight, nullptr, true, "");
+        throw;
+    } catch (const std::exception &e) {
+        finish_in_flight(ctx, key, *flight, nullptr, false, e.what());
+        throw;
+    }
+    results->cached = false;
+    results->coalesced = false;
+    finish_in_flight(ctx, key, *flight, results.get(), false, "");
+
+    return results.release();
+}
+
+/**
+ * A query submitted through `word_match_submit()`, running on its own
+ * thread. The handle returned to the user is the ticket for the query.
+ */
+struct WordMatchQuery {
+
+    // Copy of the run configuration, which refers to our copy of the
+    // pattern.
+    std::string pattern;
+    WordMatchRunConfig config;
+
+    // Completion callback and its user pointer.
+    void (*complete)(void *user, WordMatchQuery *query);
+    void *user;
+
+    // Progress counters and cancellation flag, shared with the
+    // implementation.
+    WordMatchControl control;
+
+    // State of the query, and its results or error message once it is no
+    // longer running, guarded by the mutex. The condition variable is
+    // signalled when the query completes.
+    std::mutex mutex;
+    std::condition_variable cv;
+    int state = WORD_MATCH_QUERY_RUNNING;
+    std::unique_ptr<WordMatchResultsContainer> results;
+    std::string error;
+
+    // The thread running the query.
+    std::thread thread;
+
+};
+
+/**
+ * Body of the thread running a submitted query.
+ */
+static void run_submitted(WordMatchContext *ctx, WordMatchQuery *q) {
+    std::unique_ptr<WordMatchResultsContainer> results;
+    std::string error;
+    int state = WORD_MATCH_QUERY_DONE;
+    try {
+        q->control.check();
+        results.reset(query(ctx, &q->config, nullptr, nullptr, &q->control));
+    } catch (const WordMatchCancelled &e) {
+        state = WORD_MATCH_QUERY_CANCELLED;
+        error = e.what();
+    } catch (const std::exception &e) {
+        state = WORD_MATCH_QUERY_FAILED;
+        error = e.what();
+    }
+    {
+        std::lock_guard<std::mutex> lock(q->mutex);
+        q->results = std::move(results);
+        q->error = error;
+        q->state = state;
+    }
+    q->cv.notify_all();
+
+    // The callback may free the query, so we must not touch it afterwards.
+    if (q->complete) {
+        q->complete(q->user, q);
+    }
+}
 
 extern "C" {
 
 /**
- * Returns the most recent error message.
+ * Returns the most recent error message of the calling thread.
  */
 const char *word_match_last_error() {
-    if (state == nullptr) {
-        return "";
-    }
-    return state->last_error.c_str();
+    return last_error.c_str();
 }
 
 /**
@@ -54,62 +557,15 @@ int word_match_init(
     void (*progress)(void *user, const char *status), void *user)
 {
     if (state == nullptr) {
-        state = new state_type;
+        state = new WordMatchContext;
         atexit(word_match_release);
     }
 
     try {
-
-        // Check configuration.
-        if (config == nullptr) {
-            throw std::runtime_error("configuration must not be null");
-        }
-
-        // Figure out if we need to load the hardware implementation.
-        if (config->xclbin_prefix != nullptr && config->xclbin_prefix[0]) {
-            std::string xclbin_prefix = std::string(config->xclbin_prefix) + "." + config->emu_mode;
-            if (force_reload || xclbin_prefix != state->current_xclbin_prefix) {
-
-                // Reload hardware context.
-                if (progress) progress(user, "Opening new Alveo OpenCL context...");
-                state->hw_impl = std::make_shared<HardwareWordMatch>(
-                    xclbin_prefix, config->kernel_name, config->num_subkernels, true);
-                state->current_xclbin_prefix = xclbin_prefix;
-                state->current_data_prefix = "";
-                if (progress) progress(user, "Opening new Alveo OpenCL context... done");
-
-            }
-        } else if (force_reload) {
-
-            // Forcibly release hardware context.
-            if (progress) progress(user, "Releasing Alveo OpenCL context...");
-            state->hw_impl = nullptr;
-            state->current_xclbin_prefix = "";
-            state->current_data_prefix = "";
-            if (progress) progress(user, "Releasing Alveo OpenCL context... done");
-
-        }
-
-        // Figure out if we need to load the software implementation.
-        if (config->keep_loaded && !state->sw_impl) {
-            state->sw_impl = std::make_shared<SoftwareWordMatch>();
-        } else if (!config->keep_loaded && state->sw_impl) {
-            state->sw_impl = nullptr;
-        }
-
-        // Figure out if we need to reload the data.
-        std::string data_prefix = std::string(config->data_prefix);
-        if (data_prefix != state->current_data_prefix || force_reload) {
-            std::vector<std::shared_ptr<WordMatch>> impls;
-            if (state->hw_impl) impls.push_back(state->hw_impl);
-            if (state->sw_impl) impls.push_back(state->sw_impl);
-            WordMatchDatasetLoader(data_prefix, progress, user).load(impls);
-            state->current_data_prefix = data_prefix;
-        }
-
+        configure(state, config, force_reload, progress, user);
         return true;
     } catch (const std::exception& e) {
-        state->last_error = e.what();
+        last_error = e.what();
         return false;
     }
 }
@@ -140,63 +596,476 @@ const WordMatchResults *word_match_run(
         }
 
         // Select which implementation to use.
-        std::shared_ptr<WordMatch> impl;
+        std::shared_ptr<WordMatch> impl = select_impl(state, config->mode);
+
+        // Construct the configuration.
+        WordMatchConfig wmc(config->pattern, config->whole_words, config->min_matches, config->top_k,
+            config->complete_results);
+
+        // Return cached results if we have them.
+        std::string key = WordMatchResultCache::make_key(wmc, config->mode, state->data_version);
+        {
+            std::lock_guard<std::mutex> lock(state->cache_mutex);
+            if (state->cache.get_capacity()) {
+                if (auto cached = state->cache.get(key)) {
+                    return static_cast<const WordMatchResults*>(cached);
+                }
+            }
+        }
+
+        // Run the implementation.
+        std::unique_lock<std::mutex> hw_lock(state->hw_mutex, std::defer_lock);
         if (!config->mode) {
-            if (!state->hw_impl) {
-                throw std::runtime_error("hardware implementation is not loaded");
+            hw_lock.lock();
+        }
+        EnergyMeasurement energy(state, config->mode);
+        impl->execute(wmc, progress, user);
+        energy.finish({&impl->results});
+        impl->results.cached = false;
+        impl->results.coalesced = false;
+        {
+            std::lock_guard<std::mutex> lock(state->cache_mutex);
+            if (state->cache.get_capacity()) {
+                state->cache.put(key, impl->results);
             }
-            impl = state->hw_impl;
-        } else {
-            if (!state->sw_impl) {
-                throw std::runtime_error("software implementation is not loaded");
+        }
+
+        // Return the results.
+        return static_cast<const WordMatchResults*>(&impl->results);
+
+    } catch (const std::exception& e) {
+        last_error = e.what();
+        return nullptr;
+    }
+}
+
+/**
+ * Runs the (previously initialized) word matcher kernels for all
+ * `num_configs` configurations pointed to by `configs`, which must all
+ * specify the same mode. The software implementation decompresses the
+ * dataset only once for all of them. `progress` and `user` work the same as
+ * for `word_match_run()`. If this function returns null an error occured;
+ * the error message can be retrieved using `word_match_last_error()`.
+ * Otherwise, it returns an array of `num_configs` pointers to the results for
+ * each configuration, which remain valid only until the next FFI call.
+ */
+const WordMatchResults *const *word_match_run_batch(
+    WordMatchRunConfig *configs, unsigned int num_configs,
+    void (*progress)(void *user, const char *status), void *user)
+{
+    if (state == nullptr) {
+        return nullptr;
+    }
+
+    try {
+
+        // Check configuration.
+        if (configs == nullptr || !num_configs) {
+            throw std::runtime_error("at least one configuration is required");
+        }
+        for (unsigned int i = 1; i < num_configs; i++) {
+            if (configs[i].mode != configs[0].mode) {
+                throw std::runtime_error("all configurations in a batch must use the same mode");
+            }
+        }
+
+        // Select which implementation to use.
+        std::shared_ptr<WordMatch> impl = select_impl(state, configs[0].mode);
+
+        // Construct the configurations. Configurations with cached results
+        // are not run; their results are copied, because storing the results
+        // of the others may evict them from the cache.
+        state->batch_result_ptrs.assign(num_configs, nullptr);
+        state->batch_cached_results.clear();
+        state->batch_cached_results.reserve(num_configs);
+        std::vector<WordMatchConfig> wmcs;
+        std::vector<std::string> keys;
+        std::vector<unsigned int> indices;
+        std::unique_lock<std::mutex> cache_lock(state->cache_mutex);
+        for (unsigned int i = 0; i < num_configs; i++) {
+            WordMatchConfig wmc(configs[i].pattern, configs[i].whole_words, configs[i].min_matches, configs[i].top_k,
+                configs[i].complete_results);
+            std::string key = WordMatchResultCache::make_key(wmc, configs[i].mode, state->data_version);
+            const WordMatchResultsContainer *cached = nullptr;
+            if (state->cache.get_capacity()) {
+                cached = state->cache.get(key);
             }
-            if (config->mode > 0) {
-                omp_set_dynamic(0);
-                omp_set_num_threads(config->mode);
+            if (cached) {
+                state->batch_cached_results.emplace_back();
+                state->batch_cached_results.back().assign(*cached);
+                state->batch_result_ptrs[i] = &state->batch_cached_results.back();
             } else {
-                omp_set_dynamic(1);
-                omp_set_num_threads(-config->mode);
+                wmcs.push_back(wmc);
+                keys.push_back(key);
+                indices.push_back(i);
             }
-            impl = state->sw_impl;
         }
-
-        // Construct the configuration.
-        WordMatchConfig wmc(config->pattern, config->whole_words, config->min_matches);
+        cache_lock.unlock();
 
         // Run the implementation.
-        impl->execute(wmc, progress, user);
+        if (!wmcs.empty()) {
+            std::unique_lock<std::mutex> hw_lock(state->hw_mutex, std::defer_lock);
+            if (!configs[0].mode) {
+                hw_lock.lock();
+            }
+            EnergyMeasurement energy(state, configs[0].mode);
+            impl->execute_batch(wmcs, progress, user);
+            std::vector<WordMatchResults*> results;
+            for (auto &bresults : impl->batch_results) {
+                results.push_back(&bresults);
+            }
+            energy.finish(results);
+            cache_lock.lock();
+            for (size_t i = 0; i < wmcs.size(); i++) {
+                auto &bresults = impl->batch_results[i];
+                bresults.cached = false;
+                bresults.coalesced = false;
+                if (state->cache.get_capacity()) {
+                    state->cache.put(keys[i], bresults);
+                }
+                state->batch_result_ptrs[indices[i]] = &bresults;
+            }
+        }
 
         // Return the results.
-        return static_cast<const WordMatchResults*>(&impl->results);
+        return state->batch_result_ptrs.data();
+
+    } catch (const std::exception& e) {
+        last_error = e.what();
+        return nullptr;
+    }
+}
+
+/**
+ * Opens a new context with the given platform configuration, which is
+ * loaded as for `word_match_init()` with `force_reload` set. Queries on the
+ * context can be run with `word_match_query()` from any number of threads at
+ * once. If this function returns null an error occured; the error message
+ * can be retrieved using `word_match_last_error()`. Otherwise, the context
+ * must be released with `word_match_close()`.
+ */
+WordMatchContext *word_match_open(
+    WordMatchPlatformConfig *config,
+    void (*progress)(void *user, const char *status), void *user)
+{
+    std::unique_ptr<WordMatchContext> ctx(new WordMatchContext);
+    try {
+        configure(ctx.get(), config, true, progress, user);
+        return ctx.release();
+    } catch (const std::exception& e) {
+        last_error = e.what();
+        return nullptr;
+    }
+}
+
+/**
+ * Releases a context opened with `word_match_open()`. No queries may be
+ * running on it.
+ */
+void word_match_close(WordMatchContext *ctx) {
+    delete ctx;
+}
+
+/**
+ * Returns the context configured by `word_match_init()`, or null if it has
+ * not been called yet. This context must not be closed.
+ */
+WordMatchContext *word_match_context() {
+    return state;
+}
+
+/**
+ * Runs a query on the given context. Unlike `word_match_run()`, this may be
+ * called from multiple threads at once; software queries run concurrently,
+ * hardware queries are run one at a time. The context must not be
+ * reconfigured or closed while queries are running. A query that is
+ * identical to one that is already running on the same context, including
+ * the run mode, waits for it and gets a copy of its results instead of
+ * running again; see the `coalesced` result. `progress` and `user`
+ * work the same as for `word_match_run()`. For hardware queries, the
+ * callback is also called from the threads that run the chunks, one at a
+ * time, and queries on other threads may call it at the same time, so it
+ * must be thread-safe. If this function returns null an error occured;
+ * the error message can be retrieved using `word_match_last_error()` from
+ * the same thread. Otherwise, the results are owned by the caller and must
+ * be released with `word_match_results_free()`.
+ */
+const WordMatchResults *word_match_query(
+    WordMatchContext *ctx, WordMatchRunConfig *config,
+    void (*progress)(void *user, const char *status), void *user)
+{
+    try {
+        if (ctx == nullptr) {
+            throw std::runtime_error("context must not be null");
+        }
+        return static_cast<const WordMatchResults*>(query(ctx, config, progress, user));
+    } catch (const std::exception& e) {
+        last_error = e.what();
+        return nullptr;
+    }
+}
+
+/**
+ * Releases results returned by `word_match_query()`.
+ */
+void word_match_results_free(const WordMatchResults *results) {
+    delete static_cast<const WordMatchResultsContainer*>(results);
+}
+
+/**
+ * Submits a query to run on the given context in the background, and
+ * returns its ticket right away. The query behaves like one run with
+ * `word_match_query()` from another thread. `complete`, if not null, is
+ * called with `user` and the ticket from the thread running the query once
+ * it is no longer running. If this function returns null an error occured;
+ * the error message can be retrieved using `word_match_last_error()`.
+ * Otherwise, the ticket must be released with `word_match_query_free()`.
+ */
+WordMatchQuery *word_match_submit(
+    WordMatchContext *ctx, WordMatchRunConfig *config,
+    void (*complete)(void *user, WordMatchQuery *query), void *user)
+{
+    try {
+        if (ctx == nullptr) {
+            throw std::runtime_error("context must not be null");
+        }
+        if (config == nullptr || config->pattern == nullptr) {
+            throw std::runtime_error("configuration must not be null");
+        }
+        std::unique_ptr<WordMatchQuery> q(new WordMatchQuery);
+        q->pattern = config->pattern;
+        q->config = *config;
+        q->config.pattern = q->pattern.c_str();
+        q->complete = complete;
+        q->user = user;
 
+        // The thread takes the lock before it stores the outcome, so it
+        // cannot complete before the thread handle has been stored.
+        std::lock_guard<std::mutex> lock(q->mutex);
+        q->thread = std::thread(run_submitted, ctx, q.get());
+        return q.release();
     } catch (const std::exception& e) {
-        state->last_error = e.what();
+        last_error = e.what();
+        return nullptr;
+    }
+}
+
+/**
+ * Returns the state and the progress of a submitted query.
+ */
+WordMatchQueryProgress word_match_query_progress(WordMatchQuery *query) {
+    WordMatchQueryProgress result;
+    {
+        std::lock_guard<std::mutex> lock(query->mutex);
+        result.state = query->state;
+    }
+    result.chunks_done = query->control.chunks_done;
+    result.chunks_total = query->control.chunks_total;
+    result.bytes_scanned = query->control.bytes_scanned;
+    result.bytes_total = query->control.bytes_total;
+    return result;
+}
+
+/**
+ * Requests a submitted query to stop. Software queries stop within a few
+ * hundred articles per thread; hardware queries do not start any more
+ * chunks, but finish the ones that are running. Queries that were still
+ * waiting for the hardware do not start at all. The query then completes
+ * with the `WORD_MATCH_QUERY_CANCELLED` state, unless it completed
+ * before it noticed.
+ */
+void word_match_cancel(WordMatchQuery *query) {
+    query->control.cancelled = true;
+}
+
+/**
+ * Waits for a submitted query to complete, and returns its results. If this
+ * function returns null the query failed or was cancelled; the error
+ * message can be retrieved using `word_match_last_error()`. Otherwise, the
+ * results remain valid until the ticket is released.
+ */
+const WordMatchResults *word_match_wait(WordMatchQuery *query) {
+    std::unique_lock<std::mutex> lock(query->mutex);
+    query->cv.wait(lock, [query] { return query->state != WORD_MATCH_QUERY_RUNNING; });
+    if (!query->results) {
+        last_error = query->error;
         return nullptr;
     }
+    return static_cast<const WordMatchResults*>(query->results.get());
 }
 
 /**
- * Queries health information from the Alveo board.
+ * Releases the ticket of a submitted query along with its results. A query
+ * that is still running is cancelled and waited for first. This may be
+ * called from the completion callback.
+ */
+void word_match_query_free(WordMatchQuery *query) {
+    if (query == nullptr) {
+        return;
+    }
+    query->control.cancelled = true;
+    if (query->thread.get_id() == std::this_thread::get_id()) {
+        query->thread.detach();
+    } else {
+        query->thread.join();
+    }
+    delete query;
+}
+
+/**
+ * Queries health information from the Alveo board. When multiple cards are
+ * in use, the highest temperature and the total power of all of them are
+ * returned.
  */
 WordMatchHealthInfo word_match_health() {
-    WordMatchHealthInfo result;
+    WordMatchHealthInfo result = {0.0f, 0.0f, 0.0f};
     try {
-        unsigned int index = 0;
-        if (state->hw_impl) {
-            index = state->hw_impl->get_device_index();
-        }
-        XBUtilDumpInfo info;
-        xbutil_dump(info, index);
-        result.fpga_temp = info.fpga_temp;
-        result.power_in = info.power_in;
-        result.power_vccint = info.power_vccint;
+        unsigned int num_cards = 1;
+        if (state != nullptr && state->hw_impl) {
+            num_cards = state->hw_impl->get_num_cards();
+        }
+        for (unsigned int card = 0; card < num_cards; card++) {
+            unsigned int index = 0;
+            if (state != nullptr && state->hw_impl) {
+                index = state->hw_impl->get_device_index(card);
+            }
+            auto info = card_health(card, index);
+            result.fpga_temp = std::max(result.fpga_temp, info.fpga_temp);
+            result.power_in += info.power_in;
+            result.power_vccint += info.power_vccint;
+        }
+        return result;
+    } catch (const std::exception& e) {
+        last_error = e.what();
         return result;
+    }
+}
+
+/**
+ * Returns the number of Alveo cards used by the hardware implementation,
+ * or 0 if it is not available.
+ */
+unsigned int word_match_num_cards() {
+    if (state == nullptr || !state->hw_impl) {
+        return 0;
+    }
+    return state->hw_impl->get_num_cards();
+}
+
+/**
+ * Queries health information from the given Alveo card, numbered from 0 up
+ * to `word_match_num_cards()`.
+ */
+WordMatchHealthInfo word_match_card_health(unsigned int card) {
+    WordMatchHealthInfo result = {0.0f, 0.0f, 0.0f};
+    try {
+        if (state == nullptr || !state->hw_impl) {
+            throw std::runtime_error("hardware implementation is not available");
+        }
+        if (card >= state->hw_impl->get_num_cards()) {
+            throw std::runtime_error("card " + std::to_string(card) + " does not exist");
+        }
+        return card_health(card, state->hw_impl->get_device_index(card));
     } catch (const std::exception& e) {
-        if (state != nullptr) {
-            state->last_error = e.what();
+        last_error = e.what();
+        return result;
+    }
+}
+
+/**
+ * Returns statistics of the health samples of the given card taken by the
+ * background sampler within the last `window_ms` milliseconds, or of only
+ * the most recent sample if `window_ms` is 0. This never blocks on the
+ * sensors. If the sampler is not running (see `health_interval_ms`), no
+ * samples are returned and the error message is set.
+ */
+WordMatchHealthStats word_match_health_stats(unsigned int card, unsigned int window_ms) {
+    WordMatchHealthStats result;
+    memset(&result, 0, sizeof(result));
+    try {
+        if (state == nullptr || !state->sampler) {
+            throw std::runtime_error("health sampler is not running");
+        }
+        if (card >= state->sampler->num_cards()) {
+            throw std::runtime_error("card " + std::to_string(card) + " does not exist");
+        }
+        SensorStats stats;
+        if (!state->sampler->stats(card, (uint64_t)window_ms * 1000, stats)) {
+            return result;
         }
+        result.num_samples = stats.num_samples;
+        result.age = SensorSampler::now() - stats.latest.time;
+        result.latest = sample_to_health(stats.latest);
+        result.min = sample_to_health(stats.min);
+        result.avg = sample_to_health(stats.avg);
+        result.max = sample_to_health(stats.max);
+        return result;
+    } catch (const std::exception& e) {
+        last_error = e.what();
+        return result;
+    }
+}
+
+/**
+ * Queries information about the trigram index of the software
+ * implementation.
+ */
+WordMatchIndexInfo word_match_index_info() {
+    WordMatchIndexInfo result = {0, 0, 0, 0};
+    if (state == nullptr || !state->sw_impl) {
+        return result;
+    }
+    auto index = state->sw_impl->get_index();
+    if (index) {
+        result.enabled = true;
+        result.num_trigrams = index->num_trigrams();
+        result.size = index->size();
+        result.build_time = index->get_build_time();
+    }
+    return result;
+}
+
+/**
+ * Queries information about the result cache.
+ */
+WordMatchCacheInfo word_match_cache_info() {
+    WordMatchCacheInfo result = {0, 0, 0, 0, 0, 0};
+    if (state == nullptr) {
+        return result;
+    }
+    std::lock_guard<std::mutex> lock(state->cache_mutex);
+    result.num_entries = state->cache.get_num_entries();
+    result.size = state->cache.get_size();
+    result.capacity = state->cache.get_capacity();
+    result.hits = state->cache.get_hits();
+    result.misses = state->cache.get_misses();
+    result.coalesced = state->num_coalesced;
+    return result;
+}
+
+/**
+ * Queries information about the placement of the dataset on the kernel
+ * instances of the hardware implementation. The returned pointers remain
+ * valid only until the next FFI call.
+ */
+WordMatchPlacementInfo word_match_placement_info() {
+    WordMatchPlacementInfo result = {0, 0, nullptr, 0, 1.0f};
+    if (state == nullptr || !state->hw_impl) {
         return result;
     }
+    auto placement = state->hw_impl->get_placement();
+    if (!placement) {
+        return result;
+    }
+    state->placement_bytes.assign(placement->instance_bytes.begin(), placement->instance_bytes.end());
+    result.num_instances = placement->num_instances();
+    for (auto &chunks : placement->instance_chunks) {
+        result.num_chunks += chunks.size();
+    }
+    result.instance_bytes = state->placement_bytes.data();
+    result.makespan = placement->makespan();
+    result.imbalance = placement->imbalance();
+    return result;
 }
 
 /**
@@ -207,10 +1076,13 @@ void word_match_release() {
         return;
     }
     try {
+        state->sampler = nullptr;
         state->hw_impl = nullptr;
         state->sw_impl = nullptr;
+        state->cache.clear();
+        state->batch_cached_results.clear();
     } catch (const std::exception& e) {
-        state->last_error = e.what();
+        last_error = e.what();
     }
 }
 
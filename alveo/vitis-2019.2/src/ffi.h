@@ -25,10 +25,40 @@ typedef struct {
     const char *kernel_name;
     unsigned int num_subkernels;
 
+    // Whether the command queues of the hardware implementation should be
+    // created with OpenCL profiling enabled, such that the results include a
+    // breakdown of where the time goes and a trace of the commands. Changing
+    // this reopens the hardware context.
+    int hw_profiling;
+
     // Whether the data should remain loaded in memory to allow for software
     // runs.
     int keep_loaded;
 
+    // Whether software runs should decompress articles into a small sliding
+    // window and match while decompressing, rather than decompressing each
+    // article completely before matching it.
+    int sw_streaming;
+
+    // Whether software runs should let threads take blocks of articles from a
+    // shared queue, rather than giving each thread a fixed part of the dataset
+    // with the same number of bytes.
+    int sw_work_stealing;
+
+    // Whether a trigram index should be built for software runs, such that
+    // articles that cannot contain the pattern are not decompressed.
+    int sw_trigram_index;
+
+    // Memory budget in bytes for caching the results of recent queries, or 0
+    // to disable the cache. The cache is cleared when the data is reloaded.
+    unsigned long long result_cache_size;
+
+    // Interval in milliseconds at which a background thread samples the
+    // sensors of the cards used by the hardware implementation, such that
+    // health queries return the latest sample without blocking, or 0 to
+    // read the sensors on demand for every health query.
+    unsigned int health_interval_ms;
+
 } WordMatchPlatformConfig;
 
 /**
@@ -54,6 +84,19 @@ typedef struct {
     // the optimal number of threads).
     int mode;
 
+    // Number of pages with the most matches to return in the `top_pages`
+    // results, or 0 to disable ranking.
+    unsigned int top_k;
+
+    // Specifies how to handle chunks with more matching pages than the
+    // hardware can return records for. 0 returns records for the first
+    // matching pages only. 1 re-runs such chunks over smaller ranges of
+    // articles where needed to make the `top_k` ranking exact. 2 re-runs all
+    // of them, such that records are returned for all matching pages. The
+    // software implementation always ranks exactly, and only records all
+    // matching pages for 2.
+    int complete_results;
+
 } WordMatchRunConfig;
 
 /**
@@ -83,6 +126,11 @@ typedef struct {
     unsigned int cycle_count;
     float clock_frequency;
 
+    // Load imbalance between the sub-kernels of the hardware kernel, in
+    // terms of the compressed bytes assigned to them: the largest amount
+    // divided by the mean. 1 for the software implementation.
+    float subkernel_imbalance;
+
     // The approximate size of the input data to compute bandwidth (this is the
     // sum of the number of bytes in the article text values and offset
     // buffers).
@@ -92,8 +140,56 @@ typedef struct {
     // and transferring results back) in microseconds.
     unsigned int time_taken;
 
+    // Breakdown of the time taken by the hardware implementation from the
+    // OpenCL profiling information, in microseconds, summed over the kernel
+    // runs for this chunk (including re-runs): the time the runs spent
+    // queued on the host, the time between their submission to the device
+    // and their start, their execution time, and the execution time of the
+    // result readbacks. Only set when `hw_profiling` is enabled; 0 otherwise.
+    unsigned int queue_time;
+    unsigned int submit_time;
+    unsigned int kernel_time;
+    unsigned int readback_time;
+
 } WordMatchPartialResults;
 
+/**
+ * Types of the commands in a hardware profiling trace.
+ */
+#define WORD_MATCH_TRACE_KERNEL 0
+#define WORD_MATCH_TRACE_READBACK 1
+
+/**
+ * Profiling information for a single OpenCL command issued by the hardware
+ * implementation, C-style for IPC.
+ */
+typedef struct {
+
+    // Type of the command, one of the `WORD_MATCH_TRACE_*` values.
+    int type;
+
+    // Index of the partial results and of the kernel instance that the
+    // command was issued for.
+    unsigned int chunk;
+    unsigned int instance;
+
+    // Times at which the command was queued by the host, submitted to the
+    // device, started and ended, in nanoseconds since the first command of
+    // the query was queued.
+    unsigned long long queued;
+    unsigned long long submit;
+    unsigned long long start;
+    unsigned long long end;
+
+} WordMatchTraceEvent;
+
+/**
+ * Sources of the energy measurement of a run.
+ */
+#define WORD_MATCH_ENERGY_NONE 0
+#define WORD_MATCH_ENERGY_CARDS 1
+#define WORD_MATCH_ENERGY_RAPL 2
+
 /**
  * Complete result set for a single kernel invocation, C-style for IPC.
  */
@@ -112,10 +208,61 @@ typedef struct {
     // Total amount of time taken in microseconds.
     unsigned int time_taken;
 
+    // Time between the start of the run and the moment the first article
+    // data started being processed, in microseconds.
+    unsigned int startup_time;
+
+    // Ratio between the longest and the average time taken by the partial
+    // results, as a measure for load imbalance; 1.0 is perfectly balanced.
+    float imbalance;
+
+    // Fraction of the articles that were actually scanned. This is less than
+    // 1.0 when the trigram index ruled out the other articles.
+    float scan_fraction;
+
+    // The (at most `top_k`) pages with the most matches, ordered by
+    // decreasing match count and then by their position in the dataset.
+    // `top_pages_exact` is nonzero if these are guaranteed to be the actual
+    // top pages of the whole dataset; the hardware implementation can only
+    // rank the pages it returned records for.
+    unsigned int num_top_pages;
+    const unsigned int *top_page_counts;
+    const unsigned int *top_page_title_offsets;
+    const char *top_page_title_values;
+    int top_pages_exact;
+
+    // Whether these results were served from the result cache. The timing
+    // information then refers to the run that originally produced them.
+    int cached;
+
     // Partial results for each individual kernel invocation.
     unsigned int num_partial_results;
     WordMatchPartialResults **partial_results;
 
+    // Profiling trace of all kernel runs and result readbacks of the query in
+    // the order in which they were queued, if `hw_profiling` is enabled for
+    // the hardware implementation. Empty otherwise.
+    unsigned int num_trace_events;
+    const WordMatchTraceEvent *trace_events;
+
+    // Energy used during the run in joules and the average power in watts,
+    // and where they were measured (one of the `WORD_MATCH_ENERGY_*`
+    // values). Hardware runs integrate the input power of the cards over
+    // the run, which requires the health sampler (see `health_interval_ms`);
+    // software runs read the CPU package energy counters (RAPL) if they are
+    // readable. Both are 0 if no measurement is available. For batch runs,
+    // the energy of the batch is divided evenly over the queries that were
+    // run.
+    double energy;
+    float avg_power;
+    int energy_source;
+
+    // Whether these results were produced by an identical query that was
+    // already running when this one was started through the handle-based
+    // API. Like for cached results, the timing and energy information then
+    // refers to that query.
+    int coalesced;
+
 } WordMatchResults;
 
 /**
@@ -135,7 +282,136 @@ typedef struct {
 } WordMatchHealthInfo;
 
 /**
- * Returns the most recent error message.
+ * Statistics of the sampled health of an Alveo board.
+ */
+typedef struct {
+
+    // Number of samples taken within the requested window. 0 if no samples
+    // are available, in which case the other fields are 0 as well.
+    unsigned int num_samples;
+
+    // Age of the most recent sample in microseconds.
+    unsigned long long age;
+
+    // The most recent sample, and the minimum, mean and maximum of each
+    // value over the window.
+    WordMatchHealthInfo latest;
+    WordMatchHealthInfo min;
+    WordMatchHealthInfo avg;
+    WordMatchHealthInfo max;
+
+} WordMatchHealthStats;
+
+/**
+ * Trigram index information record.
+ */
+typedef struct {
+
+    // Whether the index is enabled.
+    int enabled;
+
+    // Number of distinct trigrams in the index.
+    unsigned int num_trigrams;
+
+    // Approximate size of the index in bytes.
+    unsigned long long size;
+
+    // Total time spent building the index in microseconds.
+    unsigned long long build_time;
+
+} WordMatchIndexInfo;
+
+/**
+ * Result cache information record.
+ */
+typedef struct {
+
+    // Number of cached result sets.
+    unsigned int num_entries;
+
+    // Approximate memory used by the cached results and the budget, in bytes.
+    unsigned long long size;
+    unsigned long long capacity;
+
+    // Number of queries that were and were not served from the cache.
+    unsigned long long hits;
+    unsigned long long misses;
+
+    // Number of queries that received the results of an identical query that
+    // was already running instead of running themselves. This does not
+    // depend on the cache being enabled.
+    unsigned long long coalesced;
+
+} WordMatchCacheInfo;
+
+/**
+ * Hardware chunk placement information record.
+ */
+typedef struct {
+
+    // Number of kernel instances and of chunks placed on them. Both are zero
+    // if the hardware implementation or the dataset is not loaded.
+    unsigned int num_instances;
+    unsigned int num_chunks;
+
+    // Number of compressed text bytes placed on each kernel instance.
+    const unsigned long long *instance_bytes;
+
+    // Number of compressed text bytes of the most loaded instance, which
+    // determines the latency of a query.
+    unsigned long long makespan;
+
+    // Predicted load imbalance, computed like the `imbalance` result.
+    float imbalance;
+
+} WordMatchPlacementInfo;
+
+/**
+ * Opaque handle to a loaded platform configuration and dataset, used by the
+ * reentrant query API.
+ */
+typedef struct WordMatchContext WordMatchContext;
+
+/**
+ * Opaque ticket for a query submitted with `word_match_submit()`.
+ */
+typedef struct WordMatchQuery WordMatchQuery;
+
+/**
+ * States of a submitted query.
+ */
+#define WORD_MATCH_QUERY_RUNNING 0
+#define WORD_MATCH_QUERY_DONE 1
+#define WORD_MATCH_QUERY_FAILED 2
+#define WORD_MATCH_QUERY_CANCELLED 3
+
+/**
+ * Progress information record of a submitted query.
+ */
+typedef struct {
+
+    // State of the query (one of the `WORD_MATCH_QUERY_*` constants).
+    int state;
+
+    // Number of chunks processed so far and in total. For software runs,
+    // these are the blocks of articles that the threads process. For
+    // hardware runs, chunks that are re-run to complete the results are
+    // added to the total once the first pass is done. Both are zero while a
+    // hardware query waits for another one to finish, while a query waits for
+    // an identical one that is already running, and for results that come
+    // from the cache or from such an identical query.
+    unsigned int chunks_done;
+    unsigned int chunks_total;
+
+    // Number of bytes scanned so far and in total, counted like the
+    // `data_size` partial result.
+    unsigned long long bytes_scanned;
+    unsigned long long bytes_total;
+
+} WordMatchQueryProgress;
+
+/**
+ * Returns the most recent error message of the calling thread.
  */
 const char *word_match_last_error();
 
@@ -168,10 +444,165 @@ const WordMatchResults *word_match_run(
     void *user);
 
 /**
- * Queries health information from the Alveo board.
+ * Runs the (previously initialized) word matcher kernels for all
+ * `num_configs` configurations pointed to by `configs`, which must all
+ * specify the same mode. The software implementation decompresses the
+ * dataset only once for all of them. `progress` and `user` work the same as
+ * for `word_match_run()`. If this function returns null an error occured;
+ * the error message can be retrieved using `word_match_last_error()`.
+ * Otherwise, it returns an array of `num_configs` pointers to the results for
+ * each configuration, which remain valid only until the next FFI call.
+ */
+const WordMatchResults *const *word_match_run_batch(
+    WordMatchRunConfig *configs, unsigned int num_configs,
+    void (*progress)(void *user, const char *status),
+    void *user);
+
+/**
+ * Opens a new context with the given platform configuration, which is
+ * loaded as for `word_match_init()` with `force_reload` set. Queries on the
+ * context can be run with `word_match_query()` from any number of threads at
+ * once. If this function returns null an error occured; the error message
+ * can be retrieved using `word_match_last_error()`. Otherwise, the context
+ * must be released with `word_match_close()`. Only one context (including
+ * the one used by `word_match_init()`) should load the hardware
+ * implementation at a time.
+ */
+WordMatchContext *word_match_open(
+    WordMatchPlatformConfig *config,
+    void (*progress)(void *user, const char *status),
+    void *user);
+
+/**
+ * Releases a context opened with `word_match_open()`. No queries may be
+ * running on it.
+ */
+void word_match_close(WordMatchContext *ctx);
+
+/**
+ * Returns the context configured by `word_match_init()`, or null if it has
+ * not been called yet. This context must not be closed.
+ */
+WordMatchContext *word_match_context();
+
+/**
+ * Runs a query on the given context. Unlike `word_match_run()`, this may be
+ * called from multiple threads at once; software queries run concurrently,
+ * hardware queries are run one at a time. The context must not be
+ * reconfigured or closed while queries are running. A query that is
+ * identical to one that is already running on the same context, including
+ * the run mode, waits for it and gets a copy of its results instead of
+ * running again; see the `coalesced` result. `progress` and `user`
+ * work the same as for `word_match_run()`. For hardware queries, the
+ * callback is also called from the threads that run the chunks, one at a
+ * time, and queries on other threads may call it at the same time, so it
+ * must be thread-safe. If this function returns null an error occured;
+ * the error message can be retrieved using `word_match_last_error()` from
+ * the same thread. Otherwise, the results are owned by the caller and must
+ * be released with `word_match_results_free()`.
+ * The energy reported for software queries includes that of any queries
+ * running at the same time.
+ */
+const WordMatchResults *word_match_query(
+    WordMatchContext *ctx, WordMatchRunConfig *config,
+    void (*progress)(void *user, const char *status),
+    void *user);
+
+/**
+ * Releases results returned by `word_match_query()`.
+ */
+void word_match_results_free(const WordMatchResults *results);
+
+/**
+ * Submits a query to run on the given context in the background, and
+ * returns its ticket right away. The query behaves like one run with
+ * `word_match_query()` from another thread. `complete`, if not null, is
+ * called with `user` and the ticket from the thread running the query once
+ * it is no longer running. If this function returns null an error occured;
+ * the error message can be retrieved using `word_match_last_error()`.
+ * Otherwise, the ticket must be released with `word_match_query_free()`.
+ */
+WordMatchQuery *word_match_submit(
+    WordMatchContext *ctx, WordMatchRunConfig *config,
+    void (*complete)(void *user, WordMatchQuery *query),
+    void *user);
+
+/**
+ * Returns the state and the progress of a submitted query.
+ */
+WordMatchQueryProgress word_match_query_progress(WordMatchQuery *query);
+
+/**
+ * Requests a submitted query to stop. Software queries stop within a few
+ * hundred articles per thread; hardware queries do not start any more
+ * chunks, but finish the ones that are running. Queries that were still
+ * waiting for the hardware do not start at all. The query then completes
+ * with the `WORD_MATCH_QUERY_CANCELLED` state, unless it completed
+ * before it noticed.
+ */
+void word_match_cancel(WordMatchQuery *query);
+
+/**
+ * Waits for a submitted query to complete, and returns its results. If this
+ * function returns null the query failed or was cancelled; the error
+ * message can be retrieved using `word_match_last_error()`. Otherwise, the
+ * results remain valid until the ticket is released.
+ */
+const WordMatchResults *word_match_wait(WordMatchQuery *query);
+
+/**
+ * Releases the ticket of a submitted query along with its results. A query
+ * that is still running is cancelled and waited for first. This may be
+ * called from the completion callback.
+ */
+void word_match_query_free(WordMatchQuery *query);
+
+/**
+ * Queries health information from the Alveo board. When multiple cards are
+ * in use, the highest temperature and the total power of all of them are
+ * returned.
  */
 WordMatchHealthInfo word_match_health();
 
+/**
+ * Returns the number of Alveo cards used by the hardware implementation,
+ * or 0 if it is not available.
+ */
+unsigned int word_match_num_cards();
+
+/**
+ * Queries health information from the given Alveo card, numbered from 0 up
+ * to `word_match_num_cards()`.
+ */
+WordMatchHealthInfo word_match_card_health(unsigned int card);
+
+/**
+ * Returns statistics of the health samples of the given card taken by the
+ * background sampler within the last `window_ms` milliseconds, or of only
+ * the most recent sample if `window_ms` is 0. This never blocks on the
+ * sensors. If the sampler is not running (see `health_interval_ms`), no
+ * samples are returned and the error message is set.
+ */
+WordMatchHealthStats word_match_health_stats(unsigned int card, unsigned int window_ms);
+
+/**
+ * Queries information about the trigram index of the software
+ * implementation.
+ */
+WordMatchIndexInfo word_match_index_info();
+
+/**
+ * Queries information about the result cache.
+ */
+WordMatchCacheInfo word_match_cache_info();
+
+/**
+ * Queries information about the placement of the dataset on the kernel
+ * instances of the hardware implementation. The returned pointers remain
+ * valid only until the next FFI call.
+ */
+WordMatchPlacementInfo word_match_placement_info();
+
 /**
  * Free all resources.
  */
@@ -2,8 +2,16 @@
 #include "hardware.hpp"
 #include <omp.h>
 #include <mutex>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <exception>
 #include <iostream>
 
+// Number of DDR memory banks and their capacity on the supported cards.
+static const unsigned int BANK_COUNT = 4;
+static const uint64_t BANK_CAPACITY = 16ull << 30;
+
 /**
  * Constructs a search command for the hardware word matcher kernel.
  */
@@ -30,7 +38,35 @@ HardwareWordMatchConfig::HardwareWordMatchConfig(const WordMatchConfig &config)
 std::shared_ptr<AlveoBuffer> HardwareWordMatchKernel::arrow_to_alveo(
     AlveoKernelInstance &context, int bank, const std::shared_ptr<arrow::Buffer> &buffer)
 {
-    return std::make_shared<AlveoBuffer>(context, buffer->size(), (void*)buffer->data(), bank);
+    // The buffer usually points into the memory-mapped record batch file,
+    // which is then migrated to the device without a copy on the host.
+    return std::make_shared<AlveoBuffer>(context, (const void*)buffer->data(), buffer->size(), bank);
+}
+
+/**
+ * Splits the articles from `first` up to `last` into `parts` ranges with
+ * about the same number of compressed bytes, using the given text offsets.
+ * Returns the first article of each range, followed by `last`.
+ */
+std::vector<unsigned int> HardwareWordMatchKernel::split_rows(
+    const int32_t *text_offsets, unsigned int first, unsigned int last, unsigned int parts)
+{
+    // Each boundary is placed at the article start closest to the ideal
+    // split point.
+    const int32_t *end = text_offsets + last;
+    uint64_t total = text_offsets[last] - text_offsets[first];
+    std::vector<unsigned int> rows(1, first);
+    for (unsigned int i = 1; i < parts; i++) {
+        int64_t target = text_offsets[first] + (int64_t)(total * i / parts);
+        const int32_t *it = std::lower_bound(text_offsets + rows.back(), end, target);
+        unsigned int row = it - text_offsets;
+        if (row > rows.back() && target - it[-1] < (it == end ? INT64_MAX : *it - target)) {
+            row--;
+        }
+        rows.push_back(row);
+    }
+    rows.push_back(last);
+    return rows;
 }
 
 /**
@@ -39,6 +75,7 @@ std::shared_ptr<AlveoBuffer> HardwareWordMatchKernel::arrow_to_alveo(
 void HardwareWordMatchKernel::clear_chunks() {
     chunks.clear();
     current_chunk = 0xFFFFFFFF;
+    current_rows.clear();
 }
 
 HardwareWordMatchKernel::HardwareWordMatchKernel(
@@ -46,7 +83,8 @@ HardwareWordMatchKernel::HardwareWordMatchKernel(
     float clock0,
     float clock1,
     unsigned int num_subkernels,
-    int num_results
+    int num_results,
+    unsigned int pipeline_depth
 ) :
     context(context),
     num_results(num_results),
@@ -88,27 +126,33 @@ HardwareWordMatchKernel::HardwareWordMatchKernel(
     }
 
 
-    // Create buffers for the results.
-    result_title_offset = std::make_shared<AlveoBuffer>(
-        context, CL_MEM_WRITE_ONLY, (num_results + 1) * 4, bank);
-    result_title_values = std::make_shared<AlveoBuffer>(
-        context, CL_MEM_WRITE_ONLY, (num_results + 1) * 256, bank);
-    result_matches = std::make_shared<AlveoBuffer>(
-        context, CL_MEM_WRITE_ONLY, (num_results + 1) * 4, bank);
-    result_stats = std::make_shared<AlveoBuffer>(
-        context, CL_MEM_WRITE_ONLY, 20, bank);
+    // Create the sets of buffers for the results.
+    if (pipeline_depth < 1) {
+        throw std::runtime_error("pipeline depth must be at least 1");
+    }
+    for (unsigned int i = 0; i < pipeline_depth; i++) {
+        auto set = std::make_shared<HardwareWordMatchResultBuffers>();
+        set->title_offset = std::make_shared<AlveoBuffer>(
+            context, CL_MEM_WRITE_ONLY, (num_results + 1) * 4, bank);
+        set->title_values = std::make_shared<AlveoBuffer>(
+            context, CL_MEM_WRITE_ONLY, (num_results + 1) * 256, bank);
+        set->matches = std::make_shared<AlveoBuffer>(
+            context, CL_MEM_WRITE_ONLY, (num_results + 1) * 4, bank);
+        set->stats = std::make_shared<AlveoBuffer>(
+            context, CL_MEM_WRITE_ONLY, 20, bank);
+        set->matches_data.resize(num_results);
+        set->title_offset_data.resize(num_results + 1);
+        set->chunk = 0xFFFFFFFF;
+        result_sets.push_back(set);
+    }
+    current_result_set = 0xFFFFFFFF;
 
     // Set the kernel arguments that don't ever change. XRT prints inane
     // warnings about some kernels not being connected to some banks when
     // setting the parameters, which we suppress with the StdoutSuppressor.
     {
         StdoutSuppressor x;
-        context.set_arg(4, (unsigned int)0);
-        context.set_arg(5+num_sub, result_title_offset->buffer);
-        context.set_arg(6+num_sub, result_title_values->buffer);
-        context.set_arg(7+num_sub, result_matches->buffer);
         context.set_arg(8+num_sub, (unsigned int)num_results);
-        context.set_arg(9+num_sub, result_stats->buffer);
     }
 
     // Reset the dataset.
@@ -128,7 +172,23 @@ unsigned int HardwareWordMatchKernel::add_chunk(const std::shared_ptr<arrow::Rec
     chunk.title_values = arrow_to_alveo(context, bank, batch->column_data(0)->buffers[2]);
     chunk.text_offset = arrow_to_alveo(context, bank, batch->column_data(1)->buffers[1]);
     chunk.text_values = arrow_to_alveo(context, bank, batch->column_data(1)->buffers[2]);
+    chunk.arrow_text_offsets = batch->column_data(1)->buffers[1];
+    chunk.arrow_text_values = batch->column_data(1)->buffers[2];
     chunk.num_rows = batch->num_rows();
+
+    // The throughput of a sub-kernel is bound by its decompressor, so give
+    // each sub-kernel about the same number of compressed bytes rather than
+    // the same number of articles.
+    const int32_t *text_offsets = (const int32_t*)chunk.arrow_text_offsets->data();
+    chunk.subkernel_rows = split_rows(text_offsets, 0, chunk.num_rows, num_sub);
+    uint64_t total_bytes = text_offsets[chunk.num_rows] - text_offsets[0];
+    uint64_t max_bytes = 0;
+    for (unsigned int i = 0; i < num_sub; i++) {
+        uint64_t bytes = text_offsets[chunk.subkernel_rows[i + 1]] - text_offsets[chunk.subkernel_rows[i]];
+        max_bytes = std::max(max_bytes, bytes);
+    }
+    chunk.subkernel_imbalance = total_bytes ? (float)((double)max_bytes * num_sub / total_bytes) : 1.0f;
+
     chunks.push_back(chunk);
 
     return chunks.size() - 1;
@@ -155,10 +215,16 @@ void HardwareWordMatchKernel::configure(const HardwareWordMatchConfig &config) {
 }
 
 /**
- * Runs this instance on a previously loaded chunk using the current
- * configuration.
+ * Starts running this instance on the given articles of a previously loaded
+ * chunk, with the given first article for each sub-kernel followed by the
+ * end of the range.
  */
-cl_event HardwareWordMatchKernel::enqueue_for_chunk_(unsigned int chunk) {
+void HardwareWordMatchKernel::enqueue_rows(unsigned int chunk, const std::vector<unsigned int> &rows) {
+    unsigned int set_index = chunk % result_sets.size();
+    auto &set = *result_sets[set_index];
+    if (set.chunk != 0xFFFFFFFF) {
+        throw std::runtime_error("results for previous chunk were not collected");
+    }
 
     if (chunk != current_chunk) {
 
@@ -167,64 +233,118 @@ cl_event HardwareWordMatchKernel::enqueue_for_chunk_(unsigned int chunk) {
         context.set_arg(1, chunks[chunk].title_values->buffer);
         context.set_arg(2, chunks[chunk].text_offset->buffer);
         context.set_arg(3, chunks[chunk].text_values->buffer);
-        for (unsigned int i = 1; i <= num_sub; i++) {
-            context.set_arg(4+i, (unsigned int)(chunks[chunk].num_rows * i) / num_sub);
-        }
 
         // Remember which chunk we're configured for.
         current_chunk = chunk;
 
     }
 
+    if (rows != current_rows) {
+
+        // Configure the article ranges of the sub-kernels.
+        for (unsigned int i = 0; i <= num_sub; i++) {
+            context.set_arg(4+i, rows[i]);
+        }
+
+        // Remember which ranges we're configured for.
+        current_rows = rows;
+
+    }
+
+    if (set_index != current_result_set) {
+
+        // Configure the result buffer kernel arguments.
+        context.set_arg(5+num_sub, set.title_offset->buffer);
+        context.set_arg(6+num_sub, set.title_values->buffer);
+        context.set_arg(7+num_sub, set.matches->buffer);
+        context.set_arg(9+num_sub, set.stats->buffer);
+
+        // Remember which result buffers we're configured for.
+        current_result_set = set_index;
+
+    }
+
     // Enqueue the kernel.
     cl_event event;
     cl_int err = clEnqueueTask(context.queue, context.kernel, 0, NULL, &event);
     if (err != CL_SUCCESS) {
         throw std::runtime_error("clEnqueueTask() failed");
     }
-    return event;
+    set.events.add(event, WORD_MATCH_TRACE_KERNEL);
+    set.chunk = chunk;
+    set.enqueued = std::chrono::high_resolution_clock::now();
+
+    // Enqueue the readback of the statistics, match counts and title
+    // offsets once the kernel completes. These all have a fixed size; the
+    // title values can only be read once their size is known.
+    set.stats->read_async(set.stats_data, 0, sizeof(set.stats_data), event, set.events,
+        WORD_MATCH_TRACE_READBACK);
+    set.matches->read_async(set.matches_data.data(), 0, num_results * 4, event, set.events,
+        WORD_MATCH_TRACE_READBACK);
+    set.title_offset->read_async(set.title_offset_data.data(), 0, (num_results + 1) * 4, event, set.events,
+        WORD_MATCH_TRACE_READBACK);
+
 }
 
 /**
- * Runs this instance on a previously loaded chunk using the current
- * configuration. Returns the event object for the chunk to be waited
- * on.
+ * Starts running this instance on a previously loaded chunk using the
+ * current configuration, followed by the asynchronous readback of the
+ * statistics. The results must be collected with `collect_chunk()` before
+ * the next `get_pipeline_depth()`th chunk is enqueued.
  */
-std::shared_ptr<AlveoEvents> HardwareWordMatchKernel::enqueue_for_chunk(unsigned int chunk) {
-    return std::make_shared<AlveoEvents>(enqueue_for_chunk_(chunk));
+void HardwareWordMatchKernel::enqueue_chunk(unsigned int chunk) {
+    enqueue_rows(chunk, chunks[chunk].subkernel_rows);
 }
 
 /**
- * Runs this instance on a previously loaded chunk using the current
- * configuration. Adds the event to an existing Alveo event object,
+ * Like `enqueue_chunk()`, but only runs for the articles from `first_row`
+ * up to `last_row` of the chunk.
  */
-void HardwareWordMatchKernel::enqueue_for_chunk(unsigned int chunk, AlveoEvents &events) {
-    events.add(enqueue_for_chunk_(chunk));
+void HardwareWordMatchKernel::enqueue_chunk(unsigned int chunk, unsigned int first_row, unsigned int last_row) {
+    if (first_row > last_row || last_row > chunks[chunk].num_rows) {
+        throw std::runtime_error("article range out of range of chunk");
+    }
+    const int32_t *text_offsets = (const int32_t*)chunks[chunk].arrow_text_offsets->data();
+    enqueue_rows(chunk, split_rows(text_offsets, first_row, last_row, num_sub));
 }
 
 /**
- * Loads the results for the most recent run into the given result buffer.
+ * Waits for the run for the given chunk previously started with
+ * `enqueue_chunk()` to complete, and loads its results (including
+ * execution time and, when profiling, its breakdown) into the given
+ * results buffer.
  */
-void HardwareWordMatchKernel::get_results(WordMatchPartialResultsContainer &results) {
+void HardwareWordMatchKernel::collect_chunk(unsigned int chunk, WordMatchPartialResultsContainer &results) {
+    auto &set = *result_sets[chunk % result_sets.size()];
+    if (set.chunk != chunk) {
+        throw std::runtime_error("results for chunk are not pending");
+    }
+    results.data_size = get_data_size(chunk);
+    results.clock_frequency = clock0;
+    results.subkernel_imbalance = chunks[chunk].subkernel_imbalance;
 
-    // Read the statistics buffer.
-    unsigned int data[5];
-    result_stats->read(&data, 0, sizeof(data));
+    // Wait for the kernel and the readback. The result buffers can be reused
+    // after this, even if the run failed. When profiling, the profiling
+    // information of the commands is gathered as well.
+    std::vector<AlveoEventProfile> profiles;
+    auto *profiles_ptr = context.profiling ? &profiles : nullptr;
+    set.chunk = 0xFFFFFFFF;
+    set.events.wait(profiles_ptr);
 
     // Interpret the statistics buffer.
-    results.num_page_matches = data[0];
-    results.num_word_matches = data[1];
-    results.max_word_matches = data[2];
-    unsigned int max_page_idx = data[3];
-    results.cycle_count = data[4];
+    results.num_page_matches = set.stats_data[0];
+    results.num_word_matches = set.stats_data[1];
+    results.max_word_matches = set.stats_data[2];
+    unsigned int max_page_idx = set.stats_data[3];
+    results.cycle_count = set.stats_data[4];
 
     // Find the title of the page with the most matches.
-    auto &chunk = chunks[current_chunk];
-    if (max_page_idx < chunk.num_rows) {
-        const uint32_t *offsets = (const uint32_t*)chunk.arrow_title_offsets->data();
+    auto &data = chunks[chunk];
+    if (max_page_idx < data.num_rows) {
+        const uint32_t *offsets = (const uint32_t*)data.arrow_title_offsets->data();
         uint32_t start = offsets[max_page_idx];
         uint32_t end = offsets[max_page_idx + 1];
-        results.cpp_max_page_title = std::string((const char*)chunk.arrow_title_values->data() + start, end - start);
+        results.cpp_max_page_title = std::string((const char*)data.arrow_title_values->data() + start, end - start);
     } else {
         results.cpp_max_page_title = "<OUT-OF-RANGE>";
     }
@@ -234,27 +354,131 @@ void HardwareWordMatchKernel::get_results(WordMatchPartialResultsContainer &resu
     unsigned int result_count = results.num_page_matches;
     if (result_count > num_results) result_count = num_results;
 
-    // Read match count per page buffer.
-    results.cpp_page_match_counts.resize(result_count);
-    result_matches->read(
-        results.cpp_page_match_counts.data(),
-        0, result_count * 4);
-
-    // Read title offset buffer.
-    results.cpp_page_match_title_offsets.resize(result_count + 1);
-    result_title_offset->read(
-        results.cpp_page_match_title_offsets.data(),
-        0, (result_count + 1) * 4);
+    // Copy the match count per page and the title offsets.
+    results.cpp_page_match_counts.assign(
+        set.matches_data.begin(), set.matches_data.begin() + result_count);
+    results.cpp_page_match_title_offsets.assign(
+        set.title_offset_data.begin(), set.title_offset_data.begin() + result_count + 1);
 
     // Read title values buffer.
     results.cpp_page_match_title_values.resize(results.cpp_page_match_title_offsets.back());
-    result_title_values->read(
-        &results.cpp_page_match_title_values.front(),
-        0, results.cpp_page_match_title_offsets.back());
+    if (!results.cpp_page_match_title_values.empty()) {
+        set.title_values->read_async(
+            &results.cpp_page_match_title_values.front(),
+            0, results.cpp_page_match_title_offsets.back(), NULL, set.events,
+            WORD_MATCH_TRACE_READBACK);
+        set.events.wait(profiles_ptr);
+    }
+
+    // Break the time down using the profiling information. The chunk and
+    // instance of the trace events are filled in by the caller.
+    results.cpp_trace_events.clear();
+    cl_ulong queue_ns = 0, submit_ns = 0, kernel_ns = 0, readback_ns = 0;
+    for (auto &profile : profiles) {
+        if (profile.tag == WORD_MATCH_TRACE_KERNEL) {
+            queue_ns += profile.submit - profile.queued;
+            submit_ns += profile.start - profile.submit;
+            kernel_ns += profile.end - profile.start;
+        } else {
+            readback_ns += profile.end - profile.start;
+        }
+        WordMatchTraceEvent event;
+        event.type = profile.tag;
+        event.chunk = 0;
+        event.instance = 0;
+        event.queued = profile.queued;
+        event.submit = profile.submit;
+        event.start = profile.start;
+        event.end = profile.end;
+        results.cpp_trace_events.push_back(event);
+    }
+    results.queue_time = queue_ns / 1000;
+    results.submit_time = submit_ns / 1000;
+    results.kernel_time = kernel_ns / 1000;
+    results.readback_time = readback_ns / 1000;
 
     // Synchronize the results buffer.
     results.synchronize();
 
+    // Attribute the time since the previous chunk was collected or since
+    // this chunk was enqueued, whichever is later, to this chunk. This
+    // excludes the time spent waiting for the previous chunk while pipelining.
+    auto now = std::chrono::high_resolution_clock::now();
+    auto start = std::max(set.enqueued, last_collected);
+    results.time_taken = std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+    last_collected = now;
+}
+
+/**
+ * Re-runs a chunk with more matching pages than there are result records
+ * over smaller ranges of articles, until records have been returned for all
+ * matching pages, and replaces the records in the given results with them.
+ * The results must have been collected for the whole chunk with the current
+ * configuration. The cycle counts and execution times of the re-runs are
+ * added to those of the results.
+ */
+void HardwareWordMatchKernel::complete_chunk(unsigned int chunk, WordMatchPartialResultsContainer &results) {
+    if (results.num_page_matches <= num_results) {
+        return;
+    }
+    auto &data = chunks[chunk];
+    const int32_t *text_offsets = (const int32_t*)data.arrow_text_offsets->data();
+
+    // Ranges that remain to be run, with the next range at the back.
+    std::vector<std::pair<unsigned int, unsigned int>> ranges;
+
+    // Splits the given range into parts that are expected to fit in the
+    // result buffers, based on the number of matching pages observed for it,
+    // with some margin. Matches are assumed to be spread evenly over the
+    // compressed bytes.
+    auto split = [&](unsigned int first, unsigned int last, unsigned int matches) {
+        uint64_t parts = ((uint64_t)matches * 5 / 4 + num_results - 1) / num_results;
+        parts = std::max<uint64_t>(2, std::min<uint64_t>(parts, last - first));
+        auto rows = split_rows(text_offsets, first, last, parts);
+        for (unsigned int i = parts; i-- > 0;) {
+            if (rows[i] < rows[i + 1]) {
+                ranges.emplace_back(rows[i], rows[i + 1]);
+            }
+        }
+    };
+    split(0, data.num_rows, results.num_page_matches);
+
+    // Run the ranges in article order, splitting ranges that still overflow
+    // further.
+    results.cpp_page_match_counts.clear();
+    results.cpp_page_match_title_offsets.assign(1, 0);
+    results.cpp_page_match_title_values.clear();
+    WordMatchPartialResultsContainer range_results;
+    while (!ranges.empty()) {
+        auto range = ranges.back();
+        ranges.pop_back();
+        enqueue_chunk(chunk, range.first, range.second);
+        collect_chunk(chunk, range_results);
+        results.cycle_count += range_results.cycle_count;
+        results.time_taken += range_results.time_taken;
+        results.queue_time += range_results.queue_time;
+        results.submit_time += range_results.submit_time;
+        results.kernel_time += range_results.kernel_time;
+        results.readback_time += range_results.readback_time;
+        results.cpp_trace_events.insert(results.cpp_trace_events.end(),
+            range_results.cpp_trace_events.begin(), range_results.cpp_trace_events.end());
+        if (range_results.num_page_matches > num_results) {
+            split(range.first, range.second, range_results.num_page_matches);
+            continue;
+        }
+        uint32_t base = results.cpp_page_match_title_values.size();
+        results.cpp_page_match_counts.insert(results.cpp_page_match_counts.end(),
+            range_results.cpp_page_match_counts.begin(), range_results.cpp_page_match_counts.end());
+        for (size_t i = 1; i < range_results.cpp_page_match_title_offsets.size(); i++) {
+            results.cpp_page_match_title_offsets.push_back(base + range_results.cpp_page_match_title_offsets[i]);
+        }
+        results.cpp_page_match_title_values += range_results.cpp_page_match_title_values;
+    }
+    if (results.cpp_page_match_counts.size() != results.num_page_matches) {
+        throw std::runtime_error("re-running chunk over smaller ranges returned inconsistent results");
+    }
+
+    results.synchronize();
 }
 
 /**
@@ -262,34 +486,50 @@ void HardwareWordMatchKernel::get_results(WordMatchPartialResultsContainer &resu
  * results (including execution time) to the given results buffer.
  */
 void HardwareWordMatchKernel::execute_chunk(unsigned int chunk, WordMatchPartialResultsContainer &results) {
-    auto start = std::chrono::high_resolution_clock::now();
-    results.data_size = (unsigned long long)chunks[chunk].text_offset->get_size()
-                      + (unsigned long long)chunks[chunk].text_values->get_size();
-    results.clock_frequency = clock0;
-    enqueue_for_chunk(chunk)->wait();
-    get_results(results);
-    auto elapsed = std::chrono::high_resolution_clock::now() - start;
-    results.time_taken = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    enqueue_chunk(chunk);
+    collect_chunk(chunk, results);
 }
 
 /**
  * Constructs the word matcher from an xclbin prefix excluding the
  * `.[device].xclbin` suffix (this is chosen automatically), and the name
- * of the kernel in the xclbin file.
+ * of the kernel in the xclbin file. All cards that there is an xclbin
+ * file for are used, and the chunks are sharded across the kernel
+ * instances of all of them. If `profiling` is set, the command queues are
+ * created with OpenCL profiling enabled, and the results include a
+ * breakdown of the time taken and a trace of the commands.
  */
 HardwareWordMatch::HardwareWordMatch(
     const std::string &bin_prefix,
     const std::string &kernel_name,
     unsigned int num_subkernels,
-    bool quiet
+    bool quiet,
+    bool profiling
 ) :
-    context(bin_prefix, kernel_name, quiet)
+    contexts(AlveoContext::open_all(bin_prefix, kernel_name, quiet, profiling)),
+    num_batches(0)
 {
 
-    // Construct HardwareWordMatchKernel objects for each subdevice.
-    for (auto instance : context.instances) {
-        kernels.push_back(std::make_shared<HardwareWordMatchKernel>(
-            *instance, context.clock0, context.clock1, num_subkernels));
+    // Construct HardwareWordMatchKernel objects for each subdevice of each
+    // card. The instances of the cards are interleaved, such that the chunk
+    // placement spreads the chunks over the cards when there are fewer
+    // chunks than instances.
+    size_t max_instances = 0;
+    for (auto &context : contexts) {
+        max_instances = std::max(max_instances, context->instances.size());
+    }
+    for (size_t i = 0; i < max_instances; i++) {
+        for (unsigned int card = 0; card < contexts.size(); card++) {
+            auto &context = *contexts[card];
+            if (i < context.instances.size()) {
+                kernels.push_back(std::make_shared<HardwareWordMatchKernel>(
+                    *context.instances[i], context.clock0, context.clock1, num_subkernels));
+                kernel_cards.push_back(card);
+            }
+        }
+    }
+    if (!quiet && contexts.size() > 1) {
+        printf("Using %zu kernel instances on %zu cards.\n\n", kernels.size(), contexts.size());
     }
 
 }
@@ -301,7 +541,8 @@ void HardwareWordMatch::clear_chunks() {
     for (auto kernel : kernels) {
         kernel->clear_chunks();
     }
-    round_robin_state = 0;
+    pending_batches.clear();
+    placement = nullptr;
     num_batches = 0;
 }
 
@@ -309,12 +550,225 @@ void HardwareWordMatch::clear_chunks() {
  * Adds the given chunk to the dataset stored in device memory.
  */
 void HardwareWordMatch::add_chunk(const std::shared_ptr<arrow::RecordBatch> &batch) {
-    round_robin_state %= kernels.size();
-    kernels[round_robin_state]->add_chunk(batch);
-    round_robin_state++;
+
+    // The chunks are only placed once all of them are known, in
+    // finish_chunks().
+    pending_batches.push_back(batch);
     num_batches++;
 }
 
+/**
+ * Places the added chunks on the kernel instances and uploads them to
+ * device memory. This is also done before running the kernel if there
+ * are any chunks that have not been placed yet.
+ */
+void HardwareWordMatch::finish_chunks(void (*progress)(void *user, const char *status), void *progress_user) {
+    if (pending_batches.empty()) {
+        return;
+    }
+
+    // The batches of chunks that were already placed are no longer around,
+    // so they cannot be placed again together with the new ones.
+    if (placement) {
+        throw std::runtime_error("chunks cannot be added after the dataset has been placed");
+    }
+
+    // Determine the work and the device memory for each chunk. The work is
+    // modeled by the number of compressed text bytes, as the kernel is bound
+    // by the decompressor.
+    std::vector<uint64_t> bytes;
+    std::vector<uint64_t> memory;
+    for (auto &batch : pending_batches) {
+        bytes.push_back(batch->column_data(1)->buffers[2]->size());
+        uint64_t size = 0;
+        for (int col = 0; col < 2; col++) {
+            size += batch->column_data(col)->buffers[1]->size();
+            size += batch->column_data(col)->buffers[2]->size();
+        }
+        memory.push_back(size);
+    }
+
+    // Plan the placement. The banks of the cards are numbered
+    // consecutively, as each card has its own memory.
+    std::vector<int> banks;
+    for (unsigned int i = 0; i < kernels.size(); i++) {
+        banks.push_back(kernel_cards[i] * BANK_COUNT + kernels[i]->get_bank());
+    }
+    std::vector<uint64_t> capacities(BANK_COUNT * contexts.size(), BANK_CAPACITY);
+    placement = std::make_shared<ChunkPlacement>(banks, capacities);
+    placement->plan(bytes, memory);
+
+    // Group the chunks by the bank that they are uploaded to, in dataset
+    // order for each instance.
+    std::map<int, std::vector<std::pair<unsigned int, unsigned int>>> bank_uploads;
+    for (unsigned int i = 0; i < kernels.size(); i++) {
+        for (unsigned int chunk : placement->instance_chunks[i]) {
+            bank_uploads[banks[i]].push_back(std::make_pair(i, chunk));
+        }
+    }
+    std::vector<std::vector<std::pair<unsigned int, unsigned int>>> uploads;
+    for (auto &bank : bank_uploads) {
+        uploads.push_back(std::move(bank.second));
+    }
+
+    // Upload the chunks, using a thread for each bank, so the migrations to
+    // different banks overlap with each other. Each thread also asks for the
+    // next chunk to be read from disk while the current one is migrated, so
+    // at most two chunks per bank are in flight at any time.
+    unsigned int chunks_uploaded = 0;
+    std::exception_ptr error;
+    static std::mutex progress_mutex;
+    if (progress) {
+        std::string msg = "Uploading chunks to hardware... 0/" + std::to_string(num_batches);
+        progress(progress_user, msg.c_str());
+    }
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(uploads.size())
+    for (unsigned int b = 0; b < uploads.size(); b++) {
+        for (unsigned int u = 0; u < uploads[b].size(); u++) {
+            if (u + 1 < uploads[b].size()) {
+                auto &next = pending_batches[uploads[b][u + 1].second];
+                for (int col = 0; col < 2; col++) {
+                    for (int buf = 1; buf <= 2; buf++) {
+                        auto buffer = next->column_data(col)->buffers[buf];
+                        prefetch_pages(buffer->data(), buffer->size());
+                    }
+                }
+            }
+            try {
+                kernels[uploads[b][u].first]->add_chunk(pending_batches[uploads[b][u].second]);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                break;
+            }
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            chunks_uploaded++;
+            if (progress) {
+                std::string msg = "Uploading chunks to hardware... " + std::to_string(chunks_uploaded)
+                    + "/" + std::to_string(num_batches);
+                progress(progress_user, msg.c_str());
+            }
+        }
+    }
+    if (error) {
+        for (auto kernel : kernels) {
+            kernel->clear_chunks();
+        }
+        placement = nullptr;
+        std::rethrow_exception(error);
+    }
+    pending_batches.clear();
+    if (progress) {
+        progress(progress_user, "Uploading chunks to hardware... done");
+    }
+}
+
+/**
+ * Sets the chunk and kernel instance of the profiling trace events of the
+ * given partial results.
+ */
+void HardwareWordMatch::set_trace_origin(
+    WordMatchPartialResultsContainer &presults, unsigned int batch, unsigned int instance
+) {
+    for (auto &event : presults.cpp_trace_events) {
+        event.chunk = batch;
+        event.instance = instance;
+    }
+}
+
+/**
+ * Re-runs the chunks for which not all matching pages were recorded as
+ * requested by the `complete_results` field of the given configuration,
+ * after the results of all chunks have been collected and ranked. If
+ * `control` is not null, the re-runs are added to its chunk counters, and
+ * no more re-runs are started once the query is cancelled.
+ */
+void HardwareWordMatch::complete_chunks(
+    const WordMatchConfig &config,
+    void (*progress)(void *user, const char *status), void *progress_user,
+    WordMatchControl *control
+) {
+    if (config.complete_results < 1) {
+        return;
+    }
+
+    // Unless all pages are requested, only chunks that may contain an
+    // unrecorded page that belongs in the top-K ranking need to be re-run.
+    // Such a page would have at least as many matches as the lowest ranked
+    // page so far, and at most as many as the page with the most matches in
+    // the chunk.
+    unsigned int threshold = 0;
+    if (config.complete_results < 2) {
+        if (!config.top_k) {
+            return;
+        }
+        std::vector<unsigned int> counts;
+        for (auto &presults : results.cpp_partial_results) {
+            for (auto &page : presults.cpp_top_pages) {
+                counts.push_back(page.count);
+            }
+        }
+        if (counts.size() >= config.top_k) {
+            std::nth_element(counts.begin(), counts.begin() + config.top_k - 1, counts.end(),
+                std::greater<unsigned int>());
+            threshold = counts[config.top_k - 1];
+        }
+    }
+
+    // Determine which chunks to re-run on each instance.
+    std::vector<std::vector<unsigned int>> reruns(kernels.size());
+    unsigned int num_reruns = 0;
+    for (unsigned int i = 0; i < kernels.size(); i++) {
+        for (unsigned int j = 0; j < placement->instance_chunks[i].size(); j++) {
+            auto &presults = results.cpp_partial_results[placement->instance_chunks[i][j]];
+            if (presults.num_page_match_records < presults.num_page_matches
+                && presults.max_word_matches >= threshold)
+            {
+                reruns[i].push_back(j);
+                num_reruns++;
+            }
+        }
+    }
+    if (!num_reruns) {
+        return;
+    }
+
+    // Re-run them, using the instances in parallel.
+    if (control) {
+        control->chunks_total += num_reruns;
+    }
+    unsigned int reruns_complete = 0;
+    static std::mutex progress_mutex;
+    if (progress) {
+        std::string msg = "Completing results on hardware... completed 0/" + std::to_string(num_reruns);
+        progress(progress_user, msg.c_str());
+    }
+    #pragma omp parallel for
+    for (unsigned int i = 0; i < kernels.size(); i++) {
+        for (unsigned int j : reruns[i]) {
+            if (control && control->cancelled) {
+                break;
+            }
+            unsigned int batch = placement->instance_chunks[i][j];
+            auto &presults = results.cpp_partial_results[batch];
+            kernels[i]->complete_chunk(j, presults);
+            set_trace_origin(presults, batch, i);
+            presults.rank_records(config.top_k, (uint64_t)batch << 32);
+            if (control) {
+                control->chunks_done++;
+            }
+            if (progress) {
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                reruns_complete++;
+                std::string msg = "Completing results on hardware... completed " + std::to_string(reruns_complete) + "/" + std::to_string(num_reruns);
+                progress(progress_user, msg.c_str());
+            }
+        }
+    }
+}
+
 /**
  * Runs the kernel with the given configuration.
  */
@@ -322,6 +776,33 @@ void HardwareWordMatch::execute(
     const WordMatchConfig &config,
     void (*progress)(void *user, const char *status), void *progress_user
 ) {
+    execute(config, progress, progress_user, nullptr);
+}
+
+/**
+ * Runs the kernel with the given configuration. If `control` is not null,
+ * it receives the progress of the run, and when the query is cancelled, the
+ * chunks that have not been started yet are skipped and a
+ * `WordMatchCancelled` is thrown once the running ones have completed.
+ */
+void HardwareWordMatch::execute(
+    const WordMatchConfig &config,
+    void (*progress)(void *user, const char *status), void *progress_user,
+    WordMatchControl *control
+) {
+
+    // Place any chunks that were added since the last placement.
+    finish_chunks(progress, progress_user);
+    if (control) {
+        unsigned long long bytes = 0;
+        for (unsigned int i = 0; i < kernels.size(); i++) {
+            for (unsigned int j = 0; j < kernels[i]->size(); j++) {
+                bytes += kernels[i]->get_data_size(j);
+            }
+        }
+        control->start(num_batches, bytes);
+        control->check();
+    }
 
     if (progress) {
         std::string msg = "Running on hardware... completed 0/" + std::to_string(num_batches);
@@ -341,12 +822,42 @@ void HardwareWordMatch::execute(
     omp_set_dynamic(0);
     omp_set_num_threads(kernels.size());
     unsigned int chunks_complete = 0;
+    auto first_start = start;
     static std::mutex progress_mutex;
     #pragma omp parallel for
     for (unsigned int i = 0; i < kernels.size(); i++) {
         kernels[i]->configure(hw_config);
-        for (unsigned int j = 0; j < kernels[i]->size(); j++) {
-            kernels[i]->execute_chunk(j, this->results.cpp_partial_results[j * kernels.size() + i]);
+        {
+            // Record when the first kernel is started.
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            auto now = std::chrono::high_resolution_clock::now();
+            if (first_start == start || now < first_start) {
+                first_start = now;
+            }
+        }
+
+        // Keep as many chunks in flight as there are result buffer sets, so
+        // the kernel can run for the next chunks while the results of a
+        // chunk are read back. Once the query is cancelled, no more chunks
+        // are enqueued, but the ones in flight are still collected, as they
+        // hold on to the result buffers.
+        unsigned int num_chunks = kernels[i]->size();
+        unsigned int depth = kernels[i]->get_pipeline_depth();
+        unsigned int next_chunk = 0;
+        for (unsigned int j = 0; j < num_chunks; j++) {
+            while (next_chunk < num_chunks && next_chunk < j + depth && !(control && control->cancelled)) {
+                kernels[i]->enqueue_chunk(next_chunk++);
+            }
+            if (j >= next_chunk) {
+                break;
+            }
+            unsigned int batch = placement->instance_chunks[i][j];
+            kernels[i]->collect_chunk(j, this->results.cpp_partial_results[batch]);
+            set_trace_origin(this->results.cpp_partial_results[batch], batch, i);
+            if (control) {
+                control->chunks_done++;
+                control->bytes_scanned += this->results.cpp_partial_results[batch].data_size;
+            }
             if (progress) {
                 std::lock_guard<std::mutex> lock(progress_mutex);
                 chunks_complete++;
@@ -356,9 +867,40 @@ void HardwareWordMatch::execute(
         }
     }
 
+    if (control) {
+        control->check();
+    }
+
+    // The kernels only return records for the first matching pages of each
+    // chunk, so rank those.
+    results.cpp_top_k = config.top_k;
+    for (unsigned int i = 0; i < results.cpp_partial_results.size(); i++) {
+        results.cpp_partial_results[i].rank_records(config.top_k, (uint64_t)i << 32);
+    }
+
+    // Re-run chunks for which not all matching pages were recorded, if
+    // requested.
+    complete_chunks(config, progress, progress_user, control);
+    if (control) {
+        control->check();
+    }
+
     // Finish measuring execution time.
     auto elapsed = std::chrono::high_resolution_clock::now() - start;
     results.time_taken = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    results.startup_time = std::chrono::duration_cast<std::chrono::microseconds>(first_start - start).count();
+    results.scan_fraction = 1.0f;
+
+    // The ranking is exact if all matching pages were recorded, or if the
+    // chunks that could affect it were re-run.
+    results.top_pages_exact = true;
+    if (config.complete_results < 1 || !config.top_k) {
+        for (auto &presults : results.cpp_partial_results) {
+            if (presults.num_page_match_records < presults.num_page_matches) {
+                results.top_pages_exact = false;
+            }
+        }
+    }
     if (progress) {
         std::string msg = "Running on hardware... done";
         progress(progress_user, msg.c_str());
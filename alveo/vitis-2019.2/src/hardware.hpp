@@ -2,10 +2,12 @@
 
 #include "alveo.hpp"
 #include "word_match.hpp"
+#include "placement.hpp"
 #include "xcl2.hpp"
 #include <inttypes.h>
 #include <string>
 #include <memory>
+#include <chrono>
 #include <arrow/api.h>
 
 /**
@@ -24,13 +26,52 @@ public:
  */
 class HardwareWordMatchDataChunk {
 public:
+
+    // The Arrow buffers, which must outlive the device buffers, as those may
+    // use their memory as host pointer.
     std::shared_ptr<arrow::Buffer> arrow_title_offsets;
     std::shared_ptr<arrow::Buffer> arrow_title_values;
+    std::shared_ptr<arrow::Buffer> arrow_text_offsets;
+    std::shared_ptr<arrow::Buffer> arrow_text_values;
+
     std::shared_ptr<AlveoBuffer> title_offset;
     std::shared_ptr<AlveoBuffer> title_values;
     std::shared_ptr<AlveoBuffer> text_offset;
     std::shared_ptr<AlveoBuffer> text_values;
     unsigned int num_rows;
+
+    // First article of each sub-kernel, followed by the number of articles,
+    // chosen such that each sub-kernel gets about the same number of
+    // compressed bytes, and the resulting load imbalance.
+    std::vector<unsigned int> subkernel_rows;
+    float subkernel_imbalance;
+};
+
+/**
+ * Class used internally by HardwareWordMatchKernel to keep track of a set of
+ * result buffers. Each kernel instance has multiple sets, such that the
+ * kernel can run for the next chunk while the results of the previous chunk
+ * are still being read back.
+ */
+class HardwareWordMatchResultBuffers {
+public:
+    std::shared_ptr<AlveoBuffer> title_offset;
+    std::shared_ptr<AlveoBuffer> title_values;
+    std::shared_ptr<AlveoBuffer> matches;
+    std::shared_ptr<AlveoBuffer> stats;
+
+    // Host copies of the statistics, match counts and title offsets, which
+    // are read back asynchronously when the kernel completes.
+    unsigned int stats_data[5];
+    std::vector<unsigned int> matches_data;
+    std::vector<unsigned int> title_offset_data;
+
+    // The chunk that the kernel was enqueued for with these buffers and
+    // when, or 0xFFFFFFFF if the buffers are free. The events are those for
+    // the run and the asynchronous readback.
+    unsigned int chunk;
+    std::chrono::high_resolution_clock::time_point enqueued;
+    AlveoEvents events;
 };
 
 /**
@@ -53,15 +94,37 @@ private:
     std::vector<HardwareWordMatchDataChunk> chunks;
     unsigned int current_chunk;
 
-    // Result buffers.
-    std::shared_ptr<AlveoBuffer> result_title_offset;
-    std::shared_ptr<AlveoBuffer> result_title_values;
-    std::shared_ptr<AlveoBuffer> result_matches;
-    std::shared_ptr<AlveoBuffer> result_stats;
+    // First article of each sub-kernel and the end of the range that the
+    // kernel arguments are currently configured for.
+    std::vector<unsigned int> current_rows;
+
+    // Result buffer sets, used round-robin for consecutive chunks, and the
+    // set the kernel arguments are currently configured for.
+    std::vector<std::shared_ptr<HardwareWordMatchResultBuffers>> result_sets;
+    unsigned int current_result_set;
+
+    // Time at which the results for the previous chunk were collected, used
+    // to attribute execution time to the chunks.
+    std::chrono::high_resolution_clock::time_point last_collected;
 
     std::shared_ptr<AlveoBuffer> arrow_to_alveo(
         AlveoKernelInstance &context, int bank, const std::shared_ptr<arrow::Buffer> &buffer);
 
+    /**
+     * Splits the articles from `first` up to `last` into `parts` ranges with
+     * about the same number of compressed bytes, using the given text offsets.
+     * Returns the first article of each range, followed by `last`.
+     */
+    static std::vector<unsigned int> split_rows(
+        const int32_t *text_offsets, unsigned int first, unsigned int last, unsigned int parts);
+
+    /**
+     * Starts running this instance on the given articles of a previously loaded
+     * chunk, with the given first article for each sub-kernel followed by the
+     * end of the range.
+     */
+    void enqueue_rows(unsigned int chunk, const std::vector<unsigned int> &rows);
+
 public:
 
     HardwareWordMatchKernel(const HardwareWordMatchKernel&) = delete;
@@ -75,7 +138,8 @@ public:
         AlveoKernelInstance &context,
         float clock0, float clock1,
         unsigned int num_subkernels,
-        int num_results = 256);
+        int num_results = 256,
+        unsigned int pipeline_depth = 2);
 
     /**
      * Loads a recordbatch into the on-device OpenCL buffers for this instance.
@@ -88,38 +152,66 @@ public:
      */
     unsigned int size() const;
 
+    /**
+     * Returns the number of bytes of the given chunk that the kernel reads,
+     * as reported in the `data_size` result.
+     */
+    inline unsigned long long get_data_size(unsigned int chunk) const {
+        return (unsigned long long)chunks.at(chunk).text_offset->get_size()
+             + (unsigned long long)chunks.at(chunk).text_values->get_size();
+    }
+
+    /**
+     * Returns the memory bank this instance is connected to.
+     */
+    inline int get_bank() const {
+        return bank;
+    }
+
     /**
      * Configures this instance with a search pattern and search configuration.
      */
     void configure(const HardwareWordMatchConfig &config);
 
-private:
-
     /**
-     * Runs this instance on a previously loaded chunk using the current
-     * configuration.
+     * Returns the number of chunks that can be in flight at once, i.e. the
+     * number of result buffer sets.
      */
-    cl_event enqueue_for_chunk_(unsigned int chunk);
+    inline unsigned int get_pipeline_depth() const {
+        return result_sets.size();
+    }
 
-public:
+    /**
+     * Starts running this instance on a previously loaded chunk using the
+     * current configuration, followed by the asynchronous readback of the
+     * statistics. The results must be collected with `collect_chunk()` before
+     * the next `get_pipeline_depth()`th chunk is enqueued.
+     */
+    void enqueue_chunk(unsigned int chunk);
 
     /**
-     * Runs this instance on a previously loaded chunk using the current
-     * configuration. Returns the event object for the chunk to be waited
-     * on.
+     * Like `enqueue_chunk()`, but only runs for the articles from `first_row`
+     * up to `last_row` of the chunk.
      */
-    std::shared_ptr<AlveoEvents> enqueue_for_chunk(unsigned int chunk);
+    void enqueue_chunk(unsigned int chunk, unsigned int first_row, unsigned int last_row);
 
     /**
-     * Runs this instance on a previously loaded chunk using the current
-     * configuration. Adds the event to an existing Alveo event object,
+     * Waits for the run for the given chunk previously started with
+     * `enqueue_chunk()` to complete, and loads its results (including
+     * execution time and, when profiling, its breakdown) into the given
+     * results buffer.
      */
-    void enqueue_for_chunk(unsigned int chunk, AlveoEvents &events);
+    void collect_chunk(unsigned int chunk, WordMatchPartialResultsContainer &results);
 
     /**
-     * Loads the results for the most recent run into the given result buffer.
+     * Re-runs a chunk with more matching pages than there are result records
+     * over smaller ranges of articles, until records have been returned for all
+     * matching pages, and replaces the records in the given results with them.
+     * The results must have been collected for the whole chunk with the current
+     * configuration. The cycle counts and execution times of the re-runs are
+     * added to those of the results.
      */
-    void get_results(WordMatchPartialResultsContainer &results);
+    void complete_chunk(unsigned int chunk, WordMatchPartialResultsContainer &results);
 
     /**
      * Synchronously runs the kernel for the given chunk index, writing the
@@ -134,11 +226,40 @@ public:
  */
 class HardwareWordMatch : public WordMatch {
 private:
-    AlveoContext context;
+
+    // Contexts for all cards that there is an xclbin file for.
+    std::vector<std::shared_ptr<AlveoContext>> contexts;
+
+    // Kernel instances of all cards, interleaved such that consecutive
+    // instances are on different cards, and the card each instance is on.
     std::vector<std::shared_ptr<HardwareWordMatchKernel>> kernels;
-    unsigned int round_robin_state;
+    std::vector<unsigned int> kernel_cards;
+
     unsigned int num_batches;
 
+    // Record batches that have been added but not yet placed on the kernel
+    // instances, and the placement of the chunks that have been placed.
+    std::vector<std::shared_ptr<arrow::RecordBatch>> pending_batches;
+    std::shared_ptr<ChunkPlacement> placement;
+
+    /**
+     * Sets the chunk and kernel instance of the profiling trace events of the
+     * given partial results.
+     */
+    static void set_trace_origin(
+        WordMatchPartialResultsContainer &presults, unsigned int batch, unsigned int instance);
+
+    /**
+     * Re-runs the chunks for which not all matching pages were recorded as
+     * requested by the `complete_results` field of the given configuration,
+     * after the results of all chunks have been collected and ranked. If
+     * `control` is not null, the re-runs are added to its chunk counters, and
+     * no more re-runs are started once the query is cancelled.
+     */
+    void complete_chunks(const WordMatchConfig &config,
+        void (*progress)(void *user, const char *status), void *progress_user,
+        WordMatchControl *control);
+
 public:
 
     virtual ~HardwareWordMatch() = default;
@@ -146,19 +267,39 @@ public:
     /**
      * Constructs the word matcher from an xclbin prefix excluding the
      * `.[device].xclbin` suffix (this is chosen automatically), and the name
-     * of the kernel in the xclbin file.
+     * of the kernel in the xclbin file. All cards that there is an xclbin
+     * file for are used, and the chunks are sharded across the kernel
+     * instances of all of them. If `profiling` is set, the command queues are
+     * created with OpenCL profiling enabled, and the results include a
+     * breakdown of the time taken and a trace of the commands.
      */
     HardwareWordMatch(
         const std::string &bin_prefix,
         const std::string &kernel_name,
         unsigned int num_subkernels=3,
-        bool quiet=false);
+        bool quiet=false,
+        bool profiling=false);
+
+    /**
+     * Returns the number of cards used by this hardware implementation.
+     */
+    inline unsigned int get_num_cards() const {
+        return contexts.size();
+    }
+
+    /**
+     * Returns the device index of the given card, as used by `xbutil`.
+     */
+    inline unsigned int get_device_index(unsigned int card = 0) const {
+        return contexts.at(card)->device_index;
+    }
 
     /**
-     * Returns the device index for this hardware implementation.
+     * Returns the card that the given kernel instance (as numbered in the
+     * chunk placement and the partial results) is on.
      */
-    inline unsigned int get_device_index() {
-        return context.device_index;
+    inline unsigned int get_kernel_card(unsigned int instance) const {
+        return kernel_cards.at(instance);
     }
 
     /**
@@ -171,10 +312,35 @@ public:
      */
     virtual void add_chunk(const std::shared_ptr<arrow::RecordBatch> &batch);
 
+    /**
+     * Places the added chunks on the kernel instances and uploads them to
+     * device memory. This is also done before running the kernel if there
+     * are any chunks that have not been placed yet.
+     */
+    virtual void finish_chunks(void (*progress)(void *user, const char *status), void *progress_user);
+
+    /**
+     * Returns the placement of the chunks on the kernel instances, or null
+     * if no chunks have been placed.
+     */
+    inline const ChunkPlacement *get_placement() const {
+        return placement.get();
+    }
+
     /**
      * Runs the kernel with the given configuration.
      */
     virtual void execute(const WordMatchConfig &config,
         void (*progress)(void *user, const char *status), void *progress_user);
 
+    /**
+     * Runs the kernel with the given configuration. If `control` is not null,
+     * it receives the progress of the run, and when the query is cancelled, the
+     * chunks that have not been started yet are skipped and a
+     * `WordMatchCancelled` is thrown once the running ones have completed.
+     */
+    void execute(const WordMatchConfig &config,
+        void (*progress)(void *user, const char *status), void *progress_user,
+        WordMatchControl *control);
+
 };
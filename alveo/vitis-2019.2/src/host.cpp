@@ -39,11 +39,29 @@ int main(int argc, char **argv) {
     platcfg.emu_mode = emu_mode;
     platcfg.kernel_name = kernel_name.c_str();
     platcfg.num_subkernels = 3;
+    platcfg.hw_profiling = getenv("WORD_MATCH_PROFILE") != NULL;
     platcfg.keep_loaded = true;
+    platcfg.sw_streaming = true;
+    platcfg.sw_work_stealing = false;
+    platcfg.sw_trigram_index = getenv("WORD_MATCH_INDEX") != NULL;
+    platcfg.result_cache_size = 64 << 20;
+    platcfg.health_interval_ms = 100;
     printf("word_match_init...\n");
     if (!word_match_init(&platcfg, false, reporter, NULL)) {
         throw std::runtime_error(word_match_last_error());
     }
+    auto index_info = word_match_index_info();
+    if (index_info.enabled) {
+        printf("Trigram index: %u trigrams, %.1f MiB, built in %.3fs\n",
+            index_info.num_trigrams, index_info.size / (1024. * 1024.),
+            index_info.build_time / 1000000.);
+    }
+    auto placement_info = word_match_placement_info();
+    if (placement_info.num_instances) {
+        printf("Chunk placement: %u chunks on %u kernel instances, makespan %.1f MiB, predicted imbalance %.3f\n",
+            placement_info.num_chunks, placement_info.num_instances,
+            placement_info.makespan / (1024. * 1024.), placement_info.imbalance);
+    }
 
     try {
 
@@ -73,6 +91,8 @@ int main(int argc, char **argv) {
                 runcfg.whole_words = false;
             }
             runcfg.min_matches = 1;
+            runcfg.top_k = 10;
+            runcfg.complete_results = 1;
 
             // Run on hardware.
             runcfg.mode = 0;
@@ -85,22 +105,41 @@ int main(int argc, char **argv) {
             // Print results.
             for (unsigned int i = 0; i < results->num_partial_results; i++) {
                 auto p = results->partial_results[i];
-                printf("kernel %u took %u cycles at %.0f MHz for %llu bytes = %.3f GB/s\n",
+                printf("kernel %u took %u cycles at %.0f MHz for %llu bytes = %.3f GB/s (sub-kernel imbalance %.3f)\n",
                     i, p->cycle_count, p->clock_frequency, p->data_size,
-                    (p->data_size / (p->cycle_count / (p->clock_frequency * 1000000.0f))) / (1024.0f * 1024.0f * 1024.0f));
+                    (p->data_size / (p->cycle_count / (p->clock_frequency * 1000000.0f))) / (1024.0f * 1024.0f * 1024.0f),
+                    p->subkernel_imbalance);
+                if (platcfg.hw_profiling) {
+                    printf("  queued %.6fs, submitted %.6fs, kernel %.6fs, readback %.6fs\n",
+                        p->queue_time / 1000000., p->submit_time / 1000000.,
+                        p->kernel_time / 1000000., p->readback_time / 1000000.);
+                }
+            }
+            if (platcfg.hw_profiling && results->num_trace_events) {
+                auto &last = results->trace_events[results->num_trace_events - 1];
+                printf("%u commands traced, last one ended after %.6fs\n",
+                    results->num_trace_events, last.end / 1000000000.);
             }
             printf("\n%u pages matched & %u total matches within %.6fs on hardware\n",
                 results->num_page_matches, results->num_word_matches,
                 results->time_taken / 1000000.);
+            if (results->energy_source != WORD_MATCH_ENERGY_NONE) {
+                printf("Used %.3f J at %.2f W on average\n", results->energy, results->avg_power);
+            }
             if (results->max_word_matches) {
                 printf("Best match is \"%s\", coming in at %u matches\n",
                     results->max_page_title, results->max_word_matches);
             }
 
-            // Print FPGA health (mostly for testing the API).
-            auto health = word_match_health();
-            printf("fpga_temp=%.2f, power_in=%.2f, power_vccint=%.2f\n",
-                health.fpga_temp, health.power_in, health.power_vccint);
+            // Print FPGA health for each card (mostly for testing the API).
+            for (unsigned int card = 0; card < word_match_num_cards(); card++) {
+                auto health = word_match_card_health(card);
+                printf("card %u: fpga_temp=%.2f, power_in=%.2f, power_vccint=%.2f\n",
+                    card, health.fpga_temp, health.power_in, health.power_vccint);
+                auto stats = word_match_health_stats(card, 10000);
+                printf("  last 10s: %u samples, power_in min=%.2f avg=%.2f max=%.2f\n",
+                    stats.num_samples, stats.min.power_in, stats.avg.power_in, stats.max.power_in);
+            }
 
             // Run on software.
             runcfg.mode = -1000;
@@ -111,16 +150,32 @@ int main(int argc, char **argv) {
             }
 
             // Print results.
-            printf("\n%u pages matched & %u total matches within %.6fs on software\n",
+            printf("\n%u pages matched & %u total matches within %.6fs on software (imbalance %.2f)%s\n",
                 results->num_page_matches, results->num_word_matches,
-                results->time_taken / 1000000.);
+                results->time_taken / 1000000., results->imbalance,
+                results->cached ? " (cached)" : "");
+            printf("First article processed after %.6fs, scanned %.2f%% of the articles\n",
+                results->startup_time / 1000000., results->scan_fraction * 100.);
+            if (results->energy_source != WORD_MATCH_ENERGY_NONE) {
+                printf("Used %.3f J at %.2f W on average (CPU packages)\n", results->energy, results->avg_power);
+            }
             if (results->max_word_matches) {
                 printf("Best match is \"%s\", coming in at %u matches\n",
                     results->max_page_title, results->max_word_matches);
             }
+            for (unsigned int i = 0; i < results->num_top_pages; i++) {
+                unsigned int start = results->top_page_title_offsets[i];
+                unsigned int end = results->top_page_title_offsets[i + 1];
+                printf("%2u. %.*s (%u matches)\n", i + 1, (int)(end - start),
+                    results->top_page_title_values + start, results->top_page_counts[i]);
+            }
 
         }
 
+        auto cache_info = word_match_cache_info();
+        printf("Result cache: %llu hits, %llu misses, %u entries using %.1f KiB\n",
+            cache_info.hits, cache_info.misses, cache_info.num_entries, cache_info.size / 1024.);
+
         word_match_release();
     } catch (std::exception &e) {
         printf("Error: %s\n", word_match_last_error());
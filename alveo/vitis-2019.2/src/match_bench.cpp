@@ -0,0 +1,225 @@
+#include "match_engine.hpp"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/**
+ * The matching loop that the software implementation used before the match
+ * engine existed, used as the reference for both counts and throughput.
+ */
+static unsigned int legacy_count(const std::string &article_text, const std::string &pattern, bool whole_words) {
+    unsigned int num_matches = 0;
+    const char *ptr = article_text.c_str();
+    const char *end = ptr + strlen(ptr);
+    if (whole_words) {
+        int patsize = pattern.size();
+        bool first = true;
+        ptr--;
+        for (; ptr < end - patsize; ptr++, first = false) {
+            if (strncmp(ptr+1, pattern.c_str(), patsize)) {
+                continue;
+            }
+            if (!first && (isalnum(*ptr) || *ptr == '_')) {
+                continue;
+            }
+            if (ptr+1+patsize < end && (isalnum(*(ptr+1+patsize)) || *(ptr+1+patsize) == '_')) {
+                continue;
+            }
+            num_matches++;
+        }
+    } else {
+        while (ptr < end) {
+            ptr = strstr(ptr, pattern.c_str());
+            if (ptr) {
+                ptr++;
+                num_matches++;
+            } else {
+                break;
+            }
+        }
+    }
+    return num_matches;
+}
+
+/**
+ * Generates pseudo-random article-like text of the given size: words from a
+ * small vocabulary with a skewed distribution, separated by spaces and the
+ * occasional punctuation.
+ */
+static std::string generate_text(size_t size) {
+    static const char *vocabulary[] = {
+        "the", "of", "and", "in", "to", "was", "is", "for", "on", "as",
+        "by", "with", "he", "at", "from", "that", "his", "it", "an", "were",
+        "are", "which", "this", "also", "be", "has", "or", "had", "first", "one",
+        "their", "its", "new", "after", "who", "they", "two", "her", "she", "been",
+        "Netherlands", "Delft", "university", "hardware", "accelerator", "Wikipedia",
+        "Arrow", "FPGA", "Alveo", "kernel", "matching", "pattern", "theory", "thesis"
+    };
+    const size_t num_words = sizeof(vocabulary) / sizeof(vocabulary[0]);
+    std::string text;
+    text.reserve(size + 32);
+    uint64_t state = 0x853c49e6748fea9bull;
+    while (text.size() < size) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        uint32_t r = state >> 33;
+        size_t idx = ((uint64_t)(r & 0xFFFF) * (r & 0xFFFF) * num_words) >> 32;
+        text += vocabulary[idx];
+        switch ((r >> 16) & 15) {
+            case 0: text += ". "; break;
+            case 1: text += ", "; break;
+            case 2: text += "\n"; break;
+            case 3: text += "_"; break;
+            default: text += " "; break;
+        }
+    }
+    text.resize(size);
+    return text;
+}
+
+/**
+ * Runs `fn` `reps` times and returns the best throughput in GB/s.
+ */
+template <typename F>
+static double measure(size_t size, int reps, F fn) {
+    double best = 0.0;
+    for (int rep = 0; rep < reps; rep++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        fn();
+        auto elapsed = std::chrono::high_resolution_clock::now() - start;
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        double gbps = size / seconds / 1e9;
+        if (gbps > best) best = gbps;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+
+    // Parse command line.
+    if (argc > 1 && (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help"))) {
+        printf("Usage: %s [size-in-MiB=64] [pattern...]\n", argv[0]);
+        printf("Patterns prefixed with ~ are matched as whole words.\n");
+        exit(1);
+    }
+    size_t size = ((argc > 1) ? atoi(argv[1]) : 64) * 1024ull * 1024ull;
+    std::vector<std::string> patterns;
+    for (int i = 2; i < argc; i++) {
+        patterns.push_back(argv[i]);
+    }
+    if (patterns.empty()) {
+        patterns = {"e", "the", "~the", "Delft", "~Delft", "university", "Netherlands", "~Wikipedia", "not present"};
+    }
+
+    printf("Generating %zu MiB of text...\n", size / (1024 * 1024));
+    std::string text = generate_text(size);
+
+    const MatchEngineIsa isas[] = {
+        MatchEngineIsa::SCALAR, MatchEngineIsa::SSE42, MatchEngineIsa::AVX2, MatchEngineIsa::AVX512};
+
+    printf("Single-thread throughput in GB/s (best of 5):\n");
+    printf("%-14s %10s %8s", "pattern", "matches", "legacy");
+    for (auto isa : isas) {
+        printf(" %8s", MatchEngine::name(isa));
+    }
+    printf("\n");
+
+    bool ok = true;
+    for (auto &arg : patterns) {
+        bool whole_words = !arg.empty() && arg[0] == '~';
+        std::string pattern = whole_words ? arg.substr(1) : arg;
+
+        unsigned int expected = 0;
+        double legacy = measure(size, 5, [&]() {
+            expected = legacy_count(text, pattern, whole_words);
+        });
+        printf("%-14s %10u %8.2f", arg.c_str(), expected, legacy);
+
+        for (auto isa : isas) {
+            if (!MatchEngine::supported(isa)) {
+                printf(" %8s", "-");
+                continue;
+            }
+            MatchEngine engine(pattern, whole_words, isa);
+            unsigned int actual = 0;
+            double gbps = measure(size, 5, [&]() {
+                actual = engine.count(text.data(), text.size());
+            });
+            if (actual != expected) {
+                printf(" MISMATCH(%u)", actual);
+                ok = false;
+            } else {
+                printf(" %8.2f", gbps);
+            }
+        }
+        printf("\n");
+    }
+
+    printf("Runtime-selected variant: %s\n", MatchEngine::name(MatchEngine::best()));
+
+    // Measure how the multi-pattern engine scales with the number of
+    // patterns, compared to running the single-pattern engine for each. This
+    // is done both for frequent patterns taken from the vocabulary, which
+    // match every few dozen bytes, and for random lowercase strings, which
+    // approximate typical search terms in that they (almost) never match.
+    std::vector<std::string> frequent = {
+        "university", "Netherlands", "Delft", "thesis", "kernel", "matching", "accelerator", "Wikipedia",
+        "hardware", "theory", "pattern", "Alveo", "FPGA", "Arrow", "first", "after",
+        "which", "their", "were", "also", "been", "from", "with", "that",
+        "this", "they", "she", "her", "two", "new", "who", "its"
+    };
+    std::vector<std::string> rare;
+    uint64_t state = 0x2545f4914f6cdd1dull;
+    while (rare.size() < 64) {
+        std::string pattern;
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        size_t length = 5 + (state >> 60) % 5;
+        for (size_t i = 0; i < length; i++) {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            pattern += (char)('a' + (state >> 33) % 26);
+        }
+        rare.push_back(pattern);
+    }
+    printf("\nMulti-pattern throughput in GB/s (best of 3):\n");
+    printf("%-9s %10s %10s %10s %10s %10s\n", "patterns", "frequent", "singles", "rare", "singles", "strategy");
+    for (size_t n = 1; n <= rare.size(); n *= 2) {
+        printf("%-9zu", n);
+        for (auto set : {&frequent, &rare}) {
+            if (n > set->size()) {
+                printf(" %10s %10s", "-", "-");
+                continue;
+            }
+            std::vector<std::string> pats(set->begin(), set->begin() + n);
+            std::vector<bool> whole_words(n, false);
+            MultiMatchEngine multi(pats, whole_words);
+            std::vector<unsigned int> counts(n);
+            double multi_gbps = measure(size, 3, [&]() {
+                std::fill(counts.begin(), counts.end(), 0);
+                multi.count(text.data(), text.size(), 0, true, true, counts.data());
+            });
+            std::vector<unsigned int> expected(n);
+            double singles_gbps = measure(size, 3, [&]() {
+                for (size_t i = 0; i < n; i++) {
+                    expected[i] = MatchEngine(pats[i], false).count(text.data(), text.size());
+                }
+            });
+            if (counts != expected) {
+                printf(" %10s %10s", "MISMATCH", "");
+                ok = false;
+            } else {
+                printf(" %10.2f %10.2f", multi_gbps, singles_gbps);
+            }
+            if (set == &rare) {
+                printf(" %10s", multi.strategy_name());
+            }
+        }
+        printf("\n");
+    }
+
+    return ok ? 0 : 2;
+}
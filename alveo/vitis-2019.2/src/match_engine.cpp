@@ -0,0 +1,750 @@
+#include "match_engine.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <string.h>
+#include <inttypes.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define MATCH_ENGINE_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * Returns whether the given character is part of a word, i.e. whether
+ * `isalnum(c) || c == '_'` holds in the C locale.
+ */
+static inline bool is_word_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+/**
+ * Returns whether a match at the given position should be counted. This is
+ * always the case unless whole-word matching is enabled, in which case the
+ * characters before and after the match must not be word characters. The
+ * character before `text` is only considered if `bof` is not set, and the
+ * character at `text + size` only if `eof` is not set.
+ */
+template <bool whole_words>
+static inline bool accept(const char *text, size_t size, size_t pos, size_t pat_size, bool bof, bool eof) {
+    if (!whole_words) {
+        return true;
+    }
+    if ((pos > 0 || !bof) && is_word_char(text[pos - 1])) {
+        return false;
+    }
+    if ((pos + pat_size < size || !eof) && is_word_char(text[pos + pat_size])) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Verifies a candidate position for which the first, middle and last
+ * character already matched.
+ */
+template <bool whole_words>
+static inline bool verify(const char *text, size_t size, size_t pos, const char *pat, size_t pat_size, bool bof, bool eof) {
+    if (pat_size > 2 && memcmp(text + pos + 1, pat + 1, pat_size - 2)) {
+        return false;
+    }
+    return accept<whole_words>(text, size, pos, pat_size, bof, eof);
+}
+
+/**
+ * Scalar matcher for the candidate positions starting at `start`. Used
+ * directly as the fallback implementation and for the tails of the vectorized
+ * implementations.
+ */
+template <bool whole_words>
+static inline unsigned int count_tail(const char *text, size_t size, const char *pat, size_t pat_size, bool bof, bool eof, size_t start) {
+    if (pat_size > size) {
+        return 0;
+    }
+    unsigned int count = 0;
+    const char *ptr = text + start;
+    const char *end = text + size - pat_size + 1;
+    while (ptr < end) {
+        ptr = (const char*)memchr(ptr, pat[0], end - ptr);
+        if (!ptr) {
+            break;
+        }
+        size_t pos = ptr - text;
+        if (!memcmp(ptr + 1, pat + 1, pat_size - 1) && accept<whole_words>(text, size, pos, pat_size, bof, eof)) {
+            count++;
+        }
+        ptr++;
+    }
+    return count;
+}
+
+template <bool whole_words>
+static unsigned int count_scalar(const char *text, size_t size, const char *pat, size_t pat_size, bool bof, bool eof) {
+    return count_tail<whole_words>(text, size, pat, pat_size, bof, eof, 0);
+}
+
+/**
+ * Matcher for the empty pattern, which matches at every position. The strstr()
+ * loop counted every character, whereas the whole-word loop considered every
+ * position including the one past the last character.
+ */
+template <bool whole_words>
+static unsigned int count_empty(const char *text, size_t size, const char *pat, size_t pat_size, bool bof, bool eof) {
+    if (!whole_words) {
+        return size;
+    }
+    unsigned int count = 0;
+    for (size_t pos = 0; pos <= size; pos++) {
+        if (accept<true>(text, size, pos, 0, bof, eof)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+#ifdef MATCH_ENGINE_X86
+
+template <bool whole_words>
+__attribute__((target("sse4.2")))
+static unsigned int count_sse42(const char *text, size_t size, const char *pat, size_t pat_size, bool bof, bool eof) {
+    unsigned int count = 0;
+    const __m128i first = _mm_set1_epi8(pat[0]);
+    const __m128i last = _mm_set1_epi8(pat[pat_size - 1]);
+    const size_t mid_off = pat_size / 2;
+    const __m128i mid = _mm_set1_epi8(pat[mid_off]);
+    size_t i = 0;
+    for (; i + pat_size + 15 <= size; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i*)(text + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i*)(text + i + pat_size - 1));
+        __m128i block_mid = _mm_loadu_si128((const __m128i*)(text + i + mid_off));
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(
+            _mm_cmpeq_epi8(first, block_first),
+            _mm_cmpeq_epi8(last, block_last)),
+            _mm_cmpeq_epi8(mid, block_mid)));
+        while (mask) {
+            size_t pos = i + __builtin_ctz(mask);
+            if (verify<whole_words>(text, size, pos, pat, pat_size, bof, eof)) {
+                count++;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return count + count_tail<whole_words>(text, size, pat, pat_size, bof, eof, i);
+}
+
+template <bool whole_words>
+__attribute__((target("avx2")))
+static unsigned int count_avx2(const char *text, size_t size, const char *pat, size_t pat_size, bool bof, bool eof) {
+    unsigned int count = 0;
+    const __m256i first = _mm256_set1_epi8(pat[0]);
+    const __m256i last = _mm256_set1_epi8(pat[pat_size - 1]);
+    const size_t mid_off = pat_size / 2;
+    const __m256i mid = _mm256_set1_epi8(pat[mid_off]);
+    size_t i = 0;
+    for (; i + pat_size + 31 <= size; i += 32) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i*)(text + i));
+        __m256i block_last = _mm256_loadu_si256((const __m256i*)(text + i + pat_size - 1));
+        __m256i block_mid = _mm256_loadu_si256((const __m256i*)(text + i + mid_off));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(
+            _mm256_cmpeq_epi8(first, block_first),
+            _mm256_cmpeq_epi8(last, block_last)),
+            _mm256_cmpeq_epi8(mid, block_mid)));
+        while (mask) {
+            size_t pos = i + __builtin_ctz(mask);
+            if (verify<whole_words>(text, size, pos, pat, pat_size, bof, eof)) {
+                count++;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return count + count_tail<whole_words>(text, size, pat, pat_size, bof, eof, i);
+}
+
+template <bool whole_words>
+__attribute__((target("avx512f,avx512bw")))
+static unsigned int count_avx512(const char *text, size_t size, const char *pat, size_t pat_size, bool bof, bool eof) {
+    unsigned int count = 0;
+    const __m512i first = _mm512_set1_epi8(pat[0]);
+    const __m512i last = _mm512_set1_epi8(pat[pat_size - 1]);
+    const size_t mid_off = pat_size / 2;
+    const __m512i mid = _mm512_set1_epi8(pat[mid_off]);
+    size_t i = 0;
+    for (; i + pat_size + 63 <= size; i += 64) {
+        __m512i block_first = _mm512_loadu_si512((const void*)(text + i));
+        __m512i block_last = _mm512_loadu_si512((const void*)(text + i + pat_size - 1));
+        __m512i block_mid = _mm512_loadu_si512((const void*)(text + i + mid_off));
+        uint64_t mask = _mm512_cmpeq_epi8_mask(first, block_first)
+                      & _mm512_cmpeq_epi8_mask(last, block_last)
+                      & _mm512_cmpeq_epi8_mask(mid, block_mid);
+        while (mask) {
+            size_t pos = i + __builtin_ctzll(mask);
+            if (verify<whole_words>(text, size, pos, pat, pat_size, bof, eof)) {
+                count++;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return count + count_tail<whole_words>(text, size, pat, pat_size, bof, eof, i);
+}
+
+#endif
+
+/**
+ * Constructs a match engine for the given pattern. If `isa` is not
+ * `AUTO` and not supported by the CPU, an exception is thrown.
+ */
+MatchEngine::MatchEngine(const std::string &pattern, bool whole_words, MatchEngineIsa isa)
+    : pattern(pattern)
+{
+    if (isa == MatchEngineIsa::AUTO) {
+        isa = best();
+    } else if (!supported(isa)) {
+        throw std::runtime_error(std::string("match engine variant ") + name(isa) + " is not supported by this CPU");
+    }
+
+    if (pattern.empty()) {
+        count_fn = whole_words ? count_empty<true> : count_empty<false>;
+        return;
+    }
+
+    switch (isa) {
+#ifdef MATCH_ENGINE_X86
+        case MatchEngineIsa::AVX512:
+            count_fn = whole_words ? count_avx512<true> : count_avx512<false>;
+            break;
+        case MatchEngineIsa::AVX2:
+            count_fn = whole_words ? count_avx2<true> : count_avx2<false>;
+            break;
+        case MatchEngineIsa::SSE42:
+            count_fn = whole_words ? count_sse42<true> : count_sse42<false>;
+            break;
+#endif
+        default:
+            count_fn = whole_words ? count_scalar<true> : count_scalar<false>;
+            break;
+    }
+}
+
+/**
+ * Returns whether the given instruction set variant can be used on this
+ * CPU.
+ */
+bool MatchEngine::supported(MatchEngineIsa isa) {
+    switch (isa) {
+        case MatchEngineIsa::AUTO:
+        case MatchEngineIsa::SCALAR:
+            return true;
+#ifdef MATCH_ENGINE_X86
+        case MatchEngineIsa::SSE42:
+            return __builtin_cpu_supports("sse4.2");
+        case MatchEngineIsa::AVX2:
+            return __builtin_cpu_supports("avx2");
+        case MatchEngineIsa::AVX512:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+        default:
+            return false;
+    }
+}
+
+/**
+ * Returns the best instruction set variant supported by this CPU.
+ */
+MatchEngineIsa MatchEngine::best() {
+    static const MatchEngineIsa isa = []() {
+        for (auto isa : {MatchEngineIsa::AVX512, MatchEngineIsa::AVX2, MatchEngineIsa::SSE42}) {
+            if (supported(isa)) {
+                return isa;
+            }
+        }
+        return MatchEngineIsa::SCALAR;
+    }();
+    return isa;
+}
+
+/**
+ * Returns a printable name for the given instruction set variant.
+ */
+const char *MatchEngine::name(MatchEngineIsa isa) {
+    switch (isa) {
+        case MatchEngineIsa::AUTO:   return "auto";
+        case MatchEngineIsa::SCALAR: return "scalar";
+        case MatchEngineIsa::SSE42:  return "sse4.2";
+        case MatchEngineIsa::AVX2:   return "avx2";
+        case MatchEngineIsa::AVX512: return "avx512";
+    }
+    return "unknown";
+}
+
+const size_t MultiMatchEngine::SINGLE_MAX_PATTERNS;
+const size_t MultiMatchEngine::TEDDY_MAX_PATTERNS;
+const size_t MultiMatchEngine::TEDDY_SAMPLE_SIZE;
+const size_t MultiMatchEngine::TEDDY_CHECK_COST;
+const size_t MultiMatchEngine::TEDDY_HIT_COST;
+
+#ifdef MATCH_ENGINE_X86
+
+/**
+ * Teddy candidate search for `LEN`-byte fingerprints, 16 positions at a time.
+ * Calls `verify(pos, buckets)` for each position at which a pattern from one
+ * of the buckets may start. Returns the first position that was not
+ * checked.
+ */
+template <size_t LEN, typename F>
+__attribute__((target("sse4.2")))
+static size_t teddy_sse42(const char *text, size_t start, size_t size, const uint8_t masks[3][2][16], F verify) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i tables[LEN][2];
+    for (size_t j = 0; j < LEN; j++) {
+        tables[j][0] = _mm_loadu_si128((const __m128i*)masks[j][0]);
+        tables[j][1] = _mm_loadu_si128((const __m128i*)masks[j][1]);
+    }
+    size_t i = start;
+    for (; i + 16 + LEN - 1 <= size; i += 16) {
+        __m128i res = _mm_set1_epi8(-1);
+        for (size_t j = 0; j < LEN; j++) {
+            __m128i block = _mm_loadu_si128((const __m128i*)(text + i + j));
+            __m128i lo = _mm_and_si128(block, nibble);
+            __m128i hi = _mm_and_si128(_mm_srli_epi16(block, 4), nibble);
+            res = _mm_and_si128(res, _mm_and_si128(
+                _mm_shuffle_epi8(tables[j][0], lo), _mm_shuffle_epi8(tables[j][1], hi)));
+        }
+        uint32_t mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(res, _mm_setzero_si128())) & 0xFFFF;
+        if (mask) {
+            alignas(16) uint8_t buckets[16];
+            _mm_store_si128((__m128i*)buckets, res);
+            while (mask) {
+                size_t off = __builtin_ctz(mask);
+                verify(i + off, buckets[off]);
+                mask &= mask - 1;
+            }
+        }
+    }
+    return i;
+}
+
+/**
+ * Teddy candidate search for `LEN`-byte fingerprints, 32 positions at a time.
+ * Calls `verify(pos, buckets)` for each position at which a pattern from one
+ * of the buckets may start. Returns the first position that was not
+ * checked.
+ */
+template <size_t LEN, typename F>
+__attribute__((target("avx2")))
+static size_t teddy_avx2(const char *text, size_t start, size_t size, const uint8_t masks[3][2][16], F verify) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i tables[LEN][2];
+    for (size_t j = 0; j < LEN; j++) {
+        tables[j][0] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)masks[j][0]));
+        tables[j][1] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)masks[j][1]));
+    }
+    size_t i = start;
+    for (; i + 32 + LEN - 1 <= size; i += 32) {
+        __m256i res = _mm256_set1_epi8(-1);
+        for (size_t j = 0; j < LEN; j++) {
+            __m256i block = _mm256_loadu_si256((const __m256i*)(text + i + j));
+            __m256i lo = _mm256_and_si256(block, nibble);
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(block, 4), nibble);
+            res = _mm256_and_si256(res, _mm256_and_si256(
+                _mm256_shuffle_epi8(tables[j][0], lo), _mm256_shuffle_epi8(tables[j][1], hi)));
+        }
+        uint32_t mask = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(res, _mm256_setzero_si256()));
+        if (mask) {
+            alignas(32) uint8_t buckets[32];
+            _mm256_store_si256((__m256i*)buckets, res);
+            while (mask) {
+                size_t off = __builtin_ctz(mask);
+                verify(i + off, buckets[off]);
+                mask &= mask - 1;
+            }
+        }
+    }
+    return i;
+}
+
+/**
+ * Runs the Teddy candidate search with the given fingerprint length, using
+ * AVX2 if the instruction set variant allows it. Returns the first position
+ * that was not checked.
+ */
+template <typename F>
+static size_t teddy_search(MatchEngineIsa isa, size_t len, const char *text, size_t start, size_t size,
+    const uint8_t masks[3][2][16], F verify
+) {
+    bool avx2 = isa == MatchEngineIsa::AVX2 || isa == MatchEngineIsa::AVX512;
+    switch (len) {
+        case 1:
+            return avx2 ? teddy_avx2<1>(text, start, size, masks, verify)
+                        : teddy_sse42<1>(text, start, size, masks, verify);
+        case 2:
+            return avx2 ? teddy_avx2<2>(text, start, size, masks, verify)
+                        : teddy_sse42<2>(text, start, size, masks, verify);
+        default:
+            return avx2 ? teddy_avx2<3>(text, start, size, masks, verify)
+                        : teddy_sse42<3>(text, start, size, masks, verify);
+    }
+}
+
+#endif
+
+/**
+ * Constructs a multi-pattern match engine. `whole_words` must have the
+ * same size as `patterns`. If `isa` is not `AUTO` and not supported by the
+ * CPU, an exception is thrown.
+ */
+MultiMatchEngine::MultiMatchEngine(
+    const std::vector<std::string> &patterns, const std::vector<bool> &whole_words,
+    MatchEngineIsa isa
+) :
+    patterns(patterns), whole_words(whole_words), max_pattern_size(0), any_empty(false),
+    isa(isa == MatchEngineIsa::AUTO ? MatchEngine::best() : isa), teddy_len(0), num_classes(0)
+{
+    if (patterns.size() != whole_words.size()) {
+        throw std::runtime_error("pattern and whole-word flag count mismatch");
+    }
+    size_t num_nonempty = 0;
+    for (size_t i = 0; i < patterns.size(); i++) {
+        engines.emplace_back(patterns[i], whole_words[i], isa);
+        max_pattern_size = std::max(max_pattern_size, patterns[i].size());
+        if (patterns[i].empty()) {
+            any_empty = true;
+        } else {
+            num_nonempty++;
+        }
+    }
+    if (num_nonempty <= SINGLE_MAX_PATTERNS) {
+        strategy = Strategy::SINGLE;
+#ifdef MATCH_ENGINE_X86
+    } else if (num_nonempty <= TEDDY_MAX_PATTERNS && this->isa != MatchEngineIsa::SCALAR) {
+        strategy = Strategy::TEDDY;
+        build_teddy();
+#endif
+    } else {
+        strategy = Strategy::AUTOMATON;
+        build_automaton();
+    }
+}
+
+/**
+ * Builds the Teddy tables for the nonempty patterns.
+ */
+void MultiMatchEngine::build_teddy() {
+
+    // Use fingerprints of up to three bytes, limited by the shortest
+    // pattern.
+    std::vector<uint32_t> order;
+    teddy_len = 3;
+    for (uint32_t pi = 0; pi < patterns.size(); pi++) {
+        if (!patterns[pi].empty()) {
+            order.push_back(pi);
+            teddy_len = std::min(teddy_len, patterns[pi].size());
+        }
+    }
+
+    // Divide the patterns over the buckets greedily, adding each pattern to
+    // the bucket for which the number of byte sequences that pass the filter
+    // grows the least. Patterns are considered in lexicographical order, so
+    // patterns with the same prefix end up in the same bucket.
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        return patterns[a] < patterns[b];
+    });
+    uint16_t nibble_sets[8][3][2] = {};
+    size_t bucket_sizes[8] = {};
+    std::vector<std::vector<uint32_t>> buckets(8);
+    for (uint32_t pi : order) {
+        size_t best_bucket = 0;
+        uint64_t best_growth = UINT64_MAX;
+        for (size_t bucket = 0; bucket < 8; bucket++) {
+            uint64_t before = bucket_sizes[bucket] ? 1 : 0;
+            uint64_t after = 1;
+            for (size_t j = 0; j < teddy_len; j++) {
+                unsigned char c = patterns[pi][j];
+                uint16_t lo = nibble_sets[bucket][j][0];
+                uint16_t hi = nibble_sets[bucket][j][1];
+                before *= __builtin_popcount(lo) * __builtin_popcount(hi);
+                after *= __builtin_popcount(lo | (1 << (c & 15))) * __builtin_popcount(hi | (1 << (c >> 4)));
+            }
+            uint64_t growth = after - before;
+            if (growth < best_growth || (growth == best_growth && bucket_sizes[bucket] < bucket_sizes[best_bucket])) {
+                best_bucket = bucket;
+                best_growth = growth;
+            }
+        }
+        for (size_t j = 0; j < teddy_len; j++) {
+            unsigned char c = patterns[pi][j];
+            nibble_sets[best_bucket][j][0] |= 1 << (c & 15);
+            nibble_sets[best_bucket][j][1] |= 1 << (c >> 4);
+        }
+        bucket_sizes[best_bucket]++;
+        buckets[best_bucket].push_back(pi);
+    }
+
+    // Construct the tables.
+    memset(teddy_masks, 0, sizeof(teddy_masks));
+    bucket_patterns.clear();
+    teddy_data.clear();
+    for (size_t bucket = 0; bucket < 8; bucket++) {
+        bucket_offsets[bucket] = bucket_patterns.size();
+        for (uint32_t pi : buckets[bucket]) {
+            const std::string &pattern = patterns[pi];
+            for (size_t j = 0; j < teddy_len; j++) {
+                unsigned char c = pattern[j];
+                teddy_masks[j][0][c & 15] |= 1 << bucket;
+                teddy_masks[j][1][c >> 4] |= 1 << bucket;
+            }
+            TeddyPattern pat;
+            pat.offset = teddy_data.size();
+            pat.size = pattern.size();
+            pat.index = pi;
+            pat.whole_words = whole_words[pi];
+            bucket_patterns.push_back(pat);
+            teddy_data += pattern;
+        }
+    }
+    bucket_offsets[8] = bucket_patterns.size();
+
+}
+
+/**
+ * Builds the Aho-Corasick automaton for the nonempty patterns.
+ */
+void MultiMatchEngine::build_automaton() {
+
+    // Assign a class to each byte that occurs in a pattern.
+    for (auto &c : byte_class) {
+        c = 0;
+    }
+    num_classes = 1;
+    for (auto &pattern : patterns) {
+        for (unsigned char c : pattern) {
+            if (!byte_class[c]) {
+                byte_class[c] = num_classes++;
+            }
+        }
+    }
+
+    // Build the trie. Missing transitions are marked with UINT32_MAX for now.
+    std::vector<uint32_t> next(num_classes, UINT32_MAX);
+    std::vector<std::vector<uint32_t>> state_outputs(1);
+    for (uint32_t pi = 0; pi < patterns.size(); pi++) {
+        if (patterns[pi].empty()) {
+            continue;
+        }
+        uint32_t state = 0;
+        for (unsigned char c : patterns[pi]) {
+            uint32_t &target = next[state * num_classes + byte_class[c]];
+            if (target == UINT32_MAX) {
+                target = state_outputs.size();
+                state_outputs.emplace_back();
+                next.resize(state_outputs.size() * num_classes, UINT32_MAX);
+            }
+            state = next[state * num_classes + byte_class[c]];
+        }
+        state_outputs[state].push_back(pi);
+    }
+    size_t num_states = state_outputs.size();
+
+    // Complete the transition function in breadth-first order using the
+    // failure links, turning the trie into a DFA. The outputs of the failure
+    // state are merged into each state, so each state lists all patterns that
+    // end there.
+    std::vector<uint32_t> fail(num_states, 0);
+    std::vector<uint32_t> queue;
+    for (size_t c = 0; c < num_classes; c++) {
+        uint32_t &target = next[c];
+        if (target == UINT32_MAX) {
+            target = 0;
+        } else {
+            queue.push_back(target);
+        }
+    }
+    for (size_t qi = 0; qi < queue.size(); qi++) {
+        uint32_t state = queue[qi];
+        auto &outs = state_outputs[state];
+        auto &fail_outs = state_outputs[fail[state]];
+        outs.insert(outs.end(), fail_outs.begin(), fail_outs.end());
+        for (size_t c = 0; c < num_classes; c++) {
+            uint32_t &target = next[state * num_classes + c];
+            uint32_t fallback = next[fail[state] * num_classes + c];
+            if (target == UINT32_MAX) {
+                target = fallback;
+            } else {
+                fail[target] = fallback;
+                queue.push_back(target);
+            }
+        }
+    }
+
+    // Flatten the outputs and encode the transitions.
+    output_offsets.resize(num_states + 1);
+    outputs.clear();
+    for (size_t state = 0; state < num_states; state++) {
+        output_offsets[state] = outputs.size();
+        outputs.insert(outputs.end(), state_outputs[state].begin(), state_outputs[state].end());
+    }
+    output_offsets[num_states] = outputs.size();
+    if ((uint64_t)num_states * num_classes >= 0x80000000ull) {
+        throw std::runtime_error("too many patterns for the match automaton");
+    }
+    transitions.resize(next.size());
+    for (size_t i = 0; i < next.size(); i++) {
+        uint32_t target = next[i];
+        transitions[i] = target * num_classes;
+        if (!state_outputs[target].empty()) {
+            transitions[i] |= 0x80000000u;
+        }
+    }
+
+}
+
+/**
+ * Scans the text once for each nonempty pattern, starting such that the
+ * first candidate match ends at `from`.
+ */
+void MultiMatchEngine::count_single(const char *text, size_t size, size_t from, bool bof, bool eof, unsigned int *counts) const {
+    for (size_t pi = 0; pi < engines.size(); pi++) {
+        size_t pat_size = engines[pi].size();
+        if (!pat_size) {
+            continue;
+        }
+        size_t start = (from > pat_size - 1) ? from - (pat_size - 1) : 0;
+        if (start <= size) {
+            counts[pi] += engines[pi].count(text + start, size - start, bof && !start, eof);
+        }
+    }
+}
+
+/**
+ * Runs the Teddy strategy.
+ */
+void MultiMatchEngine::count_teddy(const char *text, size_t size, size_t from, bool bof, bool eof, unsigned int *counts) const {
+#ifdef MATCH_ENGINE_X86
+
+    // Matches that start before this cannot end at or after `from`.
+    size_t start = (from > max_pattern_size - 1) ? from - (max_pattern_size - 1) : 0;
+
+    // Counts the matches of the patterns in the given buckets that start at
+    // the given position.
+    const char *data = teddy_data.data();
+    const TeddyPattern *bpats = bucket_patterns.data();
+    size_t hits = 0;
+    auto verify = [&](size_t pos, unsigned int buckets) {
+        while (buckets) {
+            unsigned int bucket = __builtin_ctz(buckets);
+            buckets &= buckets - 1;
+            for (uint32_t bi = bucket_offsets[bucket]; bi < bucket_offsets[bucket + 1]; bi++) {
+                const TeddyPattern &pat = bpats[bi];
+                if (pos + pat.size > size || pos + pat.size <= from) {
+                    continue;
+                }
+                if (text[pos + pat.size - 1] != data[pat.offset + pat.size - 1]) {
+                    continue;
+                }
+                hits++;
+                if (memcmp(text + pos, data + pat.offset, pat.size)) {
+                    continue;
+                }
+                if (pat.whole_words && !accept<true>(text, size, pos, pat.size, bof, eof)) {
+                    continue;
+                }
+                counts[pat.index]++;
+            }
+        }
+    };
+
+    // Verifying candidates costs much more than rejecting positions, so
+    // Teddy is slower than a scan per pattern when the patterns are
+    // frequent. Estimate the cost of the candidates in the first block, and
+    // scan the rest of the text once per pattern if that is cheaper.
+    size_t sample_start = start;
+    size_t sample_end = std::min(size, start + TEDDY_SAMPLE_SIZE);
+    size_t checks = 0;
+    start = teddy_search(isa, teddy_len, text, start, sample_end, teddy_masks, [&](size_t pos, unsigned int buckets) {
+        for (unsigned int b = buckets; b; b &= b - 1) {
+            unsigned int bucket = __builtin_ctz(b);
+            checks += bucket_offsets[bucket + 1] - bucket_offsets[bucket];
+        }
+        verify(pos, buckets);
+    });
+    size_t cost = checks * TEDDY_CHECK_COST + hits * TEDDY_HIT_COST;
+    if (sample_end < size && cost > (sample_end - sample_start) * bucket_patterns.size()) {
+        count_single(text + start, size - start, (from > start) ? from - start : 0, bof && !start, eof, counts);
+        return;
+    }
+    start = teddy_search(isa, teddy_len, text, start, size, teddy_masks, verify);
+
+    // Check the remaining positions against all buckets.
+    for (size_t pos = start; pos < size; pos++) {
+        verify(pos, 0xFF);
+    }
+
+#endif
+}
+
+/**
+ * Runs the Aho-Corasick strategy.
+ */
+void MultiMatchEngine::count_automaton(const char *text, size_t size, size_t from, bool bof, bool eof, unsigned int *counts) const {
+    const uint32_t *trans = transitions.data();
+    uint32_t state = 0;
+    for (size_t pos = 0; pos < size; pos++) {
+        state = trans[(state & 0x7FFFFFFFu) + byte_class[(unsigned char)text[pos]]];
+        if (!(state & 0x80000000u) || pos < from) {
+            continue;
+        }
+        uint32_t index = (state & 0x7FFFFFFFu) / num_classes;
+        for (uint32_t oi = output_offsets[index]; oi < output_offsets[index + 1]; oi++) {
+            uint32_t pi = outputs[oi];
+            size_t pat_size = patterns[pi].size();
+            size_t start = pos + 1 - pat_size;
+            if (whole_words[pi] && !accept<true>(text, size, start, pat_size, bof, eof)) {
+                continue;
+            }
+            counts[pi]++;
+        }
+    }
+}
+
+/**
+ * Adds the number of matches of each pattern in the given text to
+ * `counts`, which must have an entry for each pattern. Only matches that
+ * end at or after offset `from` are counted, so a caller scanning a text
+ * incrementally can include up to `max_size() - 1` bytes of context from
+ * the previous call without counting matches twice. `bof` and `eof` work
+ * as for MatchEngine::count(). `from` must be zero if there are empty
+ * patterns.
+ */
+void MultiMatchEngine::count(const char *text, size_t size, size_t from, bool bof, bool eof, unsigned int *counts) const {
+
+    // Empty patterns are handled separately.
+    if (any_empty) {
+        for (size_t pi = 0; pi < engines.size(); pi++) {
+            if (!engines[pi].size()) {
+                counts[pi] += engines[pi].count(text, size, bof, eof);
+            }
+        }
+    }
+
+    switch (strategy) {
+        case Strategy::SINGLE:
+            count_single(text, size, from, bof, eof, counts);
+            break;
+        case Strategy::TEDDY:
+            count_teddy(text, size, from, bof, eof, counts);
+            break;
+        case Strategy::AUTOMATON:
+            count_automaton(text, size, from, bof, eof, counts);
+            break;
+    }
+
+}
+
+/**
+ * Returns a printable name for the strategy used.
+ */
+const char *MultiMatchEngine::strategy_name() const {
+    switch (strategy) {
+        case Strategy::SINGLE:    return "single";
+        case Strategy::TEDDY:     return "teddy";
+        case Strategy::AUTOMATON: return "automaton";
+    }
+    return "unknown";
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <inttypes.h>
+#include <stddef.h>
+
+/**
+ * Instruction set variants of the match engine. `AUTO` selects the best one
+ * supported by the CPU at runtime.
+ */
+enum class MatchEngineIsa {
+    AUTO,
+    SCALAR,
+    SSE42,
+    AVX2,
+    AVX512
+};
+
+/**
+ * Substring matcher used by the software word matcher. Candidate positions
+ * are found by comparing the first and last byte of the pattern (and the
+ * middle byte, which costs little and removes most false positives for common
+ * letters) against a full vector of text positions at once, after which only
+ * the candidates are verified with memcmp(). The counts are exactly those of the original
+ * strstr()/strncmp() loops: overlapping matches are counted, and in whole-word
+ * mode the characters surrounding a match must not be `[a-zA-Z0-9_]`.
+ */
+class MatchEngine {
+private:
+    std::string pattern;
+    unsigned int (*count_fn)(const char *text, size_t size, const char *pat, size_t pat_size, bool bof, bool eof);
+
+public:
+
+    /**
+     * Constructs a match engine for the given pattern. If `isa` is not
+     * `AUTO` and not supported by the CPU, an exception is thrown.
+     */
+    MatchEngine(const std::string &pattern, bool whole_words, MatchEngineIsa isa = MatchEngineIsa::AUTO);
+
+    /**
+     * Returns the number of matches of the pattern in the given text. If the
+     * text is only a slice of an article, `bof` and `eof` indicate whether it
+     * starts at the beginning and ends at the end of the article respectively.
+     * When they are cleared, the character before or at the end of the slice
+     * must be readable, as it is used for the whole-word boundary check.
+     * Only matches that lie entirely within the slice are counted.
+     */
+    inline unsigned int count(const char *text, size_t size, bool bof = true, bool eof = true) const {
+        return count_fn(text, size, pattern.data(), pattern.size(), bof, eof);
+    }
+
+    /**
+     * Returns the size of the pattern in bytes.
+     */
+    inline size_t size() const {
+        return pattern.size();
+    }
+
+    /**
+     * Returns whether the given instruction set variant can be used on this
+     * CPU.
+     */
+    static bool supported(MatchEngineIsa isa);
+
+    /**
+     * Returns the best instruction set variant supported by this CPU.
+     */
+    static MatchEngineIsa best();
+
+    /**
+     * Returns a printable name for the given instruction set variant.
+     */
+    static const char *name(MatchEngineIsa isa);
+
+};
+
+/**
+ * Matcher for multiple patterns at once, producing a match count per pattern
+ * that is exactly what a MatchEngine for that pattern would return. Depending
+ * on the number of patterns, one of three strategies is used:
+ *
+ *  - for a handful of patterns, the text (which is normally still in cache) is
+ *    scanned once for each pattern with the vectorized single-pattern engine;
+ *  - for up to TEDDY_MAX_PATTERNS patterns, the patterns are divided over
+ *    eight buckets, and positions where a pattern from a bucket may start are
+ *    found for a full vector of positions at once by looking up the nibbles of
+ *    the first few bytes in small shuffle tables, after which only the
+ *    candidates are verified (this is the "Teddy" algorithm from Hyperscan);
+ *  - for more patterns, or if the CPU lacks SSE4.2, a single pass of an
+ *    Aho-Corasick automaton counts all patterns at once.
+ *
+ * For patterns that rarely match, the cost per byte of the latter two grows
+ * much slower than the number of patterns. Patterns that match frequently
+ * make Teddy verify a candidate every few bytes, which is slower than a scan
+ * per pattern. Teddy therefore estimates the cost of its candidates at the
+ * start of each text, and scans the rest once for each pattern if that is
+ * cheaper. The cost per byte then grows linearly with the number of patterns.
+ */
+class MultiMatchEngine {
+private:
+    enum class Strategy {
+        SINGLE,
+        TEDDY,
+        AUTOMATON
+    };
+
+    std::vector<std::string> patterns;
+    std::vector<MatchEngine> engines;
+    std::vector<bool> whole_words;
+    size_t max_pattern_size;
+    bool any_empty;
+    Strategy strategy;
+    MatchEngineIsa isa;
+
+    // Teddy tables. For each of the first `teddy_len` pattern bytes, there is
+    // a table for the low and for the high nibble, mapping the nibble to the
+    // set of buckets that have a pattern with that nibble at that position.
+    // The patterns of bucket b are listed in bucket_patterns from
+    // bucket_offsets[b] up to bucket_offsets[b + 1], with their data
+    // concatenated in teddy_data for locality.
+    struct TeddyPattern {
+        uint32_t offset;
+        uint32_t size;
+        uint32_t index;
+        bool whole_words;
+    };
+    size_t teddy_len;
+    uint8_t teddy_masks[3][2][16];
+    uint32_t bucket_offsets[9];
+    std::vector<TeddyPattern> bucket_patterns;
+    std::string teddy_data;
+
+    // Aho-Corasick automaton. Bytes are first mapped to equivalence classes
+    // (all bytes that do not occur in any pattern share class 0), to keep the
+    // transition table small. Transitions store the target state premultiplied
+    // by the number of classes, with the most significant bit set if the
+    // target state has outputs.
+    uint32_t byte_class[256];
+    size_t num_classes;
+    std::vector<uint32_t> transitions;
+    std::vector<uint32_t> output_offsets;
+    std::vector<uint32_t> outputs;
+
+    /**
+     * Builds the Teddy tables for the nonempty patterns.
+     */
+    void build_teddy();
+
+    /**
+     * Builds the Aho-Corasick automaton for the nonempty patterns.
+     */
+    void build_automaton();
+
+    /**
+     * Runs the single-pattern engine once for each nonempty pattern.
+     */
+    void count_single(const char *text, size_t size, size_t from, bool bof, bool eof, unsigned int *counts) const;
+
+    /**
+     * Runs the Teddy strategy.
+     */
+    void count_teddy(const char *text, size_t size, size_t from, bool bof, bool eof, unsigned int *counts) const;
+
+    /**
+     * Runs the Aho-Corasick strategy.
+     */
+    void count_automaton(const char *text, size_t size, size_t from, bool bof, bool eof, unsigned int *counts) const;
+
+public:
+
+    /**
+     * Maximum number of nonempty patterns for which each pattern is scanned
+     * for separately.
+     */
+    static const size_t SINGLE_MAX_PATTERNS = 4;
+
+    /**
+     * Maximum number of nonempty patterns for which the Teddy strategy is
+     * used.
+     */
+    static const size_t TEDDY_MAX_PATTERNS = 64;
+
+    /**
+     * Number of bytes at the start of each text over which the Teddy
+     * strategy estimates the cost of verifying its candidates. If that is
+     * more than the cost of scanning these bytes once for each pattern, the
+     * rest of the text is scanned once for each pattern instead.
+     */
+    static const size_t TEDDY_SAMPLE_SIZE = 4096;
+
+    /**
+     * Cost of rejecting a Teddy candidate pattern by its last byte, in bytes
+     * scanned by the single-pattern engine.
+     */
+    static const size_t TEDDY_CHECK_COST = 32;
+
+    /**
+     * Additional cost of a Teddy candidate pattern that passes the last-byte
+     * check and is compared in full, in bytes scanned by the single-pattern
+     * engine.
+     */
+    static const size_t TEDDY_HIT_COST = 384;
+
+    /**
+     * Constructs a multi-pattern match engine. `whole_words` must have the
+     * same size as `patterns`. If `isa` is not `AUTO` and not supported by the
+     * CPU, an exception is thrown.
+     */
+    MultiMatchEngine(const std::vector<std::string> &patterns, const std::vector<bool> &whole_words,
+        MatchEngineIsa isa = MatchEngineIsa::AUTO);
+
+    /**
+     * Adds the number of matches of each pattern in the given text to
+     * `counts`, which must have an entry for each pattern. Only matches that
+     * end at or after offset `from` are counted, so a caller scanning a text
+     * incrementally can include up to `max_size() - 1` bytes of context from
+     * the previous call without counting matches twice. `bof` and `eof` work
+     * as for MatchEngine::count(). `from` must be zero if there are empty
+     * patterns.
+     */
+    void count(const char *text, size_t size, size_t from, bool bof, bool eof, unsigned int *counts) const;
+
+    /**
+     * Returns the number of patterns.
+     */
+    inline size_t num_patterns() const {
+        return engines.size();
+    }
+
+    /**
+     * Returns the size of the largest pattern in bytes.
+     */
+    inline size_t max_size() const {
+        return max_pattern_size;
+    }
+
+    /**
+     * Returns whether any of the patterns is empty.
+     */
+    inline bool has_empty() const {
+        return any_empty;
+    }
+
+    /**
+     * Returns a printable name for the strategy used.
+     */
+    const char *strategy_name() const;
+
+};
@@ -0,0 +1,149 @@
+
+#include "placement.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <stdio.h>
+
+/**
+ * Constructs a planner for instances connected to the given memory
+ * banks, with the given capacity in bytes for each bank.
+ */
+ChunkPlacement::ChunkPlacement(const std::vector<int> &instance_banks, const std::vector<uint64_t> &bank_capacities)
+    : instance_banks(instance_banks), bank_capacities(bank_capacities),
+    instance_chunks(instance_banks.size()), instance_bytes(instance_banks.size()), instance_memory(instance_banks.size())
+{
+    if (instance_banks.empty()) {
+        throw std::runtime_error("cannot place chunks without kernel instances");
+    }
+    for (int bank : instance_banks) {
+        if (bank < 0 || (size_t)bank >= bank_capacities.size()) {
+            throw std::runtime_error("kernel instance connected to unknown bank " + std::to_string(bank));
+        }
+    }
+}
+
+/**
+ * Constructs a planner for the given number of instances without memory
+ * constraints.
+ */
+ChunkPlacement::ChunkPlacement(unsigned int num_instances)
+    : ChunkPlacement(std::vector<int>(num_instances, 0), std::vector<uint64_t>(1, UINT64_MAX))
+{}
+
+/**
+ * Places chunks with the given numbers of compressed text bytes and
+ * amounts of device memory, replacing any previous placement. Throws a
+ * `std::runtime_error` if a chunk does not fit in any bank.
+ */
+void ChunkPlacement::plan(const std::vector<uint64_t> &bytes, const std::vector<uint64_t> &memory) {
+    unsigned int num_inst = num_instances();
+    for (unsigned int i = 0; i < num_inst; i++) {
+        instance_chunks[i].clear();
+        instance_bytes[i] = 0;
+        instance_memory[i] = 0;
+    }
+    std::vector<uint64_t> bank_free = bank_capacities;
+    std::vector<uint64_t> bank_bytes(bank_capacities.size(), 0);
+
+    // Place the largest chunks first. Ties are broken by chunk index to keep
+    // the placement deterministic.
+    std::vector<unsigned int> order(bytes.size());
+    for (unsigned int i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&bytes](unsigned int a, unsigned int b) {
+        return bytes[a] > bytes[b];
+    });
+
+    for (unsigned int chunk : order) {
+
+        // Find the least loaded instance with room for the chunk in its bank.
+        // Among equally loaded instances, prefer the one whose bank has the
+        // least work, as the instances connected to a bank share its
+        // bandwidth, and then the one with the fewest chunks, as every kernel
+        // invocation has some fixed overhead.
+        unsigned int best = num_inst;
+        for (unsigned int i = 0; i < num_inst; i++) {
+            int bank = instance_banks[i];
+            if (bank_free[bank] < memory[chunk]) {
+                continue;
+            }
+            if (best == num_inst) {
+                best = i;
+                continue;
+            }
+            int best_bank = instance_banks[best];
+            if (instance_bytes[i] != instance_bytes[best]) {
+                if (instance_bytes[i] < instance_bytes[best]) best = i;
+            } else if (bank_bytes[bank] != bank_bytes[best_bank]) {
+                if (bank_bytes[bank] < bank_bytes[best_bank]) best = i;
+            } else if (instance_chunks[i].size() < instance_chunks[best].size()) {
+                best = i;
+            }
+        }
+        if (best == num_inst) {
+            throw std::runtime_error(
+                "chunk " + std::to_string(chunk) + " (" + std::to_string(memory[chunk])
+                + " bytes) does not fit in the remaining device memory");
+        }
+
+        instance_chunks[best].push_back(chunk);
+        instance_bytes[best] += bytes[chunk];
+        instance_memory[best] += memory[chunk];
+        bank_free[instance_banks[best]] -= memory[chunk];
+        bank_bytes[instance_banks[best]] += bytes[chunk];
+    }
+
+    for (auto &chunks : instance_chunks) {
+        std::sort(chunks.begin(), chunks.end());
+    }
+}
+
+/**
+ * Returns the number of instances.
+ */
+unsigned int ChunkPlacement::num_instances() const {
+    return instance_banks.size();
+}
+
+/**
+ * Returns the predicted makespan, i.e. the number of compressed text
+ * bytes of the most loaded instance.
+ */
+uint64_t ChunkPlacement::makespan() const {
+    return *std::max_element(instance_bytes.begin(), instance_bytes.end());
+}
+
+/**
+ * Returns the predicted load imbalance, defined like the `imbalance`
+ * result: the makespan divided by the mean number of bytes per instance.
+ */
+float ChunkPlacement::imbalance() const {
+    uint64_t total = 0;
+    for (uint64_t bytes : instance_bytes) {
+        total += bytes;
+    }
+    if (!total) {
+        return 1.0f;
+    }
+    return (float)((double)makespan() * num_instances() / total);
+}
+
+/**
+ * Returns a human-readable report of the placement, listing the number
+ * of chunks and bytes for each instance and the predicted makespan.
+ */
+std::string ChunkPlacement::report() const {
+    std::string report;
+    char buf[256];
+    for (unsigned int i = 0; i < num_instances(); i++) {
+        snprintf(buf, sizeof(buf), "  instance %2u (bank %d): %3zu chunks, %10.2f MiB compressed, %10.2f MiB device memory\n",
+            i, instance_banks[i], instance_chunks[i].size(),
+            instance_bytes[i] / (1024. * 1024.), instance_memory[i] / (1024. * 1024.));
+        report += buf;
+    }
+    snprintf(buf, sizeof(buf), "  predicted makespan: %.2f MiB compressed, imbalance %.3f\n",
+        makespan() / (1024. * 1024.), imbalance());
+    report += buf;
+    return report;
+}
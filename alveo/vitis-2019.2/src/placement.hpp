@@ -0,0 +1,81 @@
+#pragma once
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+
+/**
+ * Plans the placement of record batches (chunks) on kernel instances, such
+ * that the instance with the most work finishes as early as possible. The
+ * kernel throughput is bound by the decompressor, so the work for a chunk is
+ * modeled by its number of compressed text bytes. Chunks are placed using
+ * greedy longest-processing-time-first bin packing: the largest chunk goes to
+ * the least loaded instance first. Instances share the capacity and the
+ * bandwidth of the memory bank they are connected to, so ties are broken in
+ * favor of the least loaded bank. With multiple cards, each card's banks get
+ * their own numbers.
+ *
+ * This class does not depend on Arrow or OpenCL, so the `optimize` tool can
+ * use it to predict how evenly its output chunks will be placed.
+ */
+class ChunkPlacement {
+private:
+
+    // Memory bank of each instance and the capacity of each bank in bytes.
+    std::vector<int> instance_banks;
+    std::vector<uint64_t> bank_capacities;
+
+public:
+
+    // For each instance, the indices of the chunks placed on it in
+    // increasing order.
+    std::vector<std::vector<unsigned int>> instance_chunks;
+
+    // For each instance, the number of compressed text bytes and the amount
+    // of device memory of the chunks placed on it.
+    std::vector<uint64_t> instance_bytes;
+    std::vector<uint64_t> instance_memory;
+
+    /**
+     * Constructs a planner for instances connected to the given memory
+     * banks, with the given capacity in bytes for each bank.
+     */
+    ChunkPlacement(const std::vector<int> &instance_banks, const std::vector<uint64_t> &bank_capacities);
+
+    /**
+     * Constructs a planner for the given number of instances without memory
+     * constraints.
+     */
+    ChunkPlacement(unsigned int num_instances);
+
+    /**
+     * Places chunks with the given numbers of compressed text bytes and
+     * amounts of device memory, replacing any previous placement. Throws a
+     * `std::runtime_error` if a chunk does not fit in any bank.
+     */
+    void plan(const std::vector<uint64_t> &bytes, const std::vector<uint64_t> &memory);
+
+    /**
+     * Returns the number of instances.
+     */
+    unsigned int num_instances() const;
+
+    /**
+     * Returns the predicted makespan, i.e. the number of compressed text
+     * bytes of the most loaded instance.
+     */
+    uint64_t makespan() const;
+
+    /**
+     * Returns the predicted load imbalance, defined like the `imbalance`
+     * result: the makespan divided by the mean number of bytes per instance.
+     */
+    float imbalance() const;
+
+    /**
+     * Returns a human-readable report of the placement, listing the number
+     * of chunks and bytes for each instance and the predicted makespan.
+     */
+    std::string report() const;
+
+};
@@ -0,0 +1,128 @@
+#include "result_cache.hpp"
+
+/**
+ * Constructs an empty cache with the given memory budget in bytes. A
+ * budget of zero disables the cache.
+ */
+WordMatchResultCache::WordMatchResultCache(uint64_t capacity)
+    : capacity(capacity), size(0), hits(0), misses(0)
+{
+}
+
+/**
+ * Returns the cache key for the given configuration, run mode and
+ * dataset version.
+ */
+std::string WordMatchResultCache::make_key(const WordMatchConfig &config, int mode, uint64_t version) {
+    std::string key = std::to_string(version);
+    key += ":" + std::to_string(mode);
+    key += ":" + std::to_string(config.whole_words ? 1 : 0);
+    key += ":" + std::to_string(config.min_matches);
+    key += ":" + std::to_string(config.top_k);
+    key += ":" + std::to_string(config.complete_results);
+    key += ":" + config.pattern;
+    return key;
+}
+
+/**
+ * Returns the approximate amount of memory used by the given results in
+ * bytes.
+ */
+uint64_t WordMatchResultCache::results_size(const WordMatchResultsContainer &results) {
+    uint64_t size = sizeof(results);
+    size += results.cpp_partial_results.capacity() * sizeof(WordMatchPartialResultsContainer);
+    size += results.cpp_partial_result_ptrs.capacity() * sizeof(WordMatchPartialResults*);
+    size += results.cpp_top_page_counts.capacity() * sizeof(unsigned int);
+    size += results.cpp_top_page_title_offsets.capacity() * sizeof(unsigned int);
+    size += results.cpp_top_page_title_values.capacity();
+    for (auto &presults : results.cpp_partial_results) {
+        size += presults.cpp_page_match_counts.capacity() * sizeof(unsigned int);
+        size += presults.cpp_page_match_title_offsets.capacity() * sizeof(unsigned int);
+        size += presults.cpp_page_match_title_values.capacity();
+        size += presults.cpp_max_page_title.capacity();
+        size += presults.cpp_page_match_positions.capacity() * sizeof(uint64_t);
+        size += presults.cpp_top_pages.capacity() * sizeof(WordMatchTopPage);
+        for (auto &page : presults.cpp_top_pages) {
+            size += page.title.capacity();
+        }
+    }
+    return size;
+}
+
+/**
+ * Evicts the least recently used entries until the cache fits within its
+ * budget.
+ */
+void WordMatchResultCache::evict() {
+    while (size > capacity && !entries.empty()) {
+        auto &entry = entries.back();
+        size -= entry.size;
+        lookup.erase(entry.key);
+        entries.pop_back();
+    }
+}
+
+/**
+ * Looks up the results for the given key, marking them as most recently
+ * used and counting a hit or miss. Returns null on a miss. The returned
+ * results remain valid until the cache is next modified.
+ */
+const WordMatchResultsContainer *WordMatchResultCache::get(const std::string &key) {
+    auto it = lookup.find(key);
+    if (it == lookup.end()) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    entries.splice(entries.begin(), entries, it->second);
+    return &it->second->results;
+}
+
+/**
+ * Stores a copy of the given results under the given key, evicting the
+ * least recently used results as needed. Results that do not fit in the
+ * budget by themselves are not stored.
+ */
+void WordMatchResultCache::put(const std::string &key, const WordMatchResultsContainer &results) {
+    uint64_t entry_size = results_size(results) + key.capacity();
+    if (entry_size > capacity) {
+        return;
+    }
+
+    // Replace any existing entry for this key.
+    auto it = lookup.find(key);
+    if (it != lookup.end()) {
+        size -= it->second->size;
+        entries.erase(it->second);
+        lookup.erase(it);
+    }
+
+    // Insert the new entry.
+    entries.emplace_front();
+    auto &entry = entries.front();
+    entry.key = key;
+    entry.results.assign(results);
+    entry.results.cached = true;
+    entry.results.coalesced = false;
+    entry.size = entry_size;
+    lookup[key] = entries.begin();
+    size += entry_size;
+    evict();
+}
+
+/**
+ * Removes all results from the cache. The counters are retained.
+ */
+void WordMatchResultCache::clear() {
+    entries.clear();
+    lookup.clear();
+    size = 0;
+}
+
+/**
+ * Changes the memory budget, evicting results as needed.
+ */
+void WordMatchResultCache::set_capacity(uint64_t capacity) {
+    this->capacity = capacity;
+    evict();
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "word_match.hpp"
+#include <inttypes.h>
+#include <string>
+#include <list>
+#include <unordered_map>
+
+/**
+ * Least-recently-used cache for query results, limited by the approximate
+ * amount of memory used by the cached results. Results are keyed on the
+ * query configuration, the run mode, and the version of the dataset they were
+ * computed for.
+ */
+class WordMatchResultCache {
+private:
+
+    /**
+     * A cached result set.
+     */
+    class Entry {
+    public:
+        std::string key;
+        WordMatchResultsContainer results;
+        uint64_t size;
+    };
+
+    // Entries ordered from most to least recently used, and an index into
+    // this list by key.
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> lookup;
+
+    // Memory budget and current usage in bytes.
+    uint64_t capacity;
+    uint64_t size;
+
+    // Hit and miss counters.
+    uint64_t hits;
+    uint64_t misses;
+
+    /**
+     * Evicts the least recently used entries until the cache fits within its
+     * budget.
+     */
+    void evict();
+
+public:
+
+    /**
+     * Constructs an empty cache with the given memory budget in bytes. A
+     * budget of zero disables the cache.
+     */
+    WordMatchResultCache(uint64_t capacity = 0);
+
+    /**
+     * Returns the cache key for the given configuration, run mode and
+     * dataset version.
+     */
+    static std::string make_key(const WordMatchConfig &config, int mode, uint64_t version);
+
+    /**
+     * Returns the approximate amount of memory used by the given results in
+     * bytes.
+     */
+    static uint64_t results_size(const WordMatchResultsContainer &results);
+
+    /**
+     * Looks up the results for the given key, marking them as most recently
+     * used and counting a hit or miss. Returns null on a miss. The returned
+     * results remain valid until the cache is next modified.
+     */
+    const WordMatchResultsContainer *get(const std::string &key);
+
+    /**
+     * Stores a copy of the given results under the given key, evicting the
+     * least recently used results as needed. Results that do not fit in the
+     * budget by themselves are not stored.
+     */
+    void put(const std::string &key, const WordMatchResultsContainer &results);
+
+    /**
+     * Removes all results from the cache. The counters are retained.
+     */
+    void clear();
+
+    /**
+     * Changes the memory budget, evicting results as needed.
+     */
+    void set_capacity(uint64_t capacity);
+
+    /**
+     * Returns the number of cached result sets.
+     */
+    inline size_t get_num_entries() const {
+        return entries.size();
+    }
+
+    /**
+     * Returns the approximate amount of memory used by the cached results.
+     */
+    inline uint64_t get_size() const {
+        return size;
+    }
+
+    /**
+     * Returns the memory budget in bytes.
+     */
+    inline uint64_t get_capacity() const {
+        return capacity;
+    }
+
+    /**
+     * Returns the number of lookups that found cached results.
+     */
+    inline uint64_t get_hits() const {
+        return hits;
+    }
+
+    /**
+     * Returns the number of lookups that did not find cached results.
+     */
+    inline uint64_t get_misses() const {
+        return misses;
+    }
+
+};
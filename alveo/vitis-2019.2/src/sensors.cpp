@@ -0,0 +1,322 @@
+#include "sensors.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <fstream>
+#include <regex>
+
+/**
+ * Starts sampling the cards with the given device indices every
+ * `interval_ms` milliseconds, keeping the most recent `capacity` samples
+ * of each card. The first samples are taken before the constructor
+ * returns.
+ */
+SensorSampler::SensorSampler(
+    const std::vector<unsigned int> &device_indices,
+    unsigned int interval_ms,
+    unsigned int capacity,
+    Source source
+) : capacity(std::max(capacity, 1u)), interval_ms(std::max(interval_ms, 1u)), source(source), stopping(false) {
+    for (unsigned int index : device_indices) {
+        rings.emplace_back(new Ring());
+        auto &ring = *rings.back();
+        ring.device_index = index;
+        ring.slots.reset(new Slot[this->capacity]);
+        for (unsigned int i = 0; i < this->capacity; i++) {
+            ring.slots[i].seq.store(0, std::memory_order_relaxed);
+        }
+        ring.count.store(0, std::memory_order_relaxed);
+    }
+    sample_all();
+    thread = std::thread(&SensorSampler::run, this);
+}
+
+/**
+ * Stops the sampler thread.
+ */
+SensorSampler::~SensorSampler() {
+    {
+        std::lock_guard<std::mutex> lock(stop_mutex);
+        stopping = true;
+    }
+    stop_cv.notify_all();
+    thread.join();
+}
+
+/**
+ * Returns the current time on the clock used for the sample times.
+ */
+uint64_t SensorSampler::now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Takes a sample of each card.
+ */
+void SensorSampler::sample_all() {
+    for (auto &ring : rings) {
+
+        // Failing reads (for instance because xbutil is not available) are
+        // skipped, such that the readers see the last good sample.
+        try {
+            XBUtilDumpInfo info;
+            source(info, ring->device_index);
+            SensorSample sample;
+            sample.time = now();
+            sample.fpga_temp = info.fpga_temp;
+            sample.power_in = info.power_in;
+            sample.power_vccint = info.power_vccint;
+            push(*ring, sample);
+        } catch (const std::exception&) {
+        }
+
+    }
+}
+
+/**
+ * Body of the sampler thread.
+ */
+void SensorSampler::run() {
+    auto next = std::chrono::steady_clock::now();
+    while (true) {
+
+        // Sleep until the next sample is due, without accumulating drift,
+        // unless we're asked to stop.
+        next += std::chrono::milliseconds(interval_ms);
+        auto now = std::chrono::steady_clock::now();
+        if (next < now) {
+            next = now;
+        }
+        {
+            std::unique_lock<std::mutex> lock(stop_mutex);
+            if (stop_cv.wait_until(lock, next, [this] { return stopping; })) {
+                return;
+            }
+        }
+
+        sample_all();
+    }
+}
+
+/**
+ * Appends a sample to the given ring. Only called by the sampler thread.
+ */
+void SensorSampler::push(Ring &ring, const SensorSample &sample) {
+    uint64_t n = ring.count.load(std::memory_order_relaxed);
+    auto &slot = ring.slots[n % capacity];
+
+    // Mark the slot as being written (odd sequence number) before touching
+    // the values, and as holding sample `n` after.
+    slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.time.store(sample.time, std::memory_order_relaxed);
+    slot.fpga_temp.store(sample.fpga_temp, std::memory_order_relaxed);
+    slot.power_in.store(sample.power_in, std::memory_order_relaxed);
+    slot.power_vccint.store(sample.power_vccint, std::memory_order_relaxed);
+    slot.seq.store(2 * n + 2, std::memory_order_release);
+    ring.count.store(n + 1, std::memory_order_release);
+}
+
+/**
+ * Copies the `age`th most recent sample of the given ring, where 0 is
+ * the most recent one. Returns false if there is no such sample anymore.
+ */
+bool SensorSampler::read(const Ring &ring, uint64_t age, SensorSample &sample) const {
+    uint64_t count = ring.count.load(std::memory_order_acquire);
+    if (age >= count || age >= capacity) {
+        return false;
+    }
+    uint64_t n = count - 1 - age;
+    auto &slot = ring.slots[n % capacity];
+    uint64_t seq = slot.seq.load(std::memory_order_acquire);
+    if (seq != 2 * n + 2) {
+        return false;
+    }
+    sample.time = slot.time.load(std::memory_order_relaxed);
+    sample.fpga_temp = slot.fpga_temp.load(std::memory_order_relaxed);
+    sample.power_in = slot.power_in.load(std::memory_order_relaxed);
+    sample.power_vccint = slot.power_vccint.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.seq.load(std::memory_order_relaxed) == seq;
+}
+
+/**
+ * Copies the most recent sample of the given card. Returns false if
+ * there is none yet.
+ */
+bool SensorSampler::latest(unsigned int card, SensorSample &sample) const {
+    if (card >= rings.size()) {
+        throw std::runtime_error("card " + std::to_string(card) + " is not being sampled");
+    }
+    return read(*rings[card], 0, sample);
+}
+
+/**
+ * Computes the statistics of the samples of the given card taken within
+ * the last `window_us` microseconds, or only of the most recent one if
+ * the window is 0. Returns the number of samples that were included.
+ */
+unsigned int SensorSampler::stats(unsigned int card, uint64_t window_us, SensorStats &stats) const {
+    stats = SensorStats();
+    if (!latest(card, stats.latest)) {
+        return 0;
+    }
+    stats.num_samples = 1;
+    stats.min = stats.latest;
+    stats.max = stats.latest;
+    double temp = stats.latest.fpga_temp;
+    double power_in = stats.latest.power_in;
+    double power_vccint = stats.latest.power_vccint;
+
+    // Walk back from the most recent sample until we leave the window or
+    // run into a sample that has been overwritten in the meantime.
+    uint64_t end = now();
+    SensorSample sample;
+    for (uint64_t age = 1; window_us && read(*rings[card], age, sample); age++) {
+        if (end - sample.time > window_us) {
+            break;
+        }
+        stats.num_samples++;
+        stats.min.fpga_temp = std::min(stats.min.fpga_temp, sample.fpga_temp);
+        stats.min.power_in = std::min(stats.min.power_in, sample.power_in);
+        stats.min.power_vccint = std::min(stats.min.power_vccint, sample.power_vccint);
+        stats.max.fpga_temp = std::max(stats.max.fpga_temp, sample.fpga_temp);
+        stats.max.power_in = std::max(stats.max.power_in, sample.power_in);
+        stats.max.power_vccint = std::max(stats.max.power_vccint, sample.power_vccint);
+        stats.min.time = sample.time;
+        stats.max.time = sample.time;
+        temp += sample.fpga_temp;
+        power_in += sample.power_in;
+        power_vccint += sample.power_vccint;
+    }
+    stats.avg.time = stats.min.time;
+    stats.avg.fpga_temp = temp / stats.num_samples;
+    stats.avg.power_in = power_in / stats.num_samples;
+    stats.avg.power_vccint = power_vccint / stats.num_samples;
+    return stats.num_samples;
+}
+
+/**
+ * Integrates the input power of the given card from time `from` up to
+ * `to` (in microseconds on the sample clock), interpolating linearly
+ * between the samples and holding the first and last sample beyond
+ * them. Returns the energy in joules, or a negative value if there are
+ * no samples or the samples around `from` have been overwritten.
+ */
+double SensorSampler::energy(unsigned int card, uint64_t from, uint64_t to) const {
+    if (card >= rings.size()) {
+        throw std::runtime_error("card " + std::to_string(card) + " is not being sampled");
+    }
+
+    // Gather the samples from the last one taken at or before `from` up to
+    // the most recent one, oldest first.
+    std::vector<SensorSample> samples;
+    SensorSample sample;
+    bool complete = false;
+    for (uint64_t age = 0; read(*rings[card], age, sample); age++) {
+        samples.push_back(sample);
+        if (sample.time <= from) {
+            complete = true;
+            break;
+        }
+    }
+    if (samples.empty()) {
+        return -1.0;
+    }
+    if (!complete && rings[card]->count.load(std::memory_order_acquire) > samples.size()) {
+        return -1.0;
+    }
+    std::reverse(samples.begin(), samples.end());
+    if (to <= from) {
+        return 0.0;
+    }
+
+    // Returns the interpolated power at time `t`.
+    auto power = [&samples](uint64_t t) -> double {
+        if (t <= samples.front().time) {
+            return samples.front().power_in;
+        }
+        for (size_t i = 1; i < samples.size(); i++) {
+            if (t <= samples[i].time) {
+                auto &a = samples[i - 1];
+                auto &b = samples[i];
+                double f = (double)(t - a.time) / (b.time - a.time);
+                return a.power_in + f * (b.power_in - a.power_in);
+            }
+        }
+        return samples.back().power_in;
+    };
+
+    // The interpolated power is linear between the sample times, so the
+    // trapezoidal rule over the sample times within the window is exact.
+    std::vector<uint64_t> times(1, from);
+    for (auto &s : samples) {
+        if (s.time > from && s.time < to) {
+            times.push_back(s.time);
+        }
+    }
+    times.push_back(to);
+    double joules = 0.0;
+    for (size_t i = 1; i < times.size(); i++) {
+        joules += 0.5 * (power(times[i - 1]) + power(times[i])) * (times[i] - times[i - 1]) * 0.000001;
+    }
+    return joules;
+}
+
+/**
+ * Reads an unsigned integer from the given file, returning whether this
+ * succeeded.
+ */
+static bool read_counter(const std::string &filename, uint64_t &value) {
+    std::ifstream file(filename);
+    return (bool)(file >> value);
+}
+
+/**
+ * Looks for the package domains. If there are none, or they cannot be
+ * read (they are only readable by root on recent kernels), the meter is
+ * not available.
+ */
+RaplMeter::RaplMeter() {
+
+    // The package domains are the top-level zones. Their subzones have a
+    // second colon in their name and are skipped, as the energy of the cores
+    // and the uncore is already part of the package energy.
+    std::regex package(".*/intel-rapl:[0-9]+");
+    for (auto &path : glob(sysfs_root() + "/class/powercap/intel-rapl:*")) {
+        if (!std::regex_match(path, package)) {
+            continue;
+        }
+        uint64_t value, range;
+        if (!read_counter(path + "/energy_uj", value) || !read_counter(path + "/max_energy_range_uj", range)) {
+            continue;
+        }
+        counters.push_back(path + "/energy_uj");
+        ranges.push_back(range);
+    }
+}
+
+/**
+ * Reads the current values of the energy counters.
+ */
+std::vector<uint64_t> RaplMeter::read() const {
+    std::vector<uint64_t> values(counters.size(), 0);
+    for (size_t i = 0; i < counters.size(); i++) {
+        read_counter(counters[i], values[i]);
+    }
+    return values;
+}
+
+/**
+ * Returns the energy in joules used by all packages between the two
+ * given readings, accounting for counters wrapping around.
+ */
+double RaplMeter::energy(const std::vector<uint64_t> &before, const std::vector<uint64_t> &after) const {
+    double joules = 0.0;
+    for (size_t i = 0; i < counters.size() && i < before.size() && i < after.size(); i++) {
+        uint64_t delta = after[i] >= before[i] ? after[i] - before[i] : after[i] + ranges[i] - before[i];
+        joules += delta * 0.000001;
+    }
+    return joules;
+}
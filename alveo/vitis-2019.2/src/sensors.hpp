@@ -0,0 +1,226 @@
+#pragma once
+
+#include "xbutil.hpp"
+#include <inttypes.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * A single sensor reading of a card.
+ */
+class SensorSample {
+public:
+
+    // Time at which the sample was taken, in microseconds on the steady
+    // clock.
+    uint64_t time;
+
+    // FPGA temperature, 12V input power and VccINT rail power.
+    float fpga_temp;
+    float power_in;
+    float power_vccint;
+};
+
+/**
+ * Minimum, mean and maximum of the samples of a card within a window, along
+ * with the most recent sample. The times of the minimum, mean and maximum
+ * are those of the oldest sample in the window.
+ */
+class SensorStats {
+public:
+    unsigned int num_samples;
+    SensorSample latest;
+    SensorSample min;
+    SensorSample avg;
+    SensorSample max;
+};
+
+/**
+ * Samples the sensors of a number of cards at a fixed interval on a
+ * background thread, such that the health of the cards can be queried
+ * without blocking on `xbutil`. The samples of each card are kept in a
+ * fixed-size ring buffer with a single writer (the sampler thread) and any
+ * number of lock-free readers; each slot carries a sequence number that
+ * readers check before and after copying a sample, seqlock-style, to detect
+ * that it was overwritten while they were reading it.
+ */
+class SensorSampler {
+public:
+
+    /**
+     * Function used to read the sensors of the card with the given device
+     * index. `xbutil_dump()` by default; tests can substitute a fake.
+     */
+    typedef void (*Source)(XBUtilDumpInfo &info, unsigned int index);
+
+private:
+
+    /**
+     * A ring buffer slot. All fields are atomic, such that readers racing
+     * with the writer are well-defined; the sequence number tells them
+     * whether the values they read belong together.
+     */
+    class Slot {
+    public:
+        std::atomic<uint64_t> seq;
+        std::atomic<uint64_t> time;
+        std::atomic<float> fpga_temp;
+        std::atomic<float> power_in;
+        std::atomic<float> power_vccint;
+    };
+
+    /**
+     * Ring buffer of the samples of a single card.
+     */
+    class Ring {
+    public:
+        unsigned int device_index;
+        std::unique_ptr<Slot[]> slots;
+
+        // Number of samples written so far. Sample `n` is stored in slot
+        // `n % capacity`.
+        std::atomic<uint64_t> count;
+    };
+
+    std::vector<std::unique_ptr<Ring>> rings;
+    const unsigned int capacity;
+    const unsigned int interval_ms;
+    const Source source;
+
+    // Used to wake up the sampler thread when stopping.
+    std::mutex stop_mutex;
+    std::condition_variable stop_cv;
+    bool stopping;
+    std::thread thread;
+
+    /**
+     * Takes a sample of each card.
+     */
+    void sample_all();
+
+    /**
+     * Body of the sampler thread.
+     */
+    void run();
+
+    /**
+     * Appends a sample to the given ring. Only called by the sampler thread.
+     */
+    void push(Ring &ring, const SensorSample &sample);
+
+    /**
+     * Copies the `age`th most recent sample of the given ring, where 0 is
+     * the most recent one. Returns false if there is no such sample anymore.
+     */
+    bool read(const Ring &ring, uint64_t age, SensorSample &sample) const;
+
+public:
+
+    SensorSampler(const SensorSampler&) = delete;
+
+    /**
+     * Starts sampling the cards with the given device indices every
+     * `interval_ms` milliseconds, keeping the most recent `capacity` samples
+     * of each card. The first samples are taken before the constructor
+     * returns.
+     */
+    SensorSampler(
+        const std::vector<unsigned int> &device_indices,
+        unsigned int interval_ms,
+        unsigned int capacity = 1024,
+        Source source = xbutil_dump);
+
+    /**
+     * Stops the sampler thread.
+     */
+    ~SensorSampler();
+
+    /**
+     * Returns the number of cards being sampled.
+     */
+    inline unsigned int num_cards() const {
+        return rings.size();
+    }
+
+    /**
+     * Returns the sampling interval in milliseconds.
+     */
+    inline unsigned int get_interval() const {
+        return interval_ms;
+    }
+
+    /**
+     * Returns the current time on the clock used for the sample times.
+     */
+    static uint64_t now();
+
+    /**
+     * Copies the most recent sample of the given card. Returns false if
+     * there is none yet.
+     */
+    bool latest(unsigned int card, SensorSample &sample) const;
+
+    /**
+     * Computes the statistics of the samples of the given card taken within
+     * the last `window_us` microseconds, or only of the most recent one if
+     * the window is 0. Returns the number of samples that were included.
+     */
+    unsigned int stats(unsigned int card, uint64_t window_us, SensorStats &stats) const;
+
+    /**
+     * Integrates the input power of the given card from time `from` up to
+     * `to` (in microseconds on the sample clock), interpolating linearly
+     * between the samples and holding the first and last sample beyond
+     * them. Returns the energy in joules, or a negative value if there are
+     * no samples or the samples around `from` have been overwritten.
+     */
+    double energy(unsigned int card, uint64_t from, uint64_t to) const;
+
+};
+
+/**
+ * Reads the package energy counters of the CPUs exposed by the Linux
+ * powercap framework (RAPL) under `<sysfs root>/class/powercap`, to measure
+ * the energy used by software runs.
+ */
+class RaplMeter {
+private:
+
+    // The energy counter file of each package domain and the value at which
+    // it wraps around, in microjoules.
+    std::vector<std::string> counters;
+    std::vector<uint64_t> ranges;
+
+public:
+
+    /**
+     * Looks for the package domains. If there are none, or they cannot be
+     * read (they are only readable by root on recent kernels), the meter is
+     * not available.
+     */
+    RaplMeter();
+
+    /**
+     * Returns whether any package energy counters were found.
+     */
+    inline bool available() const {
+        return !counters.empty();
+    }
+
+    /**
+     * Reads the current values of the energy counters.
+     */
+    std::vector<uint64_t> read() const;
+
+    /**
+     * Returns the energy in joules used by all packages between the two
+     * given readings, accounting for counters wrapping around.
+     */
+    double energy(const std::vector<uint64_t> &before, const std::vector<uint64_t> &after) const;
+
+};
@@ -0,0 +1,217 @@
+#include "snappy_stream.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
+const size_t SnappyMatchStream::BLOCK_SIZE;
+const size_t SnappyMatchStream::SLIDE_SIZE;
+const size_t SnappyMatchStream::MAX_OFFSET;
+
+/**
+ * Constructs a streaming matcher for the given engine, which must not
+ * have empty patterns.
+ */
+SnappyMatchStream::SnappyMatchStream(const MultiMatchEngine &engine)
+    : engine(engine)
+{
+    if (engine.has_empty()) {
+        throw std::runtime_error("streaming matcher needs nonempty patterns");
+    }
+    history = std::max(MAX_OFFSET, engine.max_size() + 1);
+
+    // Between two slides, the window grows by at most SLIDE_SIZE bytes plus
+    // almost a block before the flush threshold triggers, plus one element of
+    // at most a block in size.
+    window.resize(history + SLIDE_SIZE + 2 * BLOCK_SIZE);
+}
+
+/**
+ * Counts the matches in the data decompressed since the previous flush.
+ * Unless `final` is set, the last byte is held back, as it is needed as
+ * context for the whole-word check. Returns true when a null character was
+ * encountered, which terminates the article.
+ */
+bool SnappyMatchStream::flush(bool final) {
+    size_t end = out;
+    if (!final) {
+        if (out <= flushed + 1) {
+            return false;
+        }
+        end--;
+    }
+
+    // Stop at the first null character, like strlen() would.
+    bool stop = false;
+    const char *nul = (const char*)memchr(window.data() + flushed, 0, end - flushed);
+    if (nul) {
+        end = nul - window.data();
+        final = true;
+        stop = true;
+    }
+
+    // Include the last pattern-size minus one bytes of the previous block, so
+    // matches that straddle the boundary are found.
+    size_t overlap = engine.max_size() - 1;
+    size_t start = (flushed > overlap) ? flushed - overlap : 0;
+    if (end > flushed) {
+        engine.count(window.data() + start, end - start, flushed - start, base + start == 0, final, counts);
+    }
+    flushed = end;
+    return stop;
+}
+
+/**
+ * Discards all but the last `history` bytes of the window.
+ */
+void SnappyMatchStream::slide() {
+    size_t discard = out - history;
+    memmove(window.data(), window.data() + discard, history);
+    base += discard;
+    flushed -= discard;
+    out = history;
+}
+
+/**
+ * Decompresses the given article and writes the number of matches of each
+ * pattern in it to `counts`. Like the materializing path, matching stops
+ * at the first null character. Returns false if the data contains
+ * back-references that reach beyond the window, which the reference
+ * compressor never produces; the caller must then fall back to
+ * decompressing the article as a whole. Throws on corrupt data.
+ */
+bool SnappyMatchStream::count(const char *data, size_t size, unsigned int *counts_out) {
+    const uint8_t *ip = (const uint8_t*)data;
+    const uint8_t *ip_end = ip + size;
+
+    base = 0;
+    out = 0;
+    flushed = 0;
+    counts = counts_out;
+    for (size_t i = 0; i < engine.num_patterns(); i++) {
+        counts[i] = 0;
+    }
+
+    // Read the uncompressed length varint.
+    uint64_t expected = 0;
+    for (int shift = 0;; shift += 7) {
+        if (ip >= ip_end || shift > 28) {
+            throw std::runtime_error("snappy decompression error");
+        }
+        uint8_t c = *ip++;
+        expected |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            break;
+        }
+    }
+
+    // Decode the elements.
+    char *w = window.data();
+    while (ip < ip_end) {
+        uint8_t tag = *ip++;
+        size_t len;
+        size_t offset;
+        switch (tag & 3) {
+
+            case 0:
+                // Literal; the length is stored in the tag or in up to four
+                // subsequent bytes.
+                len = tag >> 2;
+                if (len >= 60) {
+                    size_t num_bytes = len - 59;
+                    if ((size_t)(ip_end - ip) < num_bytes) {
+                        throw std::runtime_error("snappy decompression error");
+                    }
+                    len = 0;
+                    for (size_t i = 0; i < num_bytes; i++) {
+                        len |= (size_t)ip[i] << (8 * i);
+                    }
+                    ip += num_bytes;
+                }
+                len++;
+                if ((size_t)(ip_end - ip) < len) {
+                    throw std::runtime_error("snappy decompression error");
+                }
+
+                // Copy large literals one block at a time.
+                while (len) {
+                    size_t n = std::min(len, BLOCK_SIZE);
+                    memcpy(w + out, ip, n);
+                    out += n;
+                    ip += n;
+                    len -= n;
+                    if (out - flushed >= BLOCK_SIZE) {
+                        if (flush(false)) {
+                            return true;
+                        }
+                        if (out > history + SLIDE_SIZE) {
+                            slide();
+                        }
+                    }
+                }
+                continue;
+
+            case 1:
+                // Copy with 1-byte offset.
+                if (ip_end - ip < 1) {
+                    throw std::runtime_error("snappy decompression error");
+                }
+                len = 4 + ((tag >> 2) & 7);
+                offset = ((size_t)(tag >> 5) << 8) | ip[0];
+                ip += 1;
+                break;
+
+            case 2:
+                // Copy with 2-byte offset.
+                if (ip_end - ip < 2) {
+                    throw std::runtime_error("snappy decompression error");
+                }
+                len = 1 + (tag >> 2);
+                offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+                ip += 2;
+                break;
+
+            default:
+                // Copy with 4-byte offset.
+                if (ip_end - ip < 4) {
+                    throw std::runtime_error("snappy decompression error");
+                }
+                len = 1 + (tag >> 2);
+                offset = (size_t)ip[0] | ((size_t)ip[1] << 8) | ((size_t)ip[2] << 16) | ((size_t)ip[3] << 24);
+                ip += 4;
+                break;
+
+        }
+
+        // Perform the copy.
+        if (offset == 0 || offset > base + out) {
+            throw std::runtime_error("snappy decompression error");
+        }
+        if (offset > out) {
+            return false;
+        }
+        char *dst = w + out;
+        const char *src = dst - offset;
+        if (offset >= len) {
+            memcpy(dst, src, len);
+        } else {
+            for (size_t i = 0; i < len; i++) {
+                dst[i] = src[i];
+            }
+        }
+        out += len;
+        if (out - flushed >= BLOCK_SIZE) {
+            if (flush(false)) {
+                return true;
+            }
+            if (out > history + SLIDE_SIZE) {
+                slide();
+            }
+        }
+    }
+
+    if (base + out != expected) {
+        throw std::runtime_error("snappy decompression error");
+    }
+    flush(true);
+    return true;
+}
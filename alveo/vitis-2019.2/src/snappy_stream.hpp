@@ -0,0 +1,87 @@
+#pragma once
+
+#include "match_engine.hpp"
+#include <inttypes.h>
+#include <vector>
+
+/**
+ * Decompresses raw Snappy data into a small sliding window and runs the match
+ * engine over each block of decompressed data as soon as it is produced. The
+ * last bytes of each block, one less than the size of the longest pattern,
+ * are carried over to the next, so matches that straddle a block boundary
+ * are counted exactly once. Since the engine may match multiple patterns,
+ * one decompression pass serves all of them. Unlike decompressing into a
+ * string first, the working set stays in L1/L2 no matter how large the
+ * article is, and the decompressed data is only touched while it is still in
+ * cache.
+ */
+class SnappyMatchStream {
+private:
+    const MultiMatchEngine &engine;
+
+    // Sliding window containing the most recently decompressed data.
+    std::vector<char> window;
+
+    // Number of bytes retained in the window when it slides. This is at least
+    // the maximum back-reference distance used by the reference compressor.
+    size_t history;
+
+    // Absolute article offset of the first byte in the window.
+    uint64_t base;
+
+    // Number of valid bytes in the window.
+    size_t out;
+
+    // Window offset up to which candidate match positions have been counted.
+    size_t flushed;
+
+    // Match counters for the current article, one for each pattern.
+    unsigned int *counts;
+
+    /**
+     * Counts the matches in the data decompressed since the previous flush.
+     * Unless `final` is set, the last byte is held back, as it is needed as
+     * context for the whole-word check. Returns true when a null character was
+     * encountered, which terminates the article.
+     */
+    bool flush(bool final);
+
+    /**
+     * Discards all but the last `history` bytes of the window.
+     */
+    void slide();
+
+public:
+
+    /**
+     * Granularity with which decompressed data is matched.
+     */
+    static const size_t BLOCK_SIZE = 16384;
+
+    /**
+     * Amount of data the window can grow beyond the history before it slides.
+     */
+    static const size_t SLIDE_SIZE = 65536;
+
+    /**
+     * Maximum back-reference distance of the reference Snappy compressor.
+     */
+    static const size_t MAX_OFFSET = 65536;
+
+    /**
+     * Constructs a streaming matcher for the given engine, which must not
+     * have empty patterns.
+     */
+    SnappyMatchStream(const MultiMatchEngine &engine);
+
+    /**
+     * Decompresses the given article and writes the number of matches of each
+     * pattern in it to `counts`. Like the materializing path, matching stops
+     * at the first null character. Returns false if the data contains
+     * back-references that reach beyond the window, which the reference
+     * compressor never produces; the caller must then fall back to
+     * decompressing the article as a whole. Throws on corrupt data.
+     */
+    bool count(const char *data, size_t size, unsigned int *counts);
+
+};
@@ -1,15 +1,21 @@
 
 #include "software.hpp"
+#include "match_engine.hpp"
+#include "snappy_stream.hpp"
 #include <snappy.h>
 #include <omp.h>
 #include <chrono>
+#include <algorithm>
 #include <string.h>
-#include <ctype.h>
+
+const int SoftwareWordMatch::BLOCKS_PER_THREAD;
 
 /**
  * Constructs the software word matcher.
  */
-SoftwareWordMatch::SoftwareWordMatch() {
+SoftwareWordMatch::SoftwareWordMatch(bool streaming, bool work_stealing)
+    : chunk_rows(1, 0), chunk_bytes(1, 0), streaming(streaming), work_stealing(work_stealing)
+{
 }
 
 /**
@@ -17,167 +23,505 @@ SoftwareWordMatch::SoftwareWordMatch() {
  */
 void SoftwareWordMatch::clear_chunks() {
     chunks.clear();
+    chunk_rows.assign(1, 0);
+    chunk_bytes.assign(1, 0);
+    partitions.clear();
+    if (index) {
+        index->clear();
+    }
 }
 
 /**
  * Adds the given chunk to the dataset stored in device memory.
  */
 void SoftwareWordMatch::add_chunk(const std::shared_ptr<arrow::RecordBatch> &batch) {
-    chunks.push_back(batch);
+    auto titles = std::dynamic_pointer_cast<arrow::StringArray, arrow::Array>(batch->column(0));
+    auto data = std::dynamic_pointer_cast<arrow::BinaryArray, arrow::Array>(batch->column(1));
+    if (!titles || !data) {
+        throw std::runtime_error("unexpected column types in record batch");
+    }
+    if (titles->length() != data->length()) {
+        throw std::runtime_error("unexpected chunking");
+    }
+
+    // Record the raw buffer pointers. The offsets pointers already take the
+    // array offset into account. The batch is kept around to keep the
+    // buffers alive.
+    SoftwareWordMatchDataChunk chunk;
+    chunk.batch = batch;
+    chunk.title_offsets = titles->raw_value_offsets();
+    chunk.title_values = (const char*)titles->value_data()->data();
+    chunk.text_offsets = data->raw_value_offsets();
+    chunk.text_values = (const char*)data->value_data()->data();
+    chunk.num_rows = data->length();
+    chunks.push_back(chunk);
+
+    chunk_rows.push_back(chunk_rows.back() + chunk.num_rows);
+    chunk_bytes.push_back(chunk_bytes.back()
+        + chunk.text_offsets[chunk.num_rows] - chunk.text_offsets[0] + 4 * chunk.num_rows);
+    partitions.clear();
+    if (index) {
+        index->add_articles(chunk.text_offsets, chunk.text_values, chunk.num_rows);
+    }
 }
 
 /**
- * Runs the kernel with the given configuration.
+ * Enables or disables the trigram index. When enabled, the index is built
+ * for the chunks that were already added, and maintained by `add_chunk()`
+ * from then on.
  */
-void SoftwareWordMatch::execute(const WordMatchConfig &config,
-    void (*progress)(void *user, const char *status), void *progress_user
-) {
+void SoftwareWordMatch::set_indexing(bool enable) {
+    if (!enable) {
+        index.reset();
+    } else if (!index) {
+        index.reset(new TrigramIndex());
+        for (auto &chunk : chunks) {
+            index->add_articles(chunk.text_offsets, chunk.text_values, chunk.num_rows);
+        }
+    }
+}
 
-    // Get a Table representation of the data.
-    std::shared_ptr<arrow::Table> table;
-    arrow::Result<std::shared_ptr<arrow::Table>> result = arrow::Table::FromRecordBatches(chunks);
-    if (result.ok()) {
-	table = result.ValueOrDie();
-    } else {
-        throw std::runtime_error("Table::FromRecordBatches failed: " + result.status().ToString());
+/**
+ * Returns the number of text bytes preceding the given global row index.
+ */
+int64_t SoftwareWordMatch::bytes_before(int64_t row) const {
+    size_t ci = std::upper_bound(chunk_rows.begin(), chunk_rows.end(), row) - chunk_rows.begin() - 1;
+    if (ci >= chunks.size()) {
+        return chunk_bytes.back();
     }
+    const auto &chunk = chunks[ci];
+    int64_t local = row - chunk_rows[ci];
+    return chunk_bytes[ci] + chunk.text_offsets[local] - chunk.text_offsets[0] + 4 * local;
+}
 
-    // Make sure we have enough presults result records and clear them.
-    results.cpp_partial_results.resize(omp_get_max_threads());
-    for (auto &presults : results.cpp_partial_results) {
-        presults.num_word_matches = 0;
-        presults.num_page_matches = 0;
-        presults.cpp_page_match_counts.clear();
-        presults.cpp_page_match_title_offsets.clear();
-        presults.cpp_page_match_title_values.clear();
-        presults.cpp_page_match_title_offsets.push_back(0);
-        presults.max_word_matches = 0;
-        presults.cpp_max_page_title.clear();
-        presults.cycle_count = 0;
-        presults.clock_frequency = 0;
-        presults.data_size = 0;
-        presults.time_taken = 0;
+/**
+ * Returns the row boundaries that divide the dataset into the given number
+ * of parts with approximately the same number of text bytes each. The
+ * returned vector has parts + 1 entries. The boundaries are computed only
+ * once for each number of parts until the dataset is modified. This may
+ * be called from multiple threads at once.
+ */
+const std::vector<int64_t> &SoftwareWordMatch::partition(int64_t parts) {
+    std::lock_guard<std::mutex> lock(partitions_mutex);
+    auto it = partitions.find(parts);
+    if (it != partitions.end()) {
+        return it->second;
     }
+    auto &bounds = partitions[parts];
+    bounds.resize(parts + 1);
+    for (int64_t part = 0; part <= parts; part++) {
+
+        // Find the first row that starts at or after the ideal boundary. Every
+        // row counts for at least four bytes, so the last boundary is always
+        // the total number of rows.
+        int64_t target = chunk_bytes.back() * part / parts;
+        int64_t lo = 0;
+        int64_t hi = chunk_rows.back();
+        while (lo < hi) {
+            int64_t mid = lo + (hi - lo) / 2;
+            if (bytes_before(mid) < target) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        bounds[part] = lo;
+
+    }
+    return bounds;
+}
+
+/**
+ * Matches the articles in the given range of global row indices against all
+ * patterns, accumulating the results in the partial results with index `tid`
+ * of each of the given result containers. If `rows` is not null, the range
+ * instead refers to entries of this sorted list of row indices, and only
+ * those rows are processed. `counts` is scratch space with an entry for each
+ * pattern. If `control` is not null, the range counts as one chunk for the
+ * progress counters, and processing stops early when the query is cancelled.
+ */
+void SoftwareWordMatch::process(int64_t stai, int64_t stoi, const std::vector<uint32_t> *rows,
+    const std::vector<WordMatchConfig> &configs, const MultiMatchEngine &engine,
+    SnappyMatchStream *stream, std::string &article_text, unsigned int *counts,
+    const std::vector<WordMatchResultsContainer*> &outputs, int tid, WordMatchControl *control) const
+{
+    if (control && control->cancelled) {
+        return;
+    }
+    if (stai >= stoi) {
+        if (control) {
+            control->chunks_done++;
+        }
+        return;
+    }
+
+    // Bytes scanned since the progress counters were last updated. They are
+    // only updated every `CONTROL_INTERVAL` articles, to keep the shared
+    // counters out of the inner loop.
+    unsigned long long scanned = 0;
+
+    // Find the chunk containing the first row.
+    int64_t first_row = rows ? (*rows)[stai] : stai;
+    size_t ci = std::upper_bound(chunk_rows.begin(), chunk_rows.end(), first_row) - chunk_rows.begin() - 1;
+
+    for (int64_t i = stai; i < stoi; i++) {
+        if (control && i > stai && (i - stai) % CONTROL_INTERVAL == 0) {
+            control->bytes_scanned += scanned;
+            scanned = 0;
+            if (control->cancelled) {
+                return;
+            }
+        }
+        int64_t row = rows ? (*rows)[i] : i;
+        while (chunk_rows[ci + 1] <= row) {
+            ci++;
+        }
+        const auto &chunk = chunks[ci];
+        int64_t ii = row - chunk_rows[ci];
+
+        // Get the article data pointer and size.
+        const char *article_data_ptr = chunk.text_values + chunk.text_offsets[ii];
+        int32_t article_data_size = chunk.text_offsets[ii + 1] - chunk.text_offsets[ii];
+
+        // In streaming mode, decompress and match at the same time. This
+        // falls back to the code below for the (non-reference) Snappy
+        // streams that refer back further than the window.
+        if (!stream || !stream->count(article_data_ptr, article_data_size, counts)) {
+
+            // Perform Snappy decompression.
+            size_t uncompressed_length;
+            if (!snappy::GetUncompressedLength(article_data_ptr, article_data_size, &uncompressed_length)) {
+                throw std::runtime_error("snappy decompression error");
+            }
+            article_text.resize(uncompressed_length);
+            if (!snappy::RawUncompress(article_data_ptr, article_data_size, &article_text[0])) {
+                throw std::runtime_error("snappy decompression error");
+            }
+
+            // Perform matching. Matching stops at the first null
+            // character, if any.
+            for (size_t pi = 0; pi < configs.size(); pi++) {
+                counts[pi] = 0;
+            }
+            engine.count(article_text.c_str(), strlen(article_text.c_str()), 0, true, true, counts);
+
+        }
+
+        // Record the results. Only the positions of the pages are recorded;
+        // the titles are looked up afterwards for the pages that are actually
+        // returned.
+        scanned += article_data_size + 4;
+        for (size_t pi = 0; pi < configs.size(); pi++) {
+            auto &presults = outputs[pi]->cpp_partial_results[tid];
+            unsigned int num_matches = counts[pi];
+            presults.data_size += article_data_size + 4;
+            presults.num_word_matches += num_matches;
+            if (num_matches >= configs[pi].min_matches) {
+                presults.num_page_matches++;
+                if (presults.cpp_page_match_counts.size() < 256 || configs[pi].complete_results >= 2) {
+                    presults.cpp_page_match_counts.push_back(num_matches);
+                    presults.cpp_page_match_positions.push_back(row);
+                }
+                if (presults.ranks_top(configs[pi].top_k, num_matches, row)) {
+                    presults.add_top_page(configs[pi].top_k, num_matches, row);
+                }
+            }
+            if (num_matches >= presults.max_word_matches) {
+                presults.max_word_matches = num_matches;
+                presults.max_page_position = row;
+            }
+        }
+    }
+    if (control) {
+        control->bytes_scanned += scanned;
+        control->chunks_done++;
+    }
+}
+
+/**
+ * Appends the title of the article with the given global row index to
+ * `title`.
+ */
+void SoftwareWordMatch::append_title(int64_t row, std::string &title) const {
+    size_t ci = std::upper_bound(chunk_rows.begin(), chunk_rows.end(), row) - chunk_rows.begin() - 1;
+    const auto &chunk = chunks[ci];
+    int64_t ii = row - chunk_rows[ci];
+    title.append(
+        chunk.title_values + chunk.title_offsets[ii],
+        chunk.title_offsets[ii + 1] - chunk.title_offsets[ii]);
+}
+
+/**
+ * Looks up the titles of the pages recorded by `process()` that are part
+ * of the final results: the page match records, the pages with the most
+ * matches, and the pages that make it into the overall top-K ranking.
+ * Partial top pages that do not make it into the ranking are dropped.
+ */
+void SoftwareWordMatch::materialize(WordMatchResultsContainer &output) const {
+    for (auto &presults : output.cpp_partial_results) {
+        for (auto position : presults.cpp_page_match_positions) {
+            append_title(position, presults.cpp_page_match_title_values);
+            presults.cpp_page_match_title_offsets.push_back(
+                presults.cpp_page_match_title_values.size());
+        }
+        if (presults.max_page_position != WordMatchPartialResultsContainer::NO_POSITION) {
+            append_title(presults.max_page_position, presults.cpp_max_page_title);
+        }
+    }
+
+    // Find the lowest ranked page of the overall top-K ranking, and drop the
+    // partial top pages that rank below it.
+    std::vector<WordMatchTopPage> ranking;
+    for (auto &presults : output.cpp_partial_results) {
+        for (auto &page : presults.cpp_top_pages) {
+            ranking.push_back(WordMatchTopPage{page.count, page.position, ""});
+        }
+    }
+    if (ranking.size() > output.cpp_top_k) {
+        auto last = ranking.begin() + output.cpp_top_k - 1;
+        std::nth_element(ranking.begin(), last, ranking.end(), WordMatchTopPage::ranks_before);
+        for (auto &presults : output.cpp_partial_results) {
+            auto &pages = presults.cpp_top_pages;
+            pages.erase(std::remove_if(pages.begin(), pages.end(), [&last](const WordMatchTopPage &page) {
+                return WordMatchTopPage::ranks_before(*last, page);
+            }), pages.end());
+        }
+    }
+    for (auto &presults : output.cpp_partial_results) {
+        for (auto &page : presults.cpp_top_pages) {
+            append_title(page.position, page.title);
+        }
+    }
+}
+
+/**
+ * Runs the given configurations with a single pass over the dataset,
+ * writing the results for each configuration to the respective container.
+ * If `control` is not null, it receives the progress of the run, and a
+ * `WordMatchCancelled` is thrown if the run is cancelled.
+ */
+void SoftwareWordMatch::run(const std::vector<WordMatchConfig> &configs,
+    const std::vector<WordMatchResultsContainer*> &outputs,
+    void (*progress)(void *user, const char *status), void *progress_user,
+    WordMatchControl *control
+) {
 
     // Start measuring execution time.
     auto start = std::chrono::high_resolution_clock::now();
+
+    // Make sure we have enough presults result records and clear them.
+    for (auto output : outputs) {
+        output->cpp_partial_results.resize(omp_get_max_threads());
+        for (auto &presults : output->cpp_partial_results) {
+            presults.num_word_matches = 0;
+            presults.num_page_matches = 0;
+            presults.cpp_page_match_counts.clear();
+            presults.cpp_page_match_title_offsets.clear();
+            presults.cpp_page_match_title_values.clear();
+            presults.cpp_page_match_title_offsets.push_back(0);
+            presults.cpp_page_match_positions.clear();
+            presults.max_word_matches = 0;
+            presults.max_page_position = WordMatchPartialResultsContainer::NO_POSITION;
+            presults.cpp_max_page_title.clear();
+            presults.cpp_top_pages.clear();
+            presults.cycle_count = 0;
+            presults.clock_frequency = 0;
+            presults.subkernel_imbalance = 1.0f;
+            presults.data_size = 0;
+            presults.time_taken = 0;
+            presults.queue_time = 0;
+            presults.submit_time = 0;
+            presults.kernel_time = 0;
+            presults.readback_time = 0;
+            presults.cpp_trace_events.clear();
+        }
+    }
+
+    // Construct the matcher for the patterns. The streaming matcher needs at
+    // least one pattern character to carry over between blocks.
+    std::vector<std::string> patterns;
+    std::vector<bool> whole_words;
+    for (auto &config : configs) {
+        patterns.push_back(config.pattern);
+        whole_words.push_back(config.whole_words);
+    }
+    MultiMatchEngine engine(patterns, whole_words);
+    bool use_stream = streaming && !engine.has_empty();
+
+    // Use the trigram index to find the articles that may match, if
+    // possible. With a minimum of zero matches every article is a page
+    // match, so the index cannot be used to skip any.
+    bool all_need_match = true;
+    for (auto &config : configs) {
+        if (!config.min_matches) {
+            all_need_match = false;
+        }
+    }
+    std::vector<uint32_t> candidates;
+    bool use_index = index && all_need_match && index->candidates(patterns, candidates);
+    if (control) {
+        control->check();
+    }
+
     if (progress) {
         std::string msg = "Running on CPU...";
         progress(progress_user, msg.c_str());
     }
 
+    // Row boundaries of the parts or blocks, determined by the first thread
+    // once the actual number of threads is known.
+    const std::vector<int64_t> *bounds = nullptr;
+    int num_threads = 0;
+    auto first_byte = std::chrono::high_resolution_clock::time_point::max();
+
     #pragma omp parallel
     {
-        // Determine what our slice of the table and result record is.
         int tcnt = omp_get_num_threads();
         int tid = omp_get_thread_num();
-        auto &presults = results.cpp_partial_results[tid];
-        int64_t stai = (table->num_rows() * tid) / tcnt;
-        int64_t stoi = (table->num_rows() * (tid + 1)) / tcnt;
-        auto slice = table->Slice(stai, stoi - stai);
-        auto title_chunks = slice->column(0);
-        auto data_chunks = slice->column(1);
-
-        // Data buffer for the uncompressed article text.
-        std::string article_text;
-
-        // Iterate over the chunks in our slice of the table.
-        if (title_chunks->num_chunks() != data_chunks->num_chunks()) {
-            throw std::runtime_error("unexpected chunking");
-        }
-        for (int ci = 0; ci < title_chunks->num_chunks(); ci++) {
-            auto titles = std::dynamic_pointer_cast<arrow::StringArray, arrow::Array>(title_chunks->chunk(ci));
-            auto data = std::dynamic_pointer_cast<arrow::BinaryArray, arrow::Array>(data_chunks->chunk(ci));
-            if (titles->length() != data->length()) {
-                throw std::runtime_error("unexpected chunking");
+        #pragma omp single
+        {
+            num_threads = tcnt;
+            if (!use_index) {
+                bounds = &partition(work_stealing ? (int64_t)tcnt * BLOCKS_PER_THREAD : tcnt);
             }
-            unsigned int max_page_cnt = 0;
-            unsigned int max_page_idx = 0;
-            for (unsigned int ii = 0; ii < titles->length(); ii++) {
-
-                // Get the article data pointer and size from Arrow.
-                int32_t article_data_size;
-                const char *article_data_ptr = (const char*)data->GetValue(ii, &article_data_size);
-                presults.data_size += article_data_size + 4;
-
-                // Perform Snappy decompression.
-                size_t uncompressed_length;
-                if (!snappy::GetUncompressedLength(article_data_ptr, article_data_size, &uncompressed_length)) {
-                    throw std::runtime_error("snappy decompression error");
-                }
-                article_text.resize(uncompressed_length);
-                if (!snappy::RawUncompress(article_data_ptr, article_data_size, &article_text[0])) {
-                    throw std::runtime_error("snappy decompression error");
-                }
-
-                // Perform matching.
-                unsigned int num_matches = 0;
-                const char *ptr = article_text.c_str();
-                const char *end = ptr + strlen(ptr);
-                if (config.whole_words) {
-                    int patsize = config.pattern.size();
-                    bool first = true;
-                    ptr--;
-                    for (; ptr < end - patsize; ptr++, first = false) {
-                        if (strncmp(ptr+1, config.pattern.c_str(), patsize)) {
-                            continue;
-                        }
-                        if (!first && (isalnum(*ptr) || *ptr == '_')) {
-                            continue;
-                        }
-                        if (ptr+1+patsize < end && (isalnum(*(ptr+1+patsize)) || *(ptr+1+patsize) == '_')) {
-                            continue;
-                        }
-                        num_matches++;
-                    }
-                } else {
-                    while (ptr < end) {
-                        ptr = strstr(ptr, config.pattern.c_str());
-                        if (ptr) {
-                            ptr++;
-                            num_matches++;
-                        } else {
-                            break;
-                        }
-                    }
-                }
-
-                presults.num_word_matches += num_matches;
-                if (num_matches >= config.min_matches) {
-                    presults.num_page_matches++;
-                    if (presults.cpp_page_match_counts.size() < 256) {
-                        presults.cpp_page_match_counts.push_back(num_matches);
-                        presults.cpp_page_match_title_values += titles->GetString(ii);
-                        presults.cpp_page_match_title_offsets.push_back(
-                            presults.cpp_page_match_title_values.size());
+            if (control) {
+                unsigned long long bytes = chunk_bytes.back();
+                if (use_index) {
+                    bytes = 0;
+                    for (auto row : candidates) {
+                        bytes += bytes_before(row + 1) - bytes_before(row);
                     }
                 }
-                if (num_matches >= max_page_cnt) {
-                    max_page_cnt = num_matches;
-                    max_page_idx = ii;
-                }
+                control->start(use_index ? tcnt * BLOCKS_PER_THREAD : bounds->size() - 1, bytes);
             }
+        }
+
+        // Data buffer for the uncompressed article text, the sliding window
+        // decompressor used in streaming mode, and the match counters.
+        std::string article_text;
+        std::unique_ptr<SnappyMatchStream> stream;
+        if (use_stream) {
+            stream.reset(new SnappyMatchStream(engine));
+        }
+        std::vector<unsigned int> counts(configs.size());
 
-            // Load the title of the page with the most matches.
-            if (max_page_cnt >= presults.max_word_matches) {
-                presults.max_word_matches = max_page_cnt;
-                presults.cpp_max_page_title = titles->GetString(max_page_idx);
+        // Record when the first thread starts matching.
+        auto thread_start = std::chrono::high_resolution_clock::now();
+        #pragma omp critical
+        {
+            first_byte = std::min(first_byte, thread_start);
+        }
+
+        // Process either blocks of candidate articles, our statically
+        // assigned part of the table, or blocks of articles from the shared
+        // queue until there are none left. Candidate articles are spread
+        // irregularly over the table, so they are always scheduled
+        // dynamically.
+        if (use_index) {
+            int64_t num_candidates = candidates.size();
+            int64_t num_blocks = (int64_t)tcnt * BLOCKS_PER_THREAD;
+            #pragma omp for schedule(dynamic, 1) nowait
+            for (int64_t bi = 0; bi < num_blocks; bi++) {
+                process(num_candidates * bi / num_blocks, num_candidates * (bi + 1) / num_blocks,
+                    &candidates, configs, engine, stream.get(), article_text, counts.data(), outputs, tid, control);
+            }
+        } else if (work_stealing) {
+            int64_t num_blocks = bounds->size() - 1;
+            #pragma omp for schedule(dynamic, 1) nowait
+            for (int64_t bi = 0; bi < num_blocks; bi++) {
+                process((*bounds)[bi], (*bounds)[bi + 1], nullptr, configs, engine,
+                    stream.get(), article_text, counts.data(), outputs, tid, control);
             }
+        } else {
+            process((*bounds)[tid], (*bounds)[tid + 1], nullptr, configs, engine,
+                stream.get(), article_text, counts.data(), outputs, tid, control);
         }
+
+        // Record how long this thread was busy, to expose load imbalance.
+        auto thread_elapsed = std::chrono::high_resolution_clock::now() - start;
+        for (auto output : outputs) {
+            output->cpp_partial_results[tid].time_taken =
+                std::chrono::duration_cast<std::chrono::microseconds>(thread_elapsed).count();
+        }
+    }
+
+    // The threads stop early when the run is cancelled, leaving the results
+    // incomplete.
+    if (control) {
+        control->check();
     }
 
     // Finish measuring execution time.
     auto elapsed = std::chrono::high_resolution_clock::now() - start;
-    results.time_taken = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
     if (progress) {
         std::string msg = "Running on CPU... done";
         progress(progress_user, msg.c_str());
     }
 
-    // Synchronize all the results.
-    for (auto &presults : results.cpp_partial_results) {
-        presults.synchronize();
+    for (size_t pi = 0; pi < outputs.size(); pi++) {
+        auto output = outputs[pi];
+        output->time_taken = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        output->startup_time = std::chrono::duration_cast<std::chrono::microseconds>(first_byte - start).count();
+        if (use_index) {
+            output->scan_fraction = chunk_rows.back() ? (float)candidates.size() / chunk_rows.back() : 0.0f;
+        } else {
+            output->scan_fraction = 1.0f;
+        }
+
+        // Every page was considered for the top pages, so the merged ranking
+        // is exact.
+        output->cpp_top_k = configs[pi].top_k;
+        output->top_pages_exact = true;
+
+        // Drop the records of threads that did not take part, if dynamic
+        // scheduling gave us fewer threads than the maximum.
+        output->cpp_partial_results.resize(num_threads);
+        materialize(*output);
+
+        // Synchronize all the results.
+        for (auto &presults : output->cpp_partial_results) {
+            presults.synchronize();
+        }
+        output->synchronize();
+    }
+
+}
+
+/**
+ * Runs the kernel with the given configuration.
+ */
+void SoftwareWordMatch::execute(const WordMatchConfig &config,
+    void (*progress)(void *user, const char *status), void *progress_user
+) {
+    run({config}, {&results}, progress, progress_user);
+}
+
+/**
+ * Runs the kernel for each of the given configurations, decompressing each
+ * article only once for all of them.
+ */
+void SoftwareWordMatch::execute_batch(const std::vector<WordMatchConfig> &configs,
+    void (*progress)(void *user, const char *status), void *progress_user
+) {
+    batch_results.resize(configs.size());
+    std::vector<WordMatchResultsContainer*> outputs;
+    for (auto &bresults : batch_results) {
+        outputs.push_back(&bresults);
     }
-    results.synchronize();
+    run(configs, outputs, progress, progress_user);
+}
 
+/**
+ * Runs the kernel with the given configuration, writing the results to
+ * the given container instead of `this->results`. Unlike `execute()`,
+ * this may be called from multiple threads at once, as long as the
+ * dataset and the settings are not modified in the meantime. The OpenMP
+ * settings of the calling thread determine the number of threads used. If
+ * `control` is not null, it receives the progress of the run, and a
+ * `WordMatchCancelled` is thrown if the run is cancelled.
+ */
+void SoftwareWordMatch::execute_into(const WordMatchConfig &config, WordMatchResultsContainer &output,
+    void (*progress)(void *user, const char *status), void *progress_user, WordMatchControl *control
+) {
+    run({config}, {&output}, progress, progress_user, control);
 }
@@ -1,26 +1,143 @@
 #pragma once
 
 #include "word_match.hpp"
+#include "match_engine.hpp"
+#include "snappy_stream.hpp"
+#include "trigram_index.hpp"
 #include <inttypes.h>
 #include <string>
 #include <memory>
+#include <map>
+#include <mutex>
 #include <arrow/api.h>
 
+/**
+ * Class used internally by SoftwareWordMatch to keep track of the raw buffer
+ * pointers for a given record batch, such that queries can scan the data
+ * without constructing any Arrow objects.
+ */
+class SoftwareWordMatchDataChunk {
+public:
+    std::shared_ptr<arrow::RecordBatch> batch;
+    const int32_t *title_offsets;
+    const char *title_values;
+    const int32_t *text_offsets;
+    const char *text_values;
+    int64_t num_rows;
+};
+
 /**
  * Software implementation of the word matcher kernel.
  */
 class SoftwareWordMatch : public WordMatch {
 private:
-    std::vector<std::shared_ptr<arrow::RecordBatch>> chunks;
+    std::vector<SoftwareWordMatchDataChunk> chunks;
+
+    // Cumulative number of rows and number of text bytes preceding each
+    // chunk, with an additional entry for the totals. The byte counts include
+    // four bytes per row for the offset buffer, like the data_size result.
+    std::vector<int64_t> chunk_rows;
+    std::vector<int64_t> chunk_bytes;
+
+    // Row boundaries for each number of parts that the dataset has been
+    // divided into since it was last modified, guarded by a mutex because
+    // queries may run concurrently.
+    std::map<int64_t, std::vector<int64_t>> partitions;
+    std::mutex partitions_mutex;
+
+    // Trigram index, if enabled.
+    std::unique_ptr<TrigramIndex> index;
+
+    /**
+     * Returns the number of text bytes preceding the given global row index.
+     */
+    int64_t bytes_before(int64_t row) const;
+
+    /**
+     * Returns the row boundaries that divide the dataset into the given number
+     * of parts with approximately the same number of text bytes each. The
+     * returned vector has parts + 1 entries. The boundaries are computed only
+     * once for each number of parts until the dataset is modified. This may
+     * be called from multiple threads at once.
+     */
+    const std::vector<int64_t> &partition(int64_t parts);
+
+    /**
+     * Matches the articles in the given range of global row indices against all
+     * patterns, accumulating the results in the partial results with index `tid`
+     * of each of the given result containers. If `rows` is not null, the range
+     * instead refers to entries of this sorted list of row indices, and only
+     * those rows are processed. `counts` is scratch space with an entry for each
+     * pattern. Pages are recorded by position only; `materialize()` looks up
+     * their titles afterwards. If `control` is not null, the range counts as
+     * one chunk for the progress counters, and processing stops early when
+     * the query is cancelled.
+     */
+    void process(int64_t stai, int64_t stoi, const std::vector<uint32_t> *rows,
+        const std::vector<WordMatchConfig> &configs, const MultiMatchEngine &engine,
+        SnappyMatchStream *stream, std::string &article_text, unsigned int *counts,
+        const std::vector<WordMatchResultsContainer*> &outputs, int tid,
+        WordMatchControl *control = nullptr) const;
+
+    /**
+     * Appends the title of the article with the given global row index to
+     * `title`.
+     */
+    void append_title(int64_t row, std::string &title) const;
+
+    /**
+     * Looks up the titles of the pages recorded by `process()` that are part
+     * of the final results: the page match records, the pages with the most
+     * matches, and the pages that make it into the overall top-K ranking.
+     * Partial top pages that do not make it into the ranking are dropped.
+     */
+    void materialize(WordMatchResultsContainer &output) const;
+
+    /**
+     * Runs the given configurations with a single pass over the dataset,
+     * writing the results for each configuration to the respective container.
+     * If `control` is not null, it receives the progress of the run, and a
+     * `WordMatchCancelled` is thrown if the run is cancelled.
+     */
+    void run(const std::vector<WordMatchConfig> &configs,
+        const std::vector<WordMatchResultsContainer*> &outputs,
+        void (*progress)(void *user, const char *status), void *progress_user,
+        WordMatchControl *control = nullptr);
 
 public:
 
+    /**
+     * Number of article blocks per thread that the dataset is divided into
+     * when work stealing is enabled.
+     */
+    static const int BLOCKS_PER_THREAD = 16;
+
+    /**
+     * Number of articles after which a thread updates the progress counters
+     * and checks whether the query was cancelled, if it is being controlled.
+     */
+    static const int CONTROL_INTERVAL = 256;
+
+    /**
+     * Whether articles are decompressed into a small sliding window and
+     * matched while they are being decompressed, rather than decompressed as
+     * a whole before matching.
+     */
+    bool streaming;
+
+    /**
+     * Whether threads dynamically take blocks of articles from a shared queue
+     * until all blocks are processed, rather than each processing one
+     * statically assigned, byte-balanced part of the dataset.
+     */
+    bool work_stealing;
+
     virtual ~SoftwareWordMatch() = default;
 
     /**
      * Constructs the software word matcher.
      */
-    SoftwareWordMatch();
+    SoftwareWordMatch(bool streaming = false, bool work_stealing = false);
 
     /**
      * Resets the dataset stored in device memory.
@@ -32,10 +149,44 @@ public:
      */
     virtual void add_chunk(const std::shared_ptr<arrow::RecordBatch> &batch);
 
+    /**
+     * Enables or disables the trigram index. When enabled, the index is built
+     * for the chunks that were already added, and maintained by `add_chunk()`
+     * from then on.
+     */
+    void set_indexing(bool enable);
+
+    /**
+     * Returns the trigram index, or null if it is disabled.
+     */
+    inline const TrigramIndex *get_index() const {
+        return index.get();
+    }
+
     /**
      * Runs the kernel with the given configuration.
      */
     virtual void execute(const WordMatchConfig &config,
         void (*progress)(void *user, const char *status), void *progress_user);
 
+    /**
+     * Runs the kernel for each of the given configurations, decompressing each
+     * article only once for all of them.
+     */
+    virtual void execute_batch(const std::vector<WordMatchConfig> &configs,
+        void (*progress)(void *user, const char *status), void *progress_user);
+
+    /**
+     * Runs the kernel with the given configuration, writing the results to
+     * the given container instead of `this->results`. Unlike `execute()`,
+     * this may be called from multiple threads at once, as long as the
+     * dataset and the settings are not modified in the meantime. The OpenMP
+     * settings of the calling thread determine the number of threads used. If
+     * `control` is not null, it receives the progress of the run, and a
+     * `WordMatchCancelled` is thrown if the run is cancelled.
+     */
+    void execute_into(const WordMatchConfig &config, WordMatchResultsContainer &output,
+        void (*progress)(void *user, const char *status), void *progress_user,
+        WordMatchControl *control = nullptr);
+
 };
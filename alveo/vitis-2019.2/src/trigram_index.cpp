@@ -0,0 +1,235 @@
+#include "trigram_index.hpp"
+#include <snappy.h>
+#include <omp.h>
+#include <algorithm>
+#include <iterator>
+#include <chrono>
+#include <stdexcept>
+#include <string.h>
+
+/**
+ * Appends the given article index, which must be greater than the
+ * previous one.
+ */
+void TrigramIndex::Posting::append(uint32_t article) {
+    uint32_t delta = count ? article - last - 1 : article;
+    while (delta >= 0x80) {
+        data.push_back((delta & 0x7F) | 0x80);
+        delta >>= 7;
+    }
+    data.push_back(delta);
+    last = article;
+    count++;
+}
+
+/**
+ * Decodes the article indices into `articles`.
+ */
+void TrigramIndex::Posting::decode(std::vector<uint32_t> &articles) const {
+    articles.resize(count);
+    const uint8_t *ptr = data.data();
+    uint32_t article = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t delta = 0;
+        for (int shift = 0;; shift += 7) {
+            uint8_t c = *ptr++;
+            delta |= (uint32_t)(c & 0x7F) << shift;
+            if (!(c & 0x80)) {
+                break;
+            }
+        }
+        article = i ? article + 1 + delta : delta;
+        articles[i] = article;
+    }
+}
+
+/**
+ * Constructs an empty index.
+ */
+TrigramIndex::TrigramIndex() : num_articles(0), build_time(0), max_candidate_fraction(0.5) {
+}
+
+/**
+ * Removes all articles from the index.
+ */
+void TrigramIndex::clear() {
+    postings.clear();
+    num_articles = 0;
+    build_time = 0;
+}
+
+/**
+ * Adds the Snappy-compressed articles described by the given Arrow binary
+ * array offsets and values buffers to the index. The articles are numbered
+ * consecutively, continuing from the previously added articles.
+ */
+void TrigramIndex::add_articles(const int32_t *offsets, const char *values, int64_t num_rows) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Process the articles in blocks, to bound the memory needed for the
+    // intermediate (trigram, article) pairs.
+    const int64_t BLOCK_SIZE = 4096;
+    std::vector<std::vector<uint64_t>> keys(omp_get_max_threads());
+    for (int64_t first = 0; first < num_rows; first += BLOCK_SIZE) {
+        int64_t last = std::min(first + BLOCK_SIZE, num_rows);
+        bool error = false;
+
+        #pragma omp parallel
+        {
+            auto &thread_keys = keys[omp_get_thread_num()];
+            thread_keys.clear();
+            std::string article_text;
+            std::vector<uint32_t> trigrams;
+
+            // Static scheduling gives each thread a contiguous range of
+            // articles, in thread order. Decompression errors are combined
+            // over the threads by the reduction.
+            #pragma omp for schedule(static) reduction(||:error)
+            for (int64_t row = first; row < last; row++) {
+
+                // Decompress the article. Like the matcher, only consider the
+                // text up to the first null character.
+                const char *data = values + offsets[row];
+                size_t size = offsets[row + 1] - offsets[row];
+                size_t uncompressed_length;
+                if (!snappy::GetUncompressedLength(data, size, &uncompressed_length)) {
+                    error = true;
+                    continue;
+                }
+                article_text.resize(uncompressed_length);
+                if (!snappy::RawUncompress(data, size, &article_text[0])) {
+                    error = true;
+                    continue;
+                }
+                size_t length = strlen(article_text.c_str());
+
+                // Collect the distinct trigrams.
+                trigrams.clear();
+                const uint8_t *text = (const uint8_t*)article_text.data();
+                for (size_t i = 0; i + 3 <= length; i++) {
+                    trigrams.push_back((uint32_t)text[i] << 16 | (uint32_t)text[i + 1] << 8 | text[i + 2]);
+                }
+                std::sort(trigrams.begin(), trigrams.end());
+                trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+                uint32_t article = num_articles + row;
+                for (uint32_t trigram : trigrams) {
+                    thread_keys.push_back((uint64_t)trigram << 32 | article);
+                }
+
+            }
+            std::sort(thread_keys.begin(), thread_keys.end());
+        }
+
+        if (error) {
+            throw std::runtime_error("snappy decompression error");
+        }
+
+        // Append to the posting lists. Since the threads processed
+        // consecutive ranges of articles, doing this thread by thread keeps
+        // the lists sorted.
+        for (auto &thread_keys : keys) {
+            Posting *posting = nullptr;
+            uint32_t current = 0;
+            for (uint64_t key : thread_keys) {
+                uint32_t trigram = key >> 32;
+                if (!posting || trigram != current) {
+                    posting = &postings[trigram];
+                    current = trigram;
+                }
+                posting->append((uint32_t)key);
+            }
+            thread_keys.clear();
+        }
+
+    }
+    num_articles += num_rows;
+
+    auto elapsed = std::chrono::high_resolution_clock::now() - start;
+    build_time += std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+/**
+ * Writes the candidate articles for a single pattern to `articles`.
+ * Returns false if the index cannot narrow down the candidates for this
+ * pattern.
+ */
+bool TrigramIndex::pattern_candidates(const std::string &pattern, std::vector<uint32_t> &articles) const {
+    if (pattern.size() < 3) {
+        return false;
+    }
+
+    // Look up the posting lists for all distinct trigrams in the pattern. If
+    // any trigram does not occur at all, neither does the pattern.
+    std::vector<const Posting*> lists;
+    const uint8_t *pat = (const uint8_t*)pattern.data();
+    for (size_t i = 0; i + 3 <= pattern.size(); i++) {
+        uint32_t trigram = (uint32_t)pat[i] << 16 | (uint32_t)pat[i + 1] << 8 | pat[i + 2];
+        auto it = postings.find(trigram);
+        if (it == postings.end()) {
+            articles.clear();
+            return true;
+        }
+        if (std::find(lists.begin(), lists.end(), &it->second) == lists.end()) {
+            lists.push_back(&it->second);
+        }
+    }
+
+    // Intersect the lists, starting with the shortest. Lists that are much
+    // longer than the current candidate set are not worth decoding; skipping
+    // them only leaves some false positives.
+    std::sort(lists.begin(), lists.end(), [](const Posting *a, const Posting *b) {
+        return a->count < b->count;
+    });
+    if (lists[0]->count > max_candidate_fraction * num_articles) {
+        return false;
+    }
+    lists[0]->decode(articles);
+    std::vector<uint32_t> other;
+    std::vector<uint32_t> intersection;
+    for (size_t li = 1; li < lists.size() && !articles.empty(); li++) {
+        if (lists[li]->count > 32 * articles.size()) {
+            break;
+        }
+        lists[li]->decode(other);
+        intersection.clear();
+        std::set_intersection(articles.begin(), articles.end(), other.begin(), other.end(),
+            std::back_inserter(intersection));
+        articles.swap(intersection);
+    }
+    return true;
+}
+
+/**
+ * Writes the sorted indices of the articles that may contain any of the
+ * given patterns to `articles`. Returns false if the index cannot narrow
+ * down the candidates, in which case all articles must be scanned.
+ */
+bool TrigramIndex::candidates(const std::vector<std::string> &patterns, std::vector<uint32_t> &articles) const {
+    articles.clear();
+    std::vector<uint32_t> pattern_articles;
+    std::vector<uint32_t> merged;
+    for (auto &pattern : patterns) {
+        if (!pattern_candidates(pattern, pattern_articles)) {
+            return false;
+        }
+        merged.clear();
+        std::set_union(articles.begin(), articles.end(), pattern_articles.begin(), pattern_articles.end(),
+            std::back_inserter(merged));
+        articles.swap(merged);
+        if (articles.size() > max_candidate_fraction * num_articles) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Returns the approximate memory footprint of the index in bytes.
+ */
+uint64_t TrigramIndex::size() const {
+    uint64_t size = postings.bucket_count() * sizeof(void*);
+    for (auto &entry : postings) {
+        size += sizeof(entry) + sizeof(void*) + entry.second.data.capacity();
+    }
+    return size;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/**
+ * Inverted index from byte trigrams to the articles containing them, used by
+ * the software word matcher to skip articles that cannot possibly match. Each
+ * posting list is stored as varint-encoded deltas between successive article
+ * indices. Patterns shorter than three bytes cannot use the index, and neither
+ * can patterns that occur in too many articles for skipping to be worth it.
+ */
+class TrigramIndex {
+private:
+
+    /**
+     * Posting list for a single trigram.
+     */
+    class Posting {
+    public:
+        std::vector<uint8_t> data;
+        uint32_t last = 0;
+        uint32_t count = 0;
+
+        /**
+         * Appends the given article index, which must be greater than the
+         * previous one.
+         */
+        void append(uint32_t article);
+
+        /**
+         * Decodes the article indices into `articles`.
+         */
+        void decode(std::vector<uint32_t> &articles) const;
+    };
+
+    std::unordered_map<uint32_t, Posting> postings;
+
+    // Total number of indexed articles.
+    uint32_t num_articles;
+
+    // Total time spent building the index in microseconds.
+    uint64_t build_time;
+
+    /**
+     * Writes the candidate articles for a single pattern to `articles`.
+     * Returns false if the index cannot narrow down the candidates for this
+     * pattern.
+     */
+    bool pattern_candidates(const std::string &pattern, std::vector<uint32_t> &articles) const;
+
+public:
+
+    /**
+     * Maximum fraction of the articles that may remain as candidates for the
+     * index to be used, rather than scanning all articles.
+     */
+    double max_candidate_fraction;
+
+    /**
+     * Constructs an empty index.
+     */
+    TrigramIndex();
+
+    /**
+     * Removes all articles from the index.
+     */
+    void clear();
+
+    /**
+     * Adds the Snappy-compressed articles described by the given Arrow binary
+     * array offsets and values buffers to the index. The articles are numbered
+     * consecutively, continuing from the previously added articles.
+     */
+    void add_articles(const int32_t *offsets, const char *values, int64_t num_rows);
+
+    /**
+     * Writes the sorted indices of the articles that may contain any of the
+     * given patterns to `articles`. Returns false if the index cannot narrow
+     * down the candidates, in which case all articles must be scanned.
+     */
+    bool candidates(const std::vector<std::string> &patterns, std::vector<uint32_t> &articles) const;
+
+    /**
+     * Returns the number of distinct trigrams in the index.
+     */
+    inline size_t num_trigrams() const {
+        return postings.size();
+    }
+
+    /**
+     * Returns the approximate memory footprint of the index in bytes.
+     */
+    uint64_t size() const;
+
+    /**
+     * Returns the total time spent building the index in microseconds.
+     */
+    inline uint64_t get_build_time() const {
+        return build_time;
+    }
+
+};
@@ -55,6 +55,20 @@ const size_t MmapFile::size() const {
     return siz;
 }
 
+/**
+ * Asks the kernel to start reading the pages of the given memory-mapped
+ * region from disk in the background, so they are resident by the time they
+ * are accessed. This is only a hint; errors are ignored.
+ */
+void prefetch_pages(const void *data, size_t size) {
+    static const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)data & ~(page_size - 1);
+    uintptr_t end = (uintptr_t)data + size;
+    if (end > start) {
+        madvise((void*)start, end - start, MADV_WILLNEED);
+    }
+}
+
 StdoutSuppressor::StdoutSuppressor() {
     fflush(stdout);
     real_stdout = dup(1);
@@ -36,6 +36,13 @@ public:
 
 };
 
+/**
+ * Asks the kernel to start reading the pages of the given memory-mapped
+ * region from disk in the background, so they are resident by the time they
+ * are accessed. This is only a hint; errors are ignored.
+ */
+void prefetch_pages(const void *data, size_t size);
+
 /**
  * XRT likes to spam error messages to stdout in addition to setting the OpenCL
  * result to the appropriate code. Unfortunately, there currently does not
@@ -2,6 +2,9 @@
 #include "word_match.hpp"
 #include <arrow/io/api.h>
 #include <arrow/ipc/api.h>
+#include <algorithm>
+
+const uint64_t WordMatchPartialResultsContainer::NO_POSITION;
 
 /**
  * Updates the pointers in the C struct to point to the STL containers.
@@ -19,8 +22,66 @@ void WordMatchPartialResultsContainer::synchronize() {
 }
 
 /**
- * Updates the pointers in the C struct to point to the STL containers.
- * Must be called after any of the containers are resized/reallocated.
+ * Adds the given page to the top-`k` heap, evicting the lowest ranked
+ * page if the heap is full. `ranks_top()` must have returned true. The
+ * title may be omitted and filled in later.
+ */
+void WordMatchPartialResultsContainer::add_top_page(
+    unsigned int k, unsigned int count, uint64_t position, const char *title, size_t title_size
+) {
+    if (cpp_top_pages.size() >= k) {
+        std::pop_heap(cpp_top_pages.begin(), cpp_top_pages.end(), WordMatchTopPage::ranks_before);
+        cpp_top_pages.pop_back();
+    }
+    cpp_top_pages.emplace_back();
+    auto &page = cpp_top_pages.back();
+    page.count = count;
+    page.position = position;
+    if (title) {
+        page.title.assign(title, title_size);
+    } else {
+        page.title.clear();
+    }
+    std::push_heap(cpp_top_pages.begin(), cpp_top_pages.end(), WordMatchTopPage::ranks_before);
+}
+
+/**
+ * Fills the top-`k` heap from the page match records and the page with
+ * the most matches, for implementations that cannot rank pages while
+ * matching. `position` is the position of the first record.
+ */
+void WordMatchPartialResultsContainer::rank_records(unsigned int k, uint64_t position) {
+    cpp_top_pages.clear();
+    bool max_page_recorded = cpp_page_match_counts.size() >= num_page_matches;
+    for (size_t i = 0; i < cpp_page_match_counts.size(); i++) {
+        unsigned int start = cpp_page_match_title_offsets[i];
+        unsigned int end = cpp_page_match_title_offsets[i + 1];
+        if (cpp_page_match_counts[i] == max_word_matches
+            && cpp_max_page_title.compare(0, std::string::npos, cpp_page_match_title_values, start, end - start) == 0)
+        {
+            max_page_recorded = true;
+        }
+        if (ranks_top(k, cpp_page_match_counts[i], position + i)) {
+            add_top_page(k, cpp_page_match_counts[i], position + i,
+                cpp_page_match_title_values.data() + start, end - start);
+        }
+    }
+
+    // The page with the most matches may not be among the records. Its
+    // position is unknown, so it is placed after them.
+    if (!max_page_recorded && max_word_matches
+        && ranks_top(k, max_word_matches, position + cpp_page_match_counts.size()))
+    {
+        add_top_page(k, max_word_matches, position + cpp_page_match_counts.size(),
+            cpp_max_page_title.data(), cpp_max_page_title.size());
+    }
+}
+
+/**
+ * Combines the partial results, merging their top page heaps into the
+ * final top-K ranking, and updates the pointers in the C struct to point
+ * to the STL containers. Must be called after any of the containers are
+ * resized/reallocated.
  */
 void WordMatchResultsContainer::synchronize() {
 
@@ -37,6 +98,62 @@ void WordMatchResultsContainer::synchronize() {
         }
     }
 
+    // Compute the load imbalance between the partial results.
+    unsigned long long total_time = 0;
+    unsigned int max_time = 0;
+    for (auto &presults : cpp_partial_results) {
+        total_time += presults.time_taken;
+        max_time = std::max(max_time, presults.time_taken);
+    }
+    if (total_time) {
+        imbalance = (float)max_time * cpp_partial_results.size() / total_time;
+    } else {
+        imbalance = 1.0f;
+    }
+
+    // Merge the top page heaps. Each heap holds the top pages of its part of
+    // the dataset, so the overall top pages are among them.
+    std::vector<const WordMatchTopPage*> top_pages;
+    for (auto &presults : cpp_partial_results) {
+        for (auto &page : presults.cpp_top_pages) {
+            top_pages.push_back(&page);
+        }
+    }
+    size_t num_top = std::min<size_t>(cpp_top_k, top_pages.size());
+    std::partial_sort(top_pages.begin(), top_pages.begin() + num_top, top_pages.end(),
+        [](const WordMatchTopPage *a, const WordMatchTopPage *b) {
+            return WordMatchTopPage::ranks_before(*a, *b);
+        });
+    cpp_top_page_counts.clear();
+    cpp_top_page_title_offsets.assign(1, 0);
+    cpp_top_page_title_values.clear();
+    for (size_t i = 0; i < num_top; i++) {
+        cpp_top_page_counts.push_back(top_pages[i]->count);
+        cpp_top_page_title_values.append(top_pages[i]->title);
+        cpp_top_page_title_offsets.push_back(cpp_top_page_title_values.size());
+    }
+
+    // Combine the profiling traces of the partial results in the order in
+    // which the commands were queued, relative to the first one.
+    cpp_trace_events.clear();
+    for (auto &presults : cpp_partial_results) {
+        cpp_trace_events.insert(cpp_trace_events.end(),
+            presults.cpp_trace_events.begin(), presults.cpp_trace_events.end());
+    }
+    std::stable_sort(cpp_trace_events.begin(), cpp_trace_events.end(),
+        [](const WordMatchTraceEvent &a, const WordMatchTraceEvent &b) {
+            return a.queued < b.queued;
+        });
+    if (!cpp_trace_events.empty()) {
+        unsigned long long origin = cpp_trace_events.front().queued;
+        for (auto &event : cpp_trace_events) {
+            event.queued -= origin;
+            event.submit -= origin;
+            event.start -= origin;
+            event.end -= origin;
+        }
+    }
+
     // Point the raw pointers to the appropriate STL structures.
     num_partial_results = cpp_partial_results.size();
     cpp_partial_result_ptrs.resize(num_partial_results);
@@ -44,7 +161,53 @@ void WordMatchResultsContainer::synchronize() {
         cpp_partial_result_ptrs[i] = &(cpp_partial_results[i]);
     }
     partial_results = cpp_partial_result_ptrs.data();
+    num_top_pages = cpp_top_page_counts.size();
+    top_page_counts = cpp_top_page_counts.data();
+    top_page_title_offsets = cpp_top_page_title_offsets.data();
+    top_page_title_values = cpp_top_page_title_values.c_str();
+    num_trace_events = cpp_trace_events.size();
+    trace_events = cpp_trace_events.data();
+
+}
+
+/**
+ * Replaces the contents of this container with a copy of the given
+ * results, and updates the pointers in the C structs to point to the
+ * copied containers.
+ */
+void WordMatchResultsContainer::assign(const WordMatchResultsContainer &other) {
+    *this = other;
 
+    // The raw pointers still refer to the containers they were copied from.
+    for (auto &presults : cpp_partial_results) {
+        presults.synchronize();
+    }
+    synchronize();
+}
+
+/**
+ * Called after the last chunk of a dataset has been added, for
+ * implementations that need to know the whole dataset before finishing
+ * the load. The default implementation does nothing.
+ */
+void WordMatch::finish_chunks(void (*progress)(void *user, const char *status), void *progress_user) {
+}
+
+/**
+ * Runs the kernel for each of the given configurations. The results are
+ * written to `this->batch_results`. The default implementation simply
+ * runs the configurations one by one; implementations may override this
+ * to share work between them.
+ */
+void WordMatch::execute_batch(
+    const std::vector<WordMatchConfig> &configs,
+    void (*progress)(void *user, const char *status), void *progress_user
+) {
+    batch_results.resize(configs.size());
+    for (size_t i = 0; i < configs.size(); i++) {
+        execute(configs[i], progress, progress_user);
+        batch_results[i].assign(results);
+    }
 }
 
 /**
@@ -102,8 +265,11 @@ std::shared_ptr<arrow::RecordBatch> WordMatchDatasetLoader::next() {
     set_state("load");
     std::string fname = prefix + "-" + std::to_string(cur_batch) + ".rb";
 
-    // Load the RecordBatch into the default memory pool as a single blob
-    // of data.
+    // Open the RecordBatch from a memory-mapped file. Its buffers point
+    // directly into the mapping, which stays alive for as long as any of
+    // them do. This avoids copying the data on the host: the software
+    // implementation reads it from the page cache, and the hardware
+    // implementation migrates it to the device from there.
     arrow::Result<std::shared_ptr<arrow::io::MemoryMappedFile>> result  = arrow::io::MemoryMappedFile::Open(fname, arrow::io::FileMode::type::READ);
     if (!result.ok()) {
         throw std::runtime_error("MemoryMappedFile::Open failed for " + fname + ": " + result.status().ToString());
@@ -124,32 +290,6 @@ std::shared_ptr<arrow::RecordBatch> WordMatchDatasetLoader::next() {
         throw std::runtime_error("ReadRecordBatch() failed for " + fname + ": " + batchResult.status().ToString());
     }
 
-    // In order to make the buffers individually freeable and aligned, we
-    // unfortunately need to copy the resulting RecordBatch entirely.
-    set_state("align");
-    std::vector<std::shared_ptr<arrow::ArrayData>> columns;
-    for (int col_idx = 0; col_idx < batch->num_columns(); col_idx++) {
-        std::shared_ptr<arrow::ArrayData> column = batch->column_data(col_idx);
-        std::vector<std::shared_ptr<arrow::Buffer>> buffers;
-        for (unsigned int buf_idx = 0; buf_idx < column->buffers.size(); buf_idx++) {
-            std::shared_ptr<arrow::Buffer> in_buffer = column->buffers[buf_idx];
-            if (!in_buffer) {
-                buffers.push_back(nullptr);
-                continue;
-            }
-            std::shared_ptr<arrow::Buffer> out_buffer;
-            arrow::Result<std::shared_ptr<arrow::Buffer>> bufferResult = in_buffer->CopySlice(0, in_buffer->size());
-            if (bufferResult.ok()) {
-                out_buffer = bufferResult.ValueOrDie();
-            } else {
-                throw std::runtime_error("Arrow buffer copy failed: " + bufferResult.status().ToString());
-            }
-            buffers.push_back(out_buffer);
-        }
-        columns.push_back(arrow::ArrayData::Make(column->type, column->length, buffers, column->null_count, column->offset));
-    }
-    batch = arrow::RecordBatch::Make(batch->schema(), batch->num_rows(), columns);
-
     // Transfer ownership to the caller.
     set_state("xfer");
     cur_batch++;
@@ -170,5 +310,8 @@ void WordMatchDatasetLoader::load(std::vector<std::shared_ptr<WordMatch>> impls)
             impl->add_chunk(chunk);
         }
     }
+    for (auto impl : impls) {
+        impl->finish_chunks(progress, progress_user);
+    }
 }
 
@@ -1,9 +1,12 @@
 #pragma once
 
 #include "ffi.h"
+#include <inttypes.h>
 #include <string>
 #include <vector>
 #include <memory>
+#include <atomic>
+#include <stdexcept>
 #include <arrow/api.h>
 #include <unistd.h>
 
@@ -15,12 +18,41 @@ public:
     std::string pattern;
     bool whole_words;
     uint16_t min_matches;
+    unsigned int top_k;
+    int complete_results;
 
-    WordMatchConfig(const std::string &pattern, bool whole_words=false, uint16_t min_matches=1)
-        : pattern(pattern), whole_words(whole_words), min_matches(min_matches)
+    WordMatchConfig(const std::string &pattern, bool whole_words=false, uint16_t min_matches=1, unsigned int top_k=0,
+        int complete_results=0)
+        : pattern(pattern), whole_words(whole_words), min_matches(min_matches), top_k(top_k),
+        complete_results(complete_results)
     {}
 };
 
+/**
+ * A page considered for the top-K ranking of a query.
+ */
+class WordMatchTopPage {
+public:
+
+    // Number of matches in the page.
+    unsigned int count;
+
+    // Position of the page in the dataset, used to break ties.
+    uint64_t position;
+
+    // Title of the page. This may be left empty while matching and filled in
+    // once it is known that the page made it into the final ranking.
+    std::string title;
+
+    /**
+     * Returns whether page `a` ranks higher than page `b`, i.e. whether it
+     * has more matches, or the same number of matches and comes first.
+     */
+    static inline bool ranks_before(const WordMatchTopPage &a, const WordMatchTopPage &b) {
+        return a.count > b.count || (a.count == b.count && a.position < b.position);
+    }
+};
+
 /**
  * Wrapper for `WordMatchPartialResults` that owns all contained data
  * STL-container style.
@@ -32,6 +64,52 @@ public:
     std::string cpp_page_match_title_values;
     std::string cpp_max_page_title;
 
+    // Positions in the dataset of the recorded page matches and of the page
+    // with the most matches, for implementations that only look up the
+    // titles after matching. `NO_POSITION` indicates that there is no page
+    // with the most matches yet.
+    static const uint64_t NO_POSITION = UINT64_MAX;
+    std::vector<uint64_t> cpp_page_match_positions;
+    uint64_t max_page_position = NO_POSITION;
+
+    // Bounded min-heap of the pages with the most matches, with the lowest
+    // ranked page at the front.
+    std::vector<WordMatchTopPage> cpp_top_pages;
+
+    // Profiling information of the commands issued for this chunk by the
+    // hardware implementation, with absolute OpenCL timestamps.
+    std::vector<WordMatchTraceEvent> cpp_trace_events;
+
+    /**
+     * Returns whether a page with the given match count and position would
+     * enter a top-`k` heap that already contains `cpp_top_pages`.
+     */
+    inline bool ranks_top(unsigned int k, unsigned int count, uint64_t position) const {
+        if (cpp_top_pages.size() < k) {
+            return true;
+        }
+        if (!k) {
+            return false;
+        }
+        const auto &last = cpp_top_pages.front();
+        return count > last.count || (count == last.count && position < last.position);
+    }
+
+    /**
+     * Adds the given page to the top-`k` heap, evicting the lowest ranked
+     * page if the heap is full. `ranks_top()` must have returned true. The
+     * title may be omitted and filled in later.
+     */
+    void add_top_page(unsigned int k, unsigned int count, uint64_t position,
+        const char *title = nullptr, size_t title_size = 0);
+
+    /**
+     * Fills the top-`k` heap from the page match records and the page with
+     * the most matches, for implementations that cannot rank pages while
+     * matching. `position` is the position of the first record.
+     */
+    void rank_records(unsigned int k, uint64_t position);
+
     /**
      * Updates the pointers in the C struct to point to the STL containers.
      * Must be called after any of the containers are resized/reallocated.
@@ -48,11 +126,78 @@ public:
     std::vector<WordMatchPartialResultsContainer> cpp_partial_results;
     std::vector<WordMatchPartialResults*> cpp_partial_result_ptrs;
 
+    // Number of top pages to select from the top page heaps of the partial
+    // results when synchronizing.
+    unsigned int cpp_top_k = 0;
+    std::vector<unsigned int> cpp_top_page_counts;
+    std::vector<unsigned int> cpp_top_page_title_offsets;
+    std::string cpp_top_page_title_values;
+
+    // Profiling trace combined from the partial results.
+    std::vector<WordMatchTraceEvent> cpp_trace_events;
+
     /**
-     * Updates the pointers in the C struct to point to the STL containers.
-     * Must be called after any of the containers are resized/reallocated.
+     * Combines the partial results, merging their top page heaps into the
+     * final top-K ranking, and updates the pointers in the C struct to point
+     * to the STL containers. Must be called after any of the containers are
+     * resized/reallocated.
      */
     void synchronize();
+
+    /**
+     * Replaces the contents of this container with a copy of the given
+     * results, and updates the pointers in the C structs to point to the
+     * copied containers.
+     */
+    void assign(const WordMatchResultsContainer &other);
+};
+
+/**
+ * Thrown by the implementations when a query is stopped through its
+ * `WordMatchControl`.
+ */
+class WordMatchCancelled : public std::runtime_error {
+public:
+    WordMatchCancelled() : std::runtime_error("query was cancelled") {}
+};
+
+/**
+ * Shared between a running query and the thread that submitted it. The
+ * implementations update the progress counters as they go, and poll the
+ * cancellation flag between chunks or blocks of articles, after which they
+ * stop starting new work and throw a `WordMatchCancelled`. Bytes are counted
+ * like the `data_size` result. For software runs, the chunks are the blocks
+ * of articles that the threads process.
+ */
+class WordMatchControl {
+public:
+    std::atomic<bool> cancelled;
+    std::atomic<unsigned int> chunks_done;
+    std::atomic<unsigned int> chunks_total;
+    std::atomic<unsigned long long> bytes_scanned;
+    std::atomic<unsigned long long> bytes_total;
+
+    WordMatchControl() : cancelled(false), chunks_done(0), chunks_total(0), bytes_scanned(0), bytes_total(0) {}
+
+    /**
+     * Resets the progress counters for a run over the given amount of work.
+     */
+    inline void start(unsigned int chunks, unsigned long long bytes) {
+        chunks_done = 0;
+        chunks_total = chunks;
+        bytes_scanned = 0;
+        bytes_total = bytes;
+    }
+
+    /**
+     * Throws a `WordMatchCancelled` if the query has been cancelled. Must not
+     * be called within an OpenMP parallel region.
+     */
+    inline void check() const {
+        if (cancelled) {
+            throw WordMatchCancelled();
+        }
+    }
 };
 
 /**
@@ -66,6 +211,12 @@ public:
      */
     WordMatchResultsContainer results;
 
+    /**
+     * Containers for the results of the latest batch of queries, one for
+     * each configuration, updated by `execute_batch()`.
+     */
+    std::vector<WordMatchResultsContainer> batch_results;
+
     virtual ~WordMatch() = default;
 
     /**
@@ -78,6 +229,13 @@ public:
      */
     virtual void add_chunk(const std::shared_ptr<arrow::RecordBatch> &batch) = 0;
 
+    /**
+     * Called after the last chunk of a dataset has been added, for
+     * implementations that need to know the whole dataset before finishing
+     * the load. The default implementation does nothing.
+     */
+    virtual void finish_chunks(void (*progress)(void *user, const char *status), void *progress_user);
+
     /**
      * Runs the kernel with the given configuration. The results are written to
      * `this->results`.
@@ -86,6 +244,16 @@ public:
         const WordMatchConfig &config,
         void (*progress)(void *user, const char *status), void *progress_user) = 0;
 
+    /**
+     * Runs the kernel for each of the given configurations. The results are
+     * written to `this->batch_results`. The default implementation simply
+     * runs the configurations one by one; implementations may override this
+     * to share work between them.
+     */
+    virtual void execute_batch(
+        const std::vector<WordMatchConfig> &configs,
+        void (*progress)(void *user, const char *status), void *progress_user);
+
 };
 
 /**
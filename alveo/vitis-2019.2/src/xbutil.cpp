@@ -9,6 +9,9 @@
 #include <glob.h>
 #include <string.h>
 #include <vector>
+#include <map>
+#include <mutex>
+#include <cstdlib>
 #include <sstream>
 #include <regex>
 #include <unistd.h>
@@ -44,6 +47,10 @@ std::vector<std::string> glob(const std::string& pattern) {
 
     // do the glob operation
     int return_value = glob(pattern.c_str(), GLOB_TILDE, NULL, &glob_result);
+    if(return_value == GLOB_NOMATCH) {
+        globfree(&glob_result);
+        return vector<string>();
+    }
     if(return_value != 0) {
         globfree(&glob_result);
         stringstream ss;
@@ -65,34 +72,41 @@ std::vector<std::string> glob(const std::string& pattern) {
 }
 
 /**
- * Look for the sysfs directories containing the sensor data and clock
- * frequency readout files. If one or both are not found, nullptrs are
- * returned. This function caches its findings after its first call.
+ * Sysfs directories containing the sensor data and clock frequency readout
+ * files for a card, or `use_xbutil` if they were not found.
  */
-static void get_paths(const std::string *&xmc_path_out, const std::string *&icap_path_out, unsigned int index) {
-    static bool first_run = true;
-    static bool use_xbutil = true;
-    static unsigned int cur_index = 0;
-    static std::string xmc_path;
-    static std::string icap_path;
-
-    xmc_path_out = nullptr;
-    icap_path_out = nullptr;
-
-    if (index != cur_index) {
-        cur_index = index;
-        first_run = true;
-    }
+struct CardPaths {
+    bool use_xbutil = true;
+    std::string xmc_path;
+    std::string icap_path;
+};
 
-    if (!first_run) {
-        if (!use_xbutil) {
-            xmc_path_out = &xmc_path;
-            icap_path_out = &icap_path;
-        }
-        return;
+/**
+ * Returns the root of the sysfs tree, which can be overridden with the
+ * `WORD_MATCH_SYSFS_ROOT` environment variable to test against a fake tree.
+ */
+std::string sysfs_root() {
+    const char *root = getenv("WORD_MATCH_SYSFS_ROOT");
+    return root ? root : "/sys";
+}
+
+/**
+ * Look for the sysfs directories containing the sensor data and clock
+ * frequency readout files. This function caches its findings for each card
+ * index after its first call for that index, and may be called from
+ * multiple threads.
+ */
+static CardPaths get_paths(unsigned int index) {
+    static std::mutex mutex;
+    static std::map<unsigned int, CardPaths> cache;
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = cache.find(index);
+    if (it != cache.end()) {
+        return it->second;
     }
 
-    first_run = false;
+    CardPaths &paths_out = cache[index];
 
     // When there are multiple devices, we need to use xbutil to tell us what
     // the device ID is for the card with the given index. If this fails for
@@ -110,22 +124,22 @@ static void get_paths(const std::string *&xmc_path_out, const std::string *&icap
     }
 
     // Look for xmc node, which contains sensor readout files.
-    auto paths = glob("/sys/bus/pci/devices/" + id + "/xmc.m.*");
+    std::string devices = sysfs_root() + "/bus/pci/devices/";
+    auto paths = glob(devices + id + "/xmc.m.*");
     if (paths.empty()) {
-        return;
+        return paths_out;
     }
-    xmc_path = paths.front();
+    std::string xmc_path = paths.front();
 
     // Look for icap node, which contains the frequency readout file.
-    paths = glob("/sys/bus/pci/devices/" + id + "/icap.m.*");
+    paths = glob(devices + id + "/icap.m.*");
     if (paths.empty()) {
-        return;
+        return paths_out;
     }
-    icap_path = paths.front();
-
-    use_xbutil = false;
-    xmc_path_out = &xmc_path;
-    icap_path_out = &icap_path;
+    paths_out.xmc_path = xmc_path;
+    paths_out.icap_path = paths.front();
+    paths_out.use_xbutil = false;
+    return paths_out;
 }
 
 /**
@@ -169,13 +183,11 @@ static void read_sysfs_floats(const std::string &filename, int num_vals, std::ve
  * Runs `xbutil dump` and puts some information into the given structure.
  */
 void xbutil_dump(XBUtilDumpInfo &info, unsigned int index) {
-    const std::string *xmc_path;
-    const std::string *icap_path;
-    get_paths(xmc_path, icap_path, index);
+    CardPaths paths = get_paths(index);
 
     std::vector<float> data;
 
-    if (xmc_path == nullptr) {
+    if (paths.use_xbutil) {
 
         // Failed to find sysfs nodes to read the values we want, so fall back
         // to calling xbutil dump.
@@ -193,14 +205,14 @@ void xbutil_dump(XBUtilDumpInfo &info, unsigned int index) {
     } else {
 
         // Use sysfs nodes to query information.
-        read_sysfs_floats(*icap_path + "/clock_freqs", 2, data);
-        read_sysfs_floats(*xmc_path + "/xmc_fpga_temp", 1, data);
-        read_sysfs_floats(*xmc_path + "/xmc_12v_pex_vol", 1, data);
-        read_sysfs_floats(*xmc_path + "/xmc_12v_pex_curr", 1, data);
-        read_sysfs_floats(*xmc_path + "/xmc_12v_aux_vol", 1, data);
-        read_sysfs_floats(*xmc_path + "/xmc_12v_aux_curr", 1, data);
-        read_sysfs_floats(*xmc_path + "/xmc_vccint_vol", 1, data);
-        read_sysfs_floats(*xmc_path + "/xmc_vccint_curr", 1, data);
+        read_sysfs_floats(paths.icap_path + "/clock_freqs", 2, data);
+        read_sysfs_floats(paths.xmc_path + "/xmc_fpga_temp", 1, data);
+        read_sysfs_floats(paths.xmc_path + "/xmc_12v_pex_vol", 1, data);
+        read_sysfs_floats(paths.xmc_path + "/xmc_12v_pex_curr", 1, data);
+        read_sysfs_floats(paths.xmc_path + "/xmc_12v_aux_vol", 1, data);
+        read_sysfs_floats(paths.xmc_path + "/xmc_12v_aux_curr", 1, data);
+        read_sysfs_floats(paths.xmc_path + "/xmc_vccint_vol", 1, data);
+        read_sysfs_floats(paths.xmc_path + "/xmc_vccint_curr", 1, data);
 
     }
 
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <string>
+#include <vector>
+
 /**
  * Structure with some relevant information received from xbutil dump.
  */
@@ -24,3 +27,14 @@ typedef struct {
  * Runs `xbutil dump` and puts some information into the given structure.
  */
 void xbutil_dump(XBUtilDumpInfo &info, unsigned int index);
+
+/**
+ * Returns the root of the sysfs tree, which can be overridden with the
+ * `WORD_MATCH_SYSFS_ROOT` environment variable to test against a fake tree.
+ */
+std::string sysfs_root();
+
+/**
+ * Returns the paths matching the given glob pattern.
+ */
+std::vector<std::string> glob(const std::string& pattern);
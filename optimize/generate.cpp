@@ -0,0 +1,473 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <set>
+#include <arrow/api.h>
+#include <unistd.h>
+#include <arrow/io/api.h>
+#include <arrow/ipc/api.h>
+#include <snappy.h>
+#include <omp.h>
+#include <string.h>
+#include <ctype.h>
+
+/**
+ * Small, fast random number generator (splitmix64). The standard library
+ * distributions are implementation-defined, so all sampling is done with
+ * this generator to make datasets identical across platforms.
+ */
+class Random {
+private:
+    uint64_t state;
+
+public:
+    Random(uint64_t seed, uint64_t stream = 0) : state(seed * 0x9E3779B97F4A7C15ull + stream) {
+        next();
+        next();
+    }
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform double in [0, 1).
+    double uniform() {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    // Uniform integer in [0, n).
+    uint64_t below(uint64_t n) {
+        return next() % n;
+    }
+
+    // Standard normal variate (Box-Muller).
+    double normal() {
+        double u1 = 1.0 - uniform();
+        double u2 = uniform();
+        return sqrt(-2.0 * log(u1)) * cos(6.283185307179586 * u2);
+    }
+};
+
+/**
+ * Generator configuration.
+ */
+struct Config {
+    std::string prefix;
+    uint64_t num_articles = 100000;
+    unsigned int num_chunks = 15;
+    uint64_t seed = 1;
+    double median_words = 400;
+    double sigma = 1.0;
+    unsigned int vocabulary_size = 50000;
+    double zipf = 1.0;
+
+    // Patterns to plant: the pattern, the number of articles to plant it in,
+    // and the number of times to plant it in each of those articles.
+    struct Plant {
+        std::string pattern;
+        uint64_t pages;
+        unsigned int per_page;
+    };
+    std::vector<Plant> plants;
+};
+
+/**
+ * Reference match counts for a single pattern.
+ */
+struct Counts {
+    unsigned long long word_matches = 0;
+    unsigned long long page_matches = 0;
+    unsigned long long max_word_matches = 0;
+
+    void add(unsigned int matches) {
+        word_matches += matches;
+        if (matches) page_matches++;
+        max_word_matches = std::max<unsigned long long>(max_word_matches, matches);
+    }
+
+    void merge(const Counts &other) {
+        word_matches += other.word_matches;
+        page_matches += other.page_matches;
+        max_word_matches = std::max(max_word_matches, other.max_word_matches);
+    }
+};
+
+/**
+ * Counts the (possibly overlapping) occurrences of the pattern in the text
+ * the same way the original software word matcher did.
+ */
+unsigned int count_matches(const std::string &text, const std::string &pattern, bool whole_words) {
+    unsigned int num_matches = 0;
+    const char *begin = text.c_str();
+    const char *end = begin + strlen(begin);
+    size_t patsize = pattern.size();
+    for (const char *ptr = begin; ptr + patsize <= end; ptr++) {
+        if (strncmp(ptr, pattern.c_str(), patsize)) {
+            continue;
+        }
+        if (whole_words) {
+            if (ptr > begin && (isalnum(ptr[-1]) || ptr[-1] == '_')) {
+                continue;
+            }
+            if (ptr + patsize < end && (isalnum(ptr[patsize]) || ptr[patsize] == '_')) {
+                continue;
+            }
+        }
+        num_matches++;
+    }
+    return num_matches;
+}
+
+/**
+ * Text generator with a Zipf-distributed vocabulary.
+ */
+class Vocabulary {
+private:
+    std::vector<std::string> words;
+    std::vector<double> cdf;
+
+public:
+    Vocabulary(const Config &config) {
+        Random rng(config.seed, 0x766f636162ull);
+        std::set<std::string> seen;
+        while (words.size() < config.vocabulary_size) {
+
+            // Words of 1 to 5 syllables, with short words being more likely,
+            // to get text that compresses somewhat like natural language.
+            static const char *onsets[] = {
+                "", "b", "c", "d", "f", "g", "h", "k", "l", "m", "n", "p", "r", "s", "t",
+                "v", "w", "st", "th", "tr", "ch", "sh", "pr", "br", "gr", "pl"};
+            static const char *vowels[] = {"a", "e", "i", "o", "u", "ea", "ou", "io", "y"};
+            static const char *codas[] = {"", "", "", "n", "r", "s", "t", "l", "nd", "ng", "st", "m"};
+            unsigned int syllables = 1 + (unsigned int)std::min(4.0, fabs(rng.normal()) * 1.5);
+            std::string word;
+            for (unsigned int i = 0; i < syllables; i++) {
+                word += onsets[rng.below(sizeof(onsets) / sizeof(onsets[0]))];
+                word += vowels[rng.below(sizeof(vowels) / sizeof(vowels[0]))];
+                word += codas[rng.below(sizeof(codas) / sizeof(codas[0]))];
+            }
+            if (seen.insert(word).second) {
+                words.push_back(word);
+            }
+        }
+
+        // Build the cumulative distribution for rank-based Zipf sampling.
+        double sum = 0.0;
+        cdf.resize(words.size());
+        for (size_t i = 0; i < words.size(); i++) {
+            sum += 1.0 / pow((double)(i + 1), config.zipf);
+            cdf[i] = sum;
+        }
+        for (auto &c : cdf) {
+            c /= sum;
+        }
+    }
+
+    const std::string &sample(Random &rng) const {
+        size_t index = std::lower_bound(cdf.begin(), cdf.end(), rng.uniform()) - cdf.begin();
+        return words[std::min(index, words.size() - 1)];
+    }
+};
+
+/**
+ * Generates the title and text of the given article. `plants` lists the
+ * indices of the planted patterns that must be inserted in this article.
+ */
+void generate_article(
+    const Config &config, const Vocabulary &vocabulary, uint64_t article,
+    const std::vector<unsigned int> &plants, std::string &title, std::string &text)
+{
+    Random rng(config.seed, article + 1);
+
+    // Generate the title.
+    title.clear();
+    unsigned int title_words = 1 + rng.below(3);
+    for (unsigned int i = 0; i < title_words; i++) {
+        std::string word = vocabulary.sample(rng);
+        word[0] = toupper(word[0]);
+        if (i) title += " ";
+        title += word;
+    }
+    title += " (" + std::to_string(article) + ")";
+
+    // Draw the article size from a log-normal distribution.
+    uint64_t num_words = (uint64_t)(config.median_words * exp(config.sigma * rng.normal()));
+    num_words = std::max<uint64_t>(num_words, 1);
+
+    // Decide where to plant the patterns.
+    std::vector<std::pair<uint64_t, unsigned int>> inserts;
+    for (auto plant : plants) {
+        for (unsigned int i = 0; i < config.plants[plant].per_page; i++) {
+            inserts.emplace_back(rng.below(num_words + 1), plant);
+        }
+    }
+    std::sort(inserts.begin(), inserts.end());
+
+    // Generate sentences of words, with the occasional link and paragraph
+    // break.
+    text.clear();
+    size_t next_insert = 0;
+    unsigned int sentence_left = 0;
+    for (uint64_t wi = 0; wi <= num_words; wi++) {
+        while (next_insert < inserts.size() && inserts[next_insert].first == wi) {
+            if (!text.empty()) text += ' ';
+            text += config.plants[inserts[next_insert].second].pattern;
+            next_insert++;
+        }
+        if (wi == num_words) {
+            break;
+        }
+        bool sentence_start = !sentence_left;
+        if (sentence_start) {
+            if (!text.empty()) {
+                text += rng.below(8) ? ". " : ".\n\n";
+            }
+            sentence_left = 5 + rng.below(16);
+        } else {
+            text += ' ';
+        }
+        sentence_left--;
+        std::string word = vocabulary.sample(rng);
+        if (sentence_start) {
+            word[0] = toupper(word[0]);
+        }
+        if (!rng.below(50)) {
+            text += "[[" + word + "]]";
+        } else {
+            text += word;
+        }
+    }
+    text += ".\n";
+}
+
+/**
+ * Writes a single record batch to the given file.
+ */
+void write_batch(const std::string &fname, const std::shared_ptr<arrow::RecordBatch> &batch) {
+    std::shared_ptr<arrow::io::FileOutputStream> file;
+    arrow::Result<std::shared_ptr<arrow::io::FileOutputStream>> fopen_result = arrow::io::FileOutputStream::Open(fname);
+    if (fopen_result.ok()) {
+        file = fopen_result.ValueOrDie();
+    } else {
+        throw std::runtime_error("FileOutputStream::Open failed for " + fname + ": " + fopen_result.status().ToString());
+    }
+    std::shared_ptr<arrow::ipc::RecordBatchWriter> writer;
+    arrow::Result<std::shared_ptr<arrow::ipc::RecordBatchWriter>> newfw_result = arrow::ipc::NewFileWriter(file.get(), batch->schema());
+    if (newfw_result.ok()) {
+        writer = newfw_result.ValueOrDie();
+    } else {
+        throw std::runtime_error("RecordBatchFileWriter::Open failed for " + fname + ": " + newfw_result.status().ToString());
+    }
+    arrow::Status status = writer->WriteRecordBatch(*batch);
+    if (!status.ok()) {
+        throw std::runtime_error("RecordBatchFileWriter::WriteRecordBatch failed for " + fname + ": " + status.ToString());
+    }
+    status = writer->Close();
+    if (!status.ok()) {
+        throw std::runtime_error("RecordBatchFileWriter::Close failed for " + fname + ": " + status.ToString());
+    }
+}
+
+/**
+ * Generates the dataset.
+ */
+void generate(const Config &config) {
+
+    // Use the same schema as the data generation program.
+    auto schema = arrow::schema({
+        arrow::field("title", arrow::utf8(), false),
+        arrow::field("text", arrow::binary(), false,
+            arrow::key_value_metadata({"fletcher_epc"}, {"8"}))
+    }, arrow::key_value_metadata({"fletcher_mode", "fletcher_name"}, {"read", "Pages"}));
+
+    printf("Generating vocabulary of %u words...\n", config.vocabulary_size);
+    Vocabulary vocabulary(config);
+
+    // Select the articles for each planted pattern.
+    std::vector<std::vector<unsigned int>> article_plants(config.num_articles);
+    for (unsigned int pi = 0; pi < config.plants.size(); pi++) {
+        Random rng(config.seed, 0x706c616e74ull + pi);
+        std::set<uint64_t> pages;
+        while (pages.size() < config.plants[pi].pages) {
+            pages.insert(rng.below(config.num_articles));
+        }
+        for (auto page : pages) {
+            article_plants[page].push_back(pi);
+        }
+    }
+
+    // Reference counts for each planted pattern, for substring and
+    // whole-word matching.
+    std::vector<Counts> counts(config.plants.size() * 2);
+    unsigned long long uncompressed_size = 0;
+    unsigned long long compressed_size = 0;
+
+    for (unsigned int ci = 0; ci < config.num_chunks; ci++) {
+        uint64_t first = config.num_articles * ci / config.num_chunks;
+        uint64_t last = config.num_articles * (ci + 1) / config.num_chunks;
+        printf("  Generate batch %u (articles %llu to %llu)...\n", ci,
+            (unsigned long long)first, (unsigned long long)last);
+
+        // Generate and compress the articles in parallel.
+        std::vector<std::string> titles(last - first);
+        std::vector<std::string> datas(last - first);
+        #pragma omp parallel
+        {
+            std::vector<Counts> thread_counts(counts.size());
+            unsigned long long thread_size = 0;
+            std::string text;
+            #pragma omp for schedule(dynamic, 64)
+            for (uint64_t ai = first; ai < last; ai++) {
+                generate_article(config, vocabulary, ai, article_plants[ai], titles[ai - first], text);
+                snappy::Compress(text.data(), text.size(), &datas[ai - first]);
+                thread_size += text.size();
+                for (size_t pi = 0; pi < config.plants.size(); pi++) {
+                    thread_counts[2 * pi].add(count_matches(text, config.plants[pi].pattern, false));
+                    thread_counts[2 * pi + 1].add(count_matches(text, config.plants[pi].pattern, true));
+                }
+            }
+            #pragma omp critical
+            {
+                for (size_t i = 0; i < counts.size(); i++) {
+                    counts[i].merge(thread_counts[i]);
+                }
+                uncompressed_size += thread_size;
+            }
+        }
+
+        // Build the record batch.
+        arrow::StringBuilder title_builder;
+        arrow::BinaryBuilder text_builder;
+        arrow::Status status;
+        for (size_t i = 0; i < titles.size(); i++) {
+            status = title_builder.Append(titles[i]);
+            if (!status.ok()) {
+                throw std::runtime_error("StringBuilder::Append failed (title): " + status.ToString());
+            }
+            status = text_builder.Append(datas[i]);
+            if (!status.ok()) {
+                throw std::runtime_error("BinaryBuilder::Append failed (text): " + status.ToString());
+            }
+            compressed_size += datas[i].size();
+        }
+        std::shared_ptr<arrow::Array> title_array;
+        std::shared_ptr<arrow::Array> text_array;
+        status = title_builder.Finish(&title_array);
+        if (!status.ok()) {
+            throw std::runtime_error("StringBuilder::Finish failed: " + status.ToString());
+        }
+        status = text_builder.Finish(&text_array);
+        if (!status.ok()) {
+            throw std::runtime_error("BinaryBuilder::Finish failed: " + status.ToString());
+        }
+        auto batch = arrow::RecordBatch::Make(schema, titles.size(), {title_array, text_array});
+
+        printf("  Write batch %u...\n", ci);
+        write_batch(config.prefix + "-" + std::to_string(ci) + ".rb", batch);
+    }
+
+    printf("Generated %llu articles, %llu bytes uncompressed, %llu bytes compressed.\n",
+        (unsigned long long)config.num_articles, uncompressed_size, compressed_size);
+
+    // Write the reference counts for the planted patterns.
+    if (!config.plants.empty()) {
+        std::string fname = config.prefix + ".expected";
+        FILE *f = fopen(fname.c_str(), "w");
+        if (!f) {
+            throw std::runtime_error("failed to open " + fname);
+        }
+        fprintf(f, "# pattern\twhole_words\tnum_word_matches\tnum_page_matches\tmax_word_matches\n");
+        for (size_t pi = 0; pi < config.plants.size(); pi++) {
+            for (int ww = 0; ww < 2; ww++) {
+                auto &c = counts[2 * pi + ww];
+                fprintf(f, "%s\t%d\t%llu\t%llu\t%llu\n", config.plants[pi].pattern.c_str(), ww,
+                    c.word_matches, c.page_matches, c.max_word_matches);
+            }
+        }
+        fclose(f);
+        printf("Wrote reference counts to %s.\n", fname.c_str());
+    }
+
+}
+
+void usage(const char *name) {
+    printf("Usage: %s [options] <output-prefix>\n", name);
+    printf("Options:\n");
+    printf("  -n <articles>      number of articles (default 100000)\n");
+    printf("  -c <chunks>        number of record batches (default 15)\n");
+    printf("  -s <seed>          random seed (default 1)\n");
+    printf("  -w <words>         median article size in words (default 400)\n");
+    printf("  -d <sigma>         log-normal sigma of the article size (default 1.0)\n");
+    printf("  -v <words>         vocabulary size (default 50000)\n");
+    printf("  -z <exponent>      Zipf exponent of the word frequencies (default 1.0)\n");
+    printf("  -p <pattern>:<pages>[:<per-page>]\n");
+    printf("                     plant the pattern <per-page> times (default 1) in\n");
+    printf("                     <pages> random articles; may be repeated\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+
+    // Parse command line.
+    Config config;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:c:s:w:d:v:z:p:")) != -1) {
+        switch (opt) {
+            case 'n': config.num_articles = strtoull(optarg, NULL, 10); break;
+            case 'c': config.num_chunks = atoi(optarg); break;
+            case 's': config.seed = strtoull(optarg, NULL, 10); break;
+            case 'w': config.median_words = atof(optarg); break;
+            case 'd': config.sigma = atof(optarg); break;
+            case 'v': config.vocabulary_size = atoi(optarg); break;
+            case 'z': config.zipf = atof(optarg); break;
+            case 'p': {
+                std::string arg = optarg;
+                Config::Plant plant;
+                size_t colon = arg.rfind(':');
+                if (colon == std::string::npos || !colon) usage(argv[0]);
+                plant.per_page = 1;
+                std::string pages = arg.substr(colon + 1);
+                arg.resize(colon);
+                size_t colon2 = arg.rfind(':');
+                if (colon2 != std::string::npos && colon2 && colon2 + 1 < arg.size()
+                    && std::all_of(arg.begin() + colon2 + 1, arg.end(), ::isdigit))
+                {
+                    plant.per_page = atoi(pages.c_str());
+                    pages = arg.substr(colon2 + 1);
+                    arg.resize(colon2);
+                }
+                plant.pattern = arg;
+                plant.pages = strtoull(pages.c_str(), NULL, 10);
+                config.plants.push_back(plant);
+                break;
+            }
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+    config.prefix = argv[optind];
+    if (!config.num_articles || !config.num_chunks || !config.vocabulary_size
+        || config.num_chunks > config.num_articles)
+    {
+        printf("Error: the number of articles, chunks and words must be nonzero, and there cannot be more chunks than articles.\n");
+        exit(1);
+    }
+    for (auto &plant : config.plants) {
+        if (plant.pattern.empty() || plant.pages > config.num_articles) {
+            printf("Error: cannot plant \"%s\" in %llu of %llu articles.\n", plant.pattern.c_str(),
+                (unsigned long long)plant.pages, (unsigned long long)config.num_articles);
+            exit(1);
+        }
+    }
+
+    // Execute the command.
+    generate(config);
+
+}
@@ -7,6 +7,7 @@
 #include <arrow/io/api.h>
 #include <arrow/ipc/api.h>
 #include <omp.h>
+#include "placement.hpp"
 
 std::shared_ptr<arrow::Table> read_input(const std::string &in_prefix) {
     printf("Reading record batches with prefix %s...\n", in_prefix.c_str());
@@ -57,7 +58,7 @@ std::shared_ptr<arrow::Table> read_input(const std::string &in_prefix) {
     return table;
 }
 
-void write_output(std::shared_ptr<arrow::Table> table, const std::string &out_prefix, const unsigned int num_chunks) {
+std::vector<uint64_t> write_output(std::shared_ptr<arrow::Table> table, const std::string &out_prefix, const unsigned int num_chunks) {
     auto title_chunks = table->column(0);
     auto data_chunks = table->column(1);
 
@@ -71,6 +72,8 @@ void write_output(std::shared_ptr<arrow::Table> table, const std::string &out_pr
 
     unsigned int current_chunk = 0;
     int64_t data_count = 0;
+    int64_t chunk_start = 0;
+    std::vector<uint64_t> chunk_bytes;
     arrow::Status status;
 
     std::unique_ptr<arrow::RecordBatchBuilder> builder;
@@ -126,6 +129,8 @@ void write_output(std::shared_ptr<arrow::Table> table, const std::string &out_pr
                     writer->Close();
                 }
                 printf("  Finished writing batch %u\n", current_chunk);
+                chunk_bytes.push_back(data_count - chunk_start);
+                chunk_start = data_count;
 
                 current_chunk += 1;
             }
@@ -137,13 +142,21 @@ void write_output(std::shared_ptr<arrow::Table> table, const std::string &out_pr
         throw std::runtime_error("checksum failure");
     }
 
+    return chunk_bytes;
+}
+
+void report_placement(const std::vector<uint64_t> &chunk_bytes, const unsigned int num_instances) {
+    printf("Predicted placement on %u kernel instances:\n", num_instances);
+    ChunkPlacement placement(num_instances);
+    placement.plan(chunk_bytes, chunk_bytes);
+    printf("%s", placement.report().c_str());
 }
 
 int main(int argc, char *argv[]) {
 
     // Parse command line.
     if (argc < 3) {
-        printf("Usage: %s <input-prefix> <output-prefix> [number-of-chunks=15]\n", argv[0]);
+        printf("Usage: %s <input-prefix> <output-prefix> [number-of-chunks=15] [number-of-instances=15]\n", argv[0]);
         exit(1);
     }
     std::string input_prefix  = argv[1];
@@ -152,8 +165,15 @@ int main(int argc, char *argv[]) {
     if (num_chunks < 1) {
         num_chunks = 15;
     }
+    int num_instances = (argc > 4) ? atoi(argv[4]) : 0;
+    if (num_instances < 1) {
+        num_instances = 15;
+    }
 
     // Execute the command.
-    write_output(read_input(input_prefix), output_prefix, num_chunks);
+    auto chunk_bytes = write_output(read_input(input_prefix), output_prefix, num_chunks);
+
+    // Show how the host code would place the chunks on the kernel instances.
+    report_placement(chunk_bytes, num_instances);
 
 }
@@ -4,7 +4,6 @@ extern crate lazy_static;
 use crypto::{digest::Digest, sha1::Sha1};
 use serde::{Deserialize, Serialize};
 use std::{
-    collections::HashMap,
     ffi::{CStr, CString},
     fs::File,
     io::{Read, Write},
@@ -42,6 +41,7 @@ struct QueryStats {
     input_size: u64,
     time_taken_ms: u32,
     bandwidth: String,
+    energy_j: f64,
 }
 
 #[derive(Debug, Serialize)]
@@ -77,6 +77,7 @@ struct ServerStatus {
     fpga_temp: f32,
     power_in: f32,
     power_vccint: f32,
+    coalesced_queries: u64,
 }
 
 impl warp::Reply for ServerStatus {
@@ -125,11 +126,20 @@ fn go_query(query: QueryParameters) -> Result<impl warp::Reply, warp::Rejection>
         whole_words: if query.whole_words { 1 } else { 0 },
         min_matches: query.min_matches,
         mode: query.mode,
+        top_k: 100,
+        complete_results: 1,
     };
 
-    // Run the kernel.
+    // Run the kernel. Queries may be handled concurrently, so we use the
+    // reentrant API, which returns results that we own.
     let result = unsafe {
-        word_match_run(&mut config, Some(ffi_update_status), std::ptr::null_mut()).as_ref()
+        word_match_query(
+            word_match_context(),
+            &mut config,
+            Some(ffi_update_status),
+            std::ptr::null_mut(),
+        )
+        .as_ref()
     };
     update_status("Ready");
     let retval = if result.is_none() {
@@ -137,60 +147,41 @@ fn go_query(query: QueryParameters) -> Result<impl warp::Reply, warp::Rejection>
     } else {
         let result = result.unwrap();
 
-        // Whether all matching results were returned, or there were
-        // more matches than result slots in at least one of the chunks.
-        let mut all_known = true;
+        // Whether the ranking is exact, or there were more matches than
+        // result slots in at least one of the chunks on hardware.
+        let all_known = result.top_pages_exact != 0;
 
         // Approximate number of compressed bytes processed in total.
         let mut input_size = 0u64;
-
-        let mut results = HashMap::new();
         for partial in
             unsafe { from_raw_parts(result.partial_results, result.num_partial_results as usize) }
         {
-            let partial = unsafe { **partial };
-
-            // Always add the page with the most matches.
-            if partial.max_word_matches >= query.min_matches {
-                results.insert(
-                    unsafe {
-                        CStr::from_ptr(partial.max_page_title)
-                            .to_string_lossy()
-                            .to_string()
-                    },
-                    partial.max_word_matches,
-                );
-            }
+            input_size += unsafe { (**partial).data_size } as u64;
+        }
 
-            // Add the N first matches found for this chunk.
-            let num_records = partial.num_page_match_records as usize;
-            let title_values = unsafe {
-                CStr::from_ptr(partial.page_match_title_values)
-                    .to_string_lossy()
-                    .to_string()
-            };
-            let title_offsets =
-                unsafe { from_raw_parts(partial.page_match_title_offsets, num_records + 1) };
-            let match_counts = unsafe { from_raw_parts(partial.page_match_counts, num_records) };
-            for i in 0..num_records as usize {
+        // The results are already ranked by the library.
+        let num_result_records = result.num_top_pages;
+        let title_offsets = unsafe {
+            from_raw_parts(result.top_page_title_offsets, num_result_records as usize + 1)
+        };
+        let title_values = unsafe {
+            from_raw_parts(
+                result.top_page_title_values as *const u8,
+                title_offsets[num_result_records as usize] as usize,
+            )
+        };
+        let match_counts =
+            unsafe { from_raw_parts(result.top_page_counts, num_result_records as usize) };
+        let mut results: Vec<(String, u32)> = (0..num_result_records as usize)
+            .map(|i| {
                 let start = title_offsets[i] as usize;
                 let stop = title_offsets[i + 1] as usize;
-                results.insert(title_values[start..stop].to_string(), match_counts[i]);
-            }
-
-            // Check if there were more matches in this chunk than there was room for.
-            if partial.num_page_match_records < partial.num_page_matches {
-                all_known = false;
-            }
-
-            // Accumulate input size.
-            input_size += partial.data_size as u64;
-        }
-
-        // Sort the results.
-        let mut results: Vec<(String, u32)> = results.into_iter().collect();
-        results.sort_by(|(at, ac), (bt, bc)| (bc, at).partial_cmp(&(ac, bt)).unwrap());
-        let num_result_records = results.len() as u32;
+                (
+                    String::from_utf8_lossy(&title_values[start..stop]).to_string(),
+                    match_counts[i],
+                )
+            })
+            .collect();
 
         // Separate into the top result, the subsequent 9 in the top 10 if the
         // sorting is valid, and 90 of the remaining results for a nice layout
@@ -222,12 +213,16 @@ fn go_query(query: QueryParameters) -> Result<impl warp::Reply, warp::Rejection>
                     "{:.2} GB/s",
                     ((input_size as f32) / (result.time_taken as f32)) / 1000f32
                 ),
+                energy_j: result.energy,
             },
             top_result,
             top_ten_results,
             other_results,
         })
     };
+    if let Some(result) = result {
+        unsafe { word_match_results_free(result) };
+    }
     println!("<- query");
     retval
 }
@@ -343,12 +338,14 @@ fn get_wiki_img(query: WikiImageParameters) -> Result<impl warp::Reply, warp::Re
 fn get_status() -> Result<impl warp::Reply, warp::Rejection> {
     println!("-> status");
     let health = unsafe { word_match_health() };
+    let cache_info = unsafe { word_match_cache_info() };
     let static_status = FFI_STATUS.lock().unwrap();
     let retval = Ok(ServerStatus {
         status: static_status.deref().to_string(),
         fpga_temp: health.fpga_temp,
         power_in: health.power_in,
         power_vccint: health.power_vccint,
+        coalesced_queries: cache_info.coalesced,
     });
     println!("<- status");
     retval
@@ -419,7 +416,13 @@ fn main() -> Result<(), ()> {
         emu_mode: emu_mode.as_ptr(),
         kernel_name: kernel_name.as_ptr(),
         num_subkernels: 3u32,
+        hw_profiling: 0i32,
         keep_loaded: 1i32,
+        sw_streaming: 1i32,
+        sw_work_stealing: 0i32,
+        sw_trigram_index: 0i32,
+        result_cache_size: 256u64 << 20,
+        health_interval_ms: 1000u32,
     };
 
     // Initialize